@@ -0,0 +1,385 @@
+// fugu_bench: headless microbenchmarks, results are written as JSON.
+//
+// Run from bin/ so the compiled shaders are found. To benchmark on a software
+// driver, select it through the loader, e.g. with Mesa's lavapipe:
+//   VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json ./fugu_bench --out bench.json
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include "vulkan/instance.hpp"
+#include "vulkan/shader.hpp"
+#include "vulkan/buffer.hpp"
+#include "vulkan/staging.hpp"
+#include "vulkan/descriptor.hpp"
+#include "vulkan/pipeline.hpp"
+#include "vulkan/recorder.hpp"
+#include "util/threadpool.hpp"
+
+using namespace std;
+typedef chrono::steady_clock Clock;
+
+static double msSince(Clock::time_point start)
+{
+	return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+// Minimal streaming JSON writer, enough for nested objects and arrays of numbers and strings
+class JsonWriter
+{
+public:
+	JsonWriter(ostream& out) : out(out) {}
+
+	void beginObject(const char* name = nullptr) { open(name, '{'); }
+	void endObject() { close('}'); }
+	void beginArray(const char* name) { open(name, '['); }
+	void endArray() { close(']'); }
+	void value(const char* name, double v) { key(name); out << v; }
+	void value(const char* name, uint64_t v) { key(name); out << v; }
+	void value(const char* name, bool v) { key(name); out << (v ? "true" : "false"); }
+	void value(const char* name, const string& v)
+	{
+		key(name);
+		out << '"';
+		for (char c : v)
+			if (c != '"' && c != '\\' && (unsigned char)c >= 0x20)
+				out << c;
+		out << '"';
+	}
+
+private:
+	void key(const char* name)
+	{
+		if (!first.empty()) {
+			out << (first.back() ? "\n" : ",\n") << string(2 * first.size(), ' ');
+			first.back() = false;
+		}
+		if (name)
+			out << '"' << name << "\": ";
+	}
+	void open(const char* name, char c)
+	{
+		key(name);
+		out << c;
+		first.push_back(true);
+	}
+	void close(char c)
+	{
+		first.pop_back();
+		out << "\n" << string(2 * first.size(), ' ') << c;
+		if (first.empty())
+			out << "\n";
+	}
+
+	ostream& out;
+	vector<bool> first;
+};
+
+static void benchBuffers(VulkanInstance& inst, JsonWriter& json)
+{
+	const size_t sizes[] = { 4 * 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024 };
+	StagingRing staging(inst);
+
+	json.beginArray("buffers");
+	for (size_t size : sizes) {
+		int count = (int)max<size_t>(4, min<size_t>(256, 64 * 1024 * 1024 / size));
+		vector<char> data(size, 0x5a);
+		vector<unique_ptr<VulkanBuffer>> buffers;
+
+		// host visible: create, then write through the persistent mapping
+		auto t = Clock::now();
+		for (int i = 0; i < count; i++)
+			buffers.push_back(make_unique<VulkanBuffer>(*inst.allocator, size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT));
+		double createMs = msSince(t);
+		t = Clock::now();
+		for (auto& buf : buffers)
+			buf->upload(data.data());
+		double hostMs = msSince(t);
+		buffers.clear();
+
+		// device local, through the staging ring until the copies completed
+		t = Clock::now();
+		for (int i = 0; i < count; i++)
+			buffers.push_back(make_unique<VulkanBuffer>(*inst.allocator, size,
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+		double createDeviceMs = msSince(t);
+		t = Clock::now();
+		for (auto& buf : buffers)
+			buf->upload(staging, data.data(), size);
+		staging.finish();
+		double stagedMs = msSince(t);
+		buffers.clear();
+
+		double totalGB = (double)size * count / (1024.0 * 1024.0 * 1024.0);
+		json.beginObject();
+		json.value("size", (uint64_t)size);
+		json.value("count", (uint64_t)count);
+		json.value("createHostUs", createMs * 1000.0 / count);
+		json.value("createDeviceUs", createDeviceMs * 1000.0 / count);
+		json.value("hostUploadGBs", totalGB / (hostMs / 1000.0));
+		json.value("stagedUploadGBs", totalGB / (stagedMs / 1000.0));
+		json.endObject();
+	}
+	json.endArray();
+}
+
+static void benchDescriptors(VulkanInstance& inst, JsonWriter& json)
+{
+	const int numSets = 10000, rounds = 3;
+	DescriptorSetLayout desc(inst.device);
+	desc.add(0, DescriptorSetLayout::UniformBuffer, DescriptorSetLayout::Both);
+	desc.create();
+	VulkanBuffer ubo(*inst.allocator, 256, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+	FrameDescriptors frame(inst.device, 1);
+
+	VkDescriptorBufferInfo bufferInfo;
+	bufferInfo.buffer = ubo.buffer;
+	bufferInfo.offset = 0;
+	bufferInfo.range = ubo.size;
+
+	// the first round grows the pools, later rounds reuse them
+	double allocMs = 0, updateMs = 0, resetMs = 0;
+	vector<VkDescriptorSet> sets(numSets);
+	for (int r = 0; r < rounds; r++) {
+		auto t = Clock::now();
+		frame.beginFrame(0);
+		resetMs = msSince(t);
+
+		t = Clock::now();
+		for (auto& set : sets)
+			set = frame.allocate(desc);
+		allocMs = msSince(t);
+
+		t = Clock::now();
+		for (auto set : sets) {
+			VkWriteDescriptorSet write = {};
+			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			write.pNext = nullptr;
+			write.dstSet = set;
+			write.dstBinding = 0;
+			write.dstArrayElement = 0;
+			write.descriptorCount = 1;
+			write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			write.pBufferInfo = &bufferInfo;
+			vkUpdateDescriptorSets(inst.device, 1, &write, 0, nullptr);
+		}
+		updateMs = msSince(t);
+	}
+	frame.beginFrame(0);
+
+	json.beginObject("descriptors");
+	json.value("sets", (uint64_t)numSets);
+	json.value("allocPerSec", numSets / (allocMs / 1000.0));
+	json.value("updatePerSec", numSets / (updateMs / 1000.0));
+	json.value("resetUs", resetMs * 1000.0);
+	json.endObject();
+}
+
+static vector<PipelineState> pipelineVariants(const Shader& vert, const Shader& frag, const DescriptorSetLayout& desc, VkRenderPass renderPass)
+{
+	const VkCullModeFlags culls[] = { VK_CULL_MODE_NONE, VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_FRONT_BIT };
+	const VkPrimitiveTopology topologies[] = { VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP, VK_PRIMITIVE_TOPOLOGY_LINE_LIST };
+	const VkCompareOp compares[] = { VK_COMPARE_OP_LESS_OR_EQUAL, VK_COMPARE_OP_ALWAYS };
+
+	vector<PipelineState> states;
+	for (auto cull : culls)
+		for (auto topology : topologies)
+			for (auto compare : compares) {
+				PipelineState state;
+				state.vert = &vert;
+				state.frag = &frag;
+				state.layout = desc.pipelineLayout;
+				state.renderPass = renderPass;
+				state.cullMode = cull;
+				state.topology = topology;
+				state.depthCompare = compare;
+				state.setVertexInputs();
+				states.push_back(state);
+			}
+	return states;
+}
+
+static void benchPipelines(VulkanInstance& inst, const Shader& vert, const Shader& frag, const DescriptorSetLayout& desc, JsonWriter& json)
+{
+	const string cachePath = "bench_pipeline.cache", manifestPath = "bench_pipeline.manifest";
+	auto states = pipelineVariants(vert, frag, desc, inst.renderPass);
+	remove(cachePath.c_str());
+	remove(manifestPath.c_str());
+
+	// cold: empty driver cache; the destructor saves it for the warm run
+	auto t = Clock::now();
+	{
+		PipelineCache cache(inst, nullptr, cachePath, manifestPath);
+		for (auto& state : states)
+			cache.get(state);
+	}
+	double coldMs = msSince(t);
+
+	t = Clock::now();
+	bool loaded;
+	{
+		PipelineCache cache(inst, nullptr, cachePath, manifestPath);
+		loaded = cache.loadedFromDisk;
+		for (auto& state : states)
+			cache.get(state);
+	}
+	double warmMs = msSince(t);
+	remove(cachePath.c_str());
+	remove(manifestPath.c_str());
+
+	json.beginObject("pipelines");
+	json.value("count", (uint64_t)states.size());
+	json.value("coldMsPerPipeline", coldMs / states.size());
+	json.value("warmMsPerPipeline", warmMs / states.size());
+	json.value("warmLoadedFromDisk", loaded);
+	json.endObject();
+}
+
+struct Vertex {
+	float pos[4];
+	float color[4];
+};
+
+static void benchDraws(VulkanInstance& inst, const Shader& vert, const Shader& frag, DescriptorSetLayout& desc, JsonWriter& json)
+{
+	const int numFrames = 50, drawsPerFrame = 5000;
+	vector<Vertex> triangle = {
+		{ { -0.01f, -0.01f, 0.5f, 1.0f }, { 1.0f, 0.0f, 0.0f, 1.0f } },
+		{ {  0.01f, -0.01f, 0.5f, 1.0f }, { 0.0f, 1.0f, 0.0f, 1.0f } },
+		{ {  0.0f,   0.01f, 0.5f, 1.0f }, { 0.0f, 0.0f, 1.0f, 1.0f } },
+	};
+	StagingRing staging(inst);
+	VertexBuffer<Vertex> vb(*inst.allocator, (int)triangle.size());
+	vb.upload(staging, triangle);
+	staging.finish();
+
+	PipelineCache pipelines(inst, nullptr, "bench_draw.cache", "bench_draw.manifest");
+	PipelineState state;
+	state.vert = &vert;
+	state.frag = &frag;
+	state.layout = desc.pipelineLayout;
+	state.renderPass = inst.renderPass;
+	state.cullMode = VK_CULL_MODE_NONE;
+	state.setVertexInputs();
+	VkPipeline pipeline = pipelines.get(state);
+
+	// the same draws, recorded inline or into secondaries on the workers
+	auto recordDraws = [&](VkCommandBuffer cmd, int begin, int end) {
+		float mvp[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		VkDeviceSize offset = 0;
+		vkCmdBindVertexBuffers(cmd, 0, 1, &vb.buffer, &offset);
+		for (int i = begin; i < end; i++) {
+			// spread the triangles over the screen
+			mvp[12] = (i % 100) * 0.02f - 1.0f;
+			mvp[13] = (i / 100 % 100) * 0.02f - 1.0f;
+			desc.pushConstants(cmd, DescriptorSetLayout::Vertex, mvp, sizeof(mvp));
+			vkCmdDraw(cmd, (uint32_t)triangle.size(), 1, 0, 0);
+		}
+	};
+	auto runFrames = [&](ParallelRecorder* recorder, double& recordMs) {
+		recordMs = 0;
+		auto start = Clock::now();
+		for (int f = 0; f < numFrames; f++) {
+			VkCommandBuffer cmd = inst.beginFrame();
+			auto t = Clock::now();
+			if (recorder) {
+				recorder->beginFrame();
+				inst.beginRenderPass(cmd, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+				recorder->record(cmd, drawsPerFrame, recordDraws, inst.renderPass, 0, inst.frameBuffers[inst.curSwap]);
+			} else {
+				inst.beginRenderPass(cmd);
+				recordDraws(cmd, 0, drawsPerFrame);
+			}
+			vkCmdEndRenderPass(cmd);
+			recordMs += msSince(t);
+			inst.endFrame();
+		}
+		inst.waitIdle();
+		return msSince(start);
+	};
+
+	double recordMs, parallelRecordMs;
+	double totalMs = runFrames(nullptr, recordMs);
+	ThreadPool threads;
+	double parallelMs;
+	int slices;
+	{
+		ParallelRecorder recorder(inst, threads);
+		slices = recorder.numSlices;
+		parallelMs = runFrames(&recorder, parallelRecordMs);
+	}
+	remove("bench_draw.cache");
+	remove("bench_draw.manifest");
+
+	uint64_t draws = (uint64_t)numFrames * drawsPerFrame;
+	json.beginObject("draws");
+	json.value("frames", (uint64_t)numFrames);
+	json.value("drawsPerFrame", (uint64_t)drawsPerFrame);
+	json.value("recordNsPerDraw", recordMs * 1e6 / draws);
+	json.value("drawsPerSec", draws / (totalMs / 1000.0));
+	json.value("msPerFrame", totalMs / numFrames);
+	json.beginObject("parallel");
+	json.value("slices", (uint64_t)slices);
+	json.value("recordNsPerDraw", parallelRecordMs * 1e6 / draws);
+	json.value("drawsPerSec", draws / (parallelMs / 1000.0));
+	json.value("msPerFrame", parallelMs / numFrames);
+	json.endObject();
+	json.endObject();
+}
+
+int main(int argc, char* argv[])
+{
+	string outPath;
+	for (int i = 1; i < argc; i++)
+		if (string(argv[i]) == "--out" && i + 1 < argc)
+			outPath = argv[++i];
+
+	ostringstream out;
+	JsonWriter json(out);
+	json.beginObject();
+
+	auto t = Clock::now();
+	VulkanInstance inst("fugu_bench", 256, 256);
+	double startupMs = msSince(t);
+
+	const auto& props = inst.gpu->gpuProps;
+	json.beginObject("device");
+	json.value("name", string(props.deviceName));
+	json.value("vendorID", (uint64_t)props.vendorID);
+	json.value("driverVersion", (uint64_t)props.driverVersion);
+	json.value("apiVersion", (uint64_t)props.apiVersion);
+	json.endObject();
+	json.beginObject("startup");
+	json.value("instanceAndDeviceMs", startupMs);
+	json.endObject();
+
+	benchBuffers(inst, json);
+	benchDescriptors(inst, json);
+
+	Shader vert(inst.device, "simple.vert");
+	Shader frag(inst.device, "simple.frag");
+	DescriptorLayoutCache layouts(inst.device);
+	DescriptorSetLayout& desc = *layouts.get({ &vert, &frag });
+	benchPipelines(inst, vert, frag, desc, json);
+	benchDraws(inst, vert, frag, desc, json);
+
+	json.endObject();
+	inst.waitIdle();
+
+	if (outPath.empty()) {
+		cout << out.str();
+	} else {
+		ofstream ofs(outPath, ios::trunc);
+		if (!ofs.is_open())
+			fatalError("Can't write " + outPath);
+		ofs << out.str();
+	}
+	return 0;
+}
@@ -0,0 +1,305 @@
+#include "deferred.hpp"
+#include "vulkan/instance.hpp"
+using namespace std;
+
+DeferredRenderer::DeferredRenderer(VulkanInstance& inst, PipelineCache& pipelines) :
+	inst(inst), pipelines(pipelines), lightVert(inst.device, "fullscreen.vert"), lightFrag(inst.device, "lighting.frag"),
+	lightLayout(inst.device)
+{
+	createAttachments();
+	createRenderPass();
+	createFramebuffers();
+
+	lightLayout.add(lightVert);
+	lightLayout.add(lightFrag);
+	lightLayout.create();
+	lightBinding = lightLayout.createBinding();
+	lightBinding->setImage(0, albedo.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	lightBinding->setImage(1, normal.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	lightBinding->setImage(2, depth.view, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+	lightBinding->apply();
+	createLightPipeline();
+}
+
+DeferredRenderer::~DeferredRenderer()
+{
+	pipelines.evict(renderPass);
+	destroyFramebuffers();
+	destroyAttachments();
+	VkDevice device = inst.device;
+	VkRenderPass pass = renderPass;
+	inst.defer([device, pass] { vkDestroyRenderPass(device, pass, nullptr); });
+}
+
+bool DeferredRenderer::resize()
+{
+	destroyFramebuffers();
+	bool newPass = colorFormat != inst.format;
+	if (newPass) {
+		pipelines.evict(renderPass);
+		VkDevice device = inst.device;
+		VkRenderPass pass = renderPass;
+		inst.defer([device, pass] { vkDestroyRenderPass(device, pass, nullptr); });
+		createRenderPass();
+		createLightPipeline();
+	}
+	if (width != inst.width || height != inst.height) {
+		destroyAttachments();
+		createAttachments();
+		// recreateSwapChain waited for the device, so the set isn't in use
+		lightBinding->setImage(0, albedo.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		lightBinding->setImage(1, normal.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		lightBinding->setImage(2, depth.view, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+		lightBinding->apply();
+	}
+	createFramebuffers();
+	return newPass;
+}
+
+void DeferredRenderer::createLightPipeline()
+{
+	// the lighting subpass can't do anything without its pipeline, so don't
+	// compile it in the background
+	PipelineState state;
+	state.vert = &lightVert;
+	state.frag = &lightFrag;
+	state.layout = lightLayout.pipelineLayout;
+	state.renderPass = renderPass;
+	state.subpass = 1;
+	state.cullMode = VK_CULL_MODE_NONE;
+	state.depthTest = false;
+	state.depthWrite = false;
+	lightPipeline = pipelines.get(state);
+}
+
+void DeferredRenderer::createAttachments()
+{
+	width = inst.width;
+	height = inst.height;
+	albedo = createAttachment(albedoFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+	normal = createAttachment(normalFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+	depth = createAttachment(inst.depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT);
+}
+
+void DeferredRenderer::createFramebuffers()
+{
+	for (auto& swap : inst.swapImages) {
+		VkImageView attachments[4] = { swap.view, albedo.view, normal.view, depth.view };
+
+		VkFramebufferCreateInfo info = {};
+		info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		info.pNext = nullptr;
+		info.renderPass = renderPass;
+		info.attachmentCount = 4;
+		info.pAttachments = attachments;
+		info.width = inst.width;
+		info.height = inst.height;
+		info.layers = 1;
+
+		VkFramebuffer buf;
+		vkAssert(vkCreateFramebuffer(inst.device, &info, nullptr, &buf), "create framebuffer");
+		frameBuffers.push_back(buf);
+	}
+}
+
+void DeferredRenderer::destroyFramebuffers()
+{
+	VkDevice device = inst.device;
+	vector<VkFramebuffer> old = move(frameBuffers);
+	frameBuffers.clear();
+	inst.defer([device, old] {
+		for (auto fb : old)
+			vkDestroyFramebuffer(device, fb, nullptr);
+	});
+}
+
+void DeferredRenderer::destroyAttachments()
+{
+	VkDevice device = inst.device;
+	MemoryAllocator* allocator = inst.allocator.get();
+	for (Attachment a : { albedo, normal, depth }) {
+		inst.defer([device, allocator, a] {
+			vkDestroyImageView(device, a.view, nullptr);
+			vkDestroyImage(device, a.image, nullptr);
+			allocator->free(a.mem);
+		});
+	}
+}
+
+DeferredRenderer::Attachment DeferredRenderer::createAttachment(VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect)
+{
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.pNext = nullptr;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = format;
+	imageInfo.extent.width = inst.width;
+	imageInfo.extent.height = inst.height;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = inst.numSamples;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.queueFamilyIndexCount = 0;
+	imageInfo.pQueueFamilyIndices = nullptr;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.usage = usage | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+	imageInfo.flags = 0;
+
+	Attachment a;
+	vkAssert(vkCreateImage(inst.device, &imageInfo, nullptr, &a.image), "create G-buffer image");
+	a.mem = inst.allocator->bindImage(a.image,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, true);
+
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.pNext = nullptr;
+	viewInfo.format = format;
+	viewInfo.components.r = VK_COMPONENT_SWIZZLE_R;
+	viewInfo.components.g = VK_COMPONENT_SWIZZLE_G;
+	viewInfo.components.b = VK_COMPONENT_SWIZZLE_B;
+	viewInfo.components.a = VK_COMPONENT_SWIZZLE_A;
+	viewInfo.subresourceRange.aspectMask = aspect;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.flags = 0;
+	viewInfo.image = a.image;
+	vkAssert(vkCreateImageView(inst.device, &viewInfo, nullptr, &a.view), "create G-buffer view");
+	return a;
+}
+
+void DeferredRenderer::createRenderPass()
+{
+	// 0: swapchain image, 1: albedo, 2: normals, 3: depth
+	VkAttachmentDescription attachments[4] = {};
+	for (auto& a : attachments) {
+		a.samples = inst.numSamples;
+		a.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		a.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		a.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		a.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		a.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		a.flags = 0;
+	}
+	// lighting covers every pixel, so the swapchain image is neither cleared nor loaded
+	colorFormat = inst.format;
+	attachments[0].format = colorFormat;
+	attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachments[0].finalLayout = inst.headless ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	attachments[1].format = albedoFormat;
+	attachments[1].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	attachments[2].format = normalFormat;
+	attachments[2].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	attachments[3].format = inst.depthFormat;
+	attachments[3].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+	VkAttachmentReference gbufferRefs[2] = {
+		{ 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL },
+		{ 2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL },
+	};
+	VkAttachmentReference depthRef = { 3, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+	VkAttachmentReference inputRefs[3] = {
+		{ 1, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+		{ 2, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+		{ 3, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL },
+	};
+	VkAttachmentReference colorRef = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+
+	VkSubpassDescription subpasses[2] = {};
+	subpasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpasses[0].colorAttachmentCount = 2;
+	subpasses[0].pColorAttachments = gbufferRefs;
+	subpasses[0].pDepthStencilAttachment = &depthRef;
+	subpasses[1].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpasses[1].inputAttachmentCount = 3;
+	subpasses[1].pInputAttachments = inputRefs;
+	subpasses[1].colorAttachmentCount = 1;
+	subpasses[1].pColorAttachments = &colorRef;
+
+	VkSubpassDependency dependencies[3] = {};
+	// The G-buffer is shared by the frames in flight: the previous frame's
+	// lighting reads and G-buffer writes must be done before it is cleared
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	// The swapchain image is first used by lighting, once the acquire
+	// semaphore (waited at color output) signals
+	dependencies[1].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[1].dstSubpass = 1;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[1].srcAccessMask = 0;
+	dependencies[1].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	// Lighting reads only its own pixel of the G-buffer, so the dependency is
+	// per region and never has to leave the tile
+	dependencies[2].srcSubpass = 0;
+	dependencies[2].dstSubpass = 1;
+	dependencies[2].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[2].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	dependencies[2].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[2].dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+	dependencies[2].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+	VkRenderPassCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	info.pNext = nullptr;
+	info.attachmentCount = 4;
+	info.pAttachments = attachments;
+	info.subpassCount = 2;
+	info.pSubpasses = subpasses;
+	info.dependencyCount = 3;
+	info.pDependencies = dependencies;
+	vkAssert(vkCreateRenderPass(inst.device, &info, nullptr, &renderPass), "create deferred render pass");
+}
+
+PipelineState DeferredRenderer::geometryState(const Shader& vert, const Shader& frag, VkPipelineLayout layout) const
+{
+	PipelineState state;
+	state.vert = &vert;
+	state.frag = &frag;
+	state.layout = layout;
+	state.renderPass = renderPass;
+	state.subpass = 0;
+	state.colorAttachments = 2;
+	return state;
+}
+
+void DeferredRenderer::begin(VkCommandBuffer cmd)
+{
+	VkClearValue clearValues[4] = {};
+	clearValues[3].depthStencil.depth = 1.0f;
+	clearValues[3].depthStencil.stencil = 0;
+
+	VkRenderPassBeginInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	info.pNext = nullptr;
+	info.renderPass = renderPass;
+	info.framebuffer = frameBuffers[inst.curSwap];
+	info.renderArea.offset.x = 0;
+	info.renderArea.offset.y = 0;
+	info.renderArea.extent.width = inst.width;
+	info.renderArea.extent.height = inst.height;
+	info.clearValueCount = 4;
+	info.pClearValues = clearValues;
+	vkCmdBeginRenderPass(cmd, &info, VK_SUBPASS_CONTENTS_INLINE);
+	inst.setViewport(cmd);
+}
+
+void DeferredRenderer::end(VkCommandBuffer cmd)
+{
+	vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, lightPipeline);
+	lightBinding->bind(cmd);
+	vkCmdDraw(cmd, 3, 1, 0, 0);
+	vkCmdEndRenderPass(cmd);
+}
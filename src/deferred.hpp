@@ -0,0 +1,70 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include "vulkan/vkmain.hpp"
+#include "vulkan/memory.hpp"
+#include "vulkan/shader.hpp"
+#include "vulkan/pipeline.hpp"
+
+class VulkanInstance;
+
+// G-buffer and lighting in a single render pass. Subpass 0 writes albedo,
+// normals and depth; subpass 1 reads them back at the same pixel as input
+// attachments and shades a fullscreen triangle into the swapchain image.
+// The G-buffer never leaves the render pass: its attachments are created
+// transient with lazily allocated memory where the device has it, cleared on
+// load and never stored, so tilers keep them on chip.
+class DeferredRenderer
+{
+public:
+	DeferredRenderer(VulkanInstance& inst, PipelineCache& pipelines);
+	// Evicts the pipelines built for the render pass
+	~DeferredRenderer();
+	DeferredRenderer(const DeferredRenderer&) = delete;
+	DeferredRenderer& operator=(const DeferredRenderer&) = delete;
+
+	// After the swapchain was recreated: rebuilds the framebuffers, and the
+	// G-buffer if the extent changed. Returns true if the swapchain format
+	// changed too, which recreates the render pass, so pipelines from
+	// geometryState() have to be recreated.
+	bool resize();
+
+	// Begin the render pass in the G-buffer subpass
+	void begin(VkCommandBuffer cmd);
+	// Light the G-buffer and end the render pass
+	void end(VkCommandBuffer cmd);
+	// State for G-buffer pipelines; their fragment shader writes albedo to
+	// location 0 and normals (0..1 encoded) to location 1
+	PipelineState geometryState(const Shader& vert, const Shader& frag, VkPipelineLayout layout) const;
+
+	struct Attachment {
+		VkImage image;
+		VkImageView view;
+		Allocation mem;
+	};
+
+	VulkanInstance& inst;
+	PipelineCache& pipelines;
+	VkFormat albedoFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	VkFormat normalFormat = VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+	Attachment albedo, normal, depth;
+	VkRenderPass renderPass;
+	std::vector<VkFramebuffer> frameBuffers; // one per swapchain image
+	Shader lightVert, lightFrag;
+	DescriptorSetLayout lightLayout;
+	std::unique_ptr<Binding> lightBinding;
+	VkPipeline lightPipeline;
+
+private:
+	Attachment createAttachment(VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect);
+	void createRenderPass();
+	void createLightPipeline();
+	void createAttachments();
+	void createFramebuffers();
+	// Destruction waits for the frames in flight, see VulkanInstance::defer
+	void destroyAttachments();
+	void destroyFramebuffers();
+
+	int width, height;
+	VkFormat colorFormat;
+};
@@ -5,26 +5,405 @@
 #include <algorithm>
 #include <vector>
 #include <thread>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <cmath>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
 #include "vulkan/instance.hpp"
 #include "vulkan/shader.hpp"
+#include "vulkan/buffer.hpp"
+#include "vulkan/staging.hpp"
+#include "vulkan/transfer.hpp"
+#include "vulkan/pipeline.hpp"
+#include "vulkan/profiler.hpp"
+#include "vulkan/rendergraph.hpp"
+#include "vulkan/devicepool.hpp"
+#include "vulkan/readback.hpp"
+#include "util/threadpool.hpp"
+#include "util/archive.hpp"
+#include "particles.hpp"
+#include "deferred.hpp"
+#include "scene.hpp"
 #include "platform/window.hpp"
 
 using namespace std;
 
-int main()
+// 12 bytes instead of two float4, simple.vert still reads vec4s
+struct Vertex {
+	Half4 pos;
+	Unorm8x4 color;
+	static constexpr std::array<VertexAttribute, 2> attributes() {
+		return {{ vertexAttribute<Half4>(0, offsetof(Vertex, pos)), vertexAttribute<Unorm8x4>(1, offsetof(Vertex, color)) }};
+	}
+};
+static_assert(std::get<1>(VertexLayout<Vertex>::attributes(1)).binding == 1 &&
+	std::get<1>(VertexLayout<Vertex>::attributes(1)).offset == offsetof(Vertex, color), "vertex layout isn't constexpr");
+
+static const char* usage =
+	"usage: fugu [options]\n"
+	"  --headless                render offscreen, without a window or swapchain\n"
+	"  --trace                   write GPU scope timings to gpu_trace.json\n"
+	"  --deferred                shade through the G-buffer path\n"
+	"  --gpu-driven              add a field of objects culled on the GPU\n"
+	"  --present-mode MODE       fifo, mailbox or immediate\n"
+	"  --images N                swapchain images, 0 for the default\n"
+	"  --frames-in-flight N      frames the CPU records ahead, 1 to 16\n"
+	"  --max-fps N               CPU frame limit, 0 for unlimited\n"
+	"  --frame-stats             write frame time histograms to frame_stats.json\n"
+	"  --device N                use VulkanInstance::gpus[N]\n"
+	"  --batch N                 render N offscreen frames on every device and exit\n"
+	"  --verify-assets           check the checksums of assets from assets.pak\n"
+	"  --capture PATTERN         write every frame, e.g. frame_%05d.png\n"
+#ifndef _WIN32
+	"Windows only has a window backend so far, here rendering is always headless.\n"
+#endif
+	;
+
+// The whole of s as an integer in [lo, hi]
+static bool parseInt(const char* s, long lo, long hi, long& value)
+{
+	char* end;
+	errno = 0;
+	long v = strtol(s, &end, 10);
+	if (end == s || *end != '\0' || errno == ERANGE || v < lo || v > hi)
+		return false;
+	value = v;
+	return true;
+}
+
+static bool parseDouble(const char* s, double lo, double hi, double& value)
+{
+	char* end;
+	errno = 0;
+	double v = strtod(s, &end);
+	// written so NaN fails too
+	if (end == s || *end != '\0' || errno == ERANGE || !(v >= lo && v <= hi))
+		return false;
+	value = v;
+	return true;
+}
+
+int main(int argc, char* argv[])
 {
 	const char* appName = "Fugu Vulkan Example";
-	Window wnd(appName, 640, 480);
-	VulkanInstance inst(appName, &wnd);
+
+	// --headless renders offscreen, without a window or swapchain
+	// --trace writes GPU scope timings to gpu_trace.json on exit
+	// --deferred shades the triangle through the G-buffer path, particles aren't drawn
+	// --gpu-driven adds a field of objects culled and drawn indirectly on the GPU
+	// --present-mode fifo|mailbox|immediate, --images N, --frames-in-flight N and
+	// --max-fps N trade latency against throughput
+	// --frame-stats writes frame time histograms to frame_stats.json on exit
+	// --device N picks VulkanInstance::gpus[N] instead of the best scoring device
+	// --batch N spreads N offscreen frames over every usable device and exits
+	// --verify-assets checks the checksum of each asset loaded from assets.pak
+	// --capture frame_%05d.png writes every frame, PNG or raw by extension,
+	// without stalling: frames the encoder can't keep up with are dropped
+	bool headless = false, trace = false, deferredPath = false, gpuDriven = false, frameStats = false;
+	bool verifyAssets = false;
+	VulkanConfig config;
+	int batchFrames = 0;
+	string capturePattern;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		int flag = i;
+		long n;
+		bool ok = true;
+		if (arg == "--headless")
+			headless = true;
+		else if (arg == "--trace")
+			trace = true;
+		else if (arg == "--deferred")
+			deferredPath = true;
+		else if (arg == "--gpu-driven")
+			gpuDriven = true;
+		else if (arg == "--frame-stats")
+			frameStats = true;
+		else if (arg == "--verify-assets")
+			verifyAssets = true;
+		else if (arg == "--present-mode" && hasValue) {
+			string mode = argv[++i];
+			if (mode == "fifo")
+				config.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+			else if (mode == "immediate")
+				config.presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+			else if (mode == "mailbox")
+				config.presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+			else
+				ok = false;
+		} else if (arg == "--images" && hasValue) {
+			ok = parseInt(argv[++i], 0, 16, n);
+			config.imageCount = (uint32_t)n;
+		} else if (arg == "--frames-in-flight" && hasValue) {
+			ok = parseInt(argv[++i], 1, 16, n);
+			config.framesInFlight = (int)n;
+		} else if (arg == "--max-fps" && hasValue)
+			ok = parseDouble(argv[++i], 0.0, 100000.0, config.maxFps);
+		else if (arg == "--device" && hasValue) {
+			ok = parseInt(argv[++i], 0, INT_MAX, n);
+			config.deviceIndex = (int)n;
+		} else if (arg == "--batch" && hasValue) {
+			ok = parseInt(argv[++i], 1, INT_MAX, n);
+			batchFrames = (int)n;
+		} else if (arg == "--capture" && hasValue)
+			capturePattern = argv[++i];
+		else
+			ok = false;
+		if (!ok) {
+			cerr << "bad argument " << arg;
+			if (i > flag)
+				cerr << " " << argv[i];
+			cerr << "\n" << usage;
+			return 1;
+		}
+	}
+#ifndef _WIN32
+	// Window and VulkanInstance only have a Win32 surface so far
+	if (!headless)
+		cerr << "no window support on this platform, rendering headless" << endl;
+	headless = true;
+#endif
+
+	// shaders come from loose files when there is no archive
+	Archive assets;
+	if (assets.open("assets.pak", verifyAssets))
+		Archive::active = &assets;
+
+	if (batchFrames > 0) {
+		DevicePool pool(appName, 640, 480, 1, config);
+		auto start = chrono::steady_clock::now();
+		for (int i = 0; i < batchFrames; i++) {
+			pool.submit([](VulkanInstance& inst, int) {
+				VkCommandBuffer cmd = inst.beginFrame();
+				inst.beginRenderPass(cmd);
+				vkCmdEndRenderPass(cmd);
+				inst.endFrame();
+			});
+		}
+		pool.wait();
+		for (auto& device : pool.devices)
+			device->waitIdle();
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		for (int i = 0; i < pool.size(); i++)
+			cout << pool.devices[i]->gpu->gpuProps.deviceName << ": " << pool.jobsRun[i] << " frames" << endl;
+		cout << batchFrames / seconds << " frames/s on " << pool.size() << " devices" << endl;
+		return 0;
+	}
+
+	unique_ptr<Window> wnd;
+	unique_ptr<VulkanInstance> instPtr;
+	if (headless) {
+		instPtr = make_unique<VulkanInstance>(appName, 640, 480, config);
+	} else {
+		wnd = make_unique<Window>(appName, 640, 480);
+		instPtr = make_unique<VulkanInstance>(appName, wnd.get(), config);
+	}
+	VulkanInstance& inst = *instPtr;
 	
 	Shader vert(inst.device, "simple.vert");
 	Shader frag(inst.device, "simple.frag");
-	DescriptorSetLayout desc(inst.device);
-	desc.add(0, DescriptorSetLayout::UniformBuffer, DescriptorSetLayout::Vertex);
-	desc.create();
+	DescriptorLayoutCache layouts(inst.device);
+	DescriptorSetLayout& desc = *layouts.get({ &vert, &frag });
+
+	vector<Vertex> triangle = {
+		{ half4(-0.5f, -0.5f, 0.5f), unorm8x4(1.0f, 0.0f, 0.0f) },
+		{ half4( 0.5f, -0.5f, 0.5f), unorm8x4(0.0f, 1.0f, 0.0f) },
+		{ half4( 0.0f,  0.5f, 0.5f), unorm8x4(0.0f, 0.0f, 1.0f) },
+	};
+	// uploaded on the transfer queue, the frames draw it once it was acquired
+	UploadService uploads(inst);
+	VertexBuffer<Vertex> vb(*inst.allocator, (int)triangle.size());
+	uploads.upload(vb, 0, triangle.data(), triangle.size() * sizeof(Vertex));
+	const uint64_t vbTicket = uploads.submit();
+	bool vbReady = false;
+	StagingRing staging(inst);
+
+	ThreadPool threads;
+	PipelineCache pipelines(inst, &threads);
+
+	// the shaders outlive the renderer, which evicts the pipelines using them
+	unique_ptr<Shader> gbufferVert, gbufferFrag;
+	unique_ptr<DeferredRenderer> deferred;
+	VkPipeline gbufferPipeline = VK_NULL_HANDLE;
+	DescriptorSetLayout* gbufferDesc = nullptr;
+	// the G-buffer pipeline is only rebuilt if the render pass had to be
+	auto createGbufferPipeline = [&]() {
+		PipelineState gbufferState = deferred->geometryState(*gbufferVert, *gbufferFrag, gbufferDesc->pipelineLayout);
+		gbufferState.cullMode = VK_CULL_MODE_NONE;
+		gbufferState.addVertexLayout<Vertex>();
+		gbufferPipeline = pipelines.get(gbufferState);
+	};
+	if (deferredPath) {
+		gbufferVert = make_unique<Shader>(inst.device, "gbuffer.vert");
+		gbufferFrag = make_unique<Shader>(inst.device, "gbuffer.frag");
+		gbufferDesc = layouts.get({ gbufferVert.get(), gbufferFrag.get() });
+		deferred = make_unique<DeferredRenderer>(inst, pipelines);
+	}
+
+	// Replay last run's pipelines on the workers before anything asks for
+	// them. The manifest has shader names only, the layout and render pass
+	// come from whoever owns those shaders.
+	pipelines.prewarm([&](const string& vertName, const string& fragName, PipelineState& s) {
+		if (vertName == vert.name && fragName == frag.name) {
+			s.vert = &vert;
+			s.frag = &frag;
+			s.layout = desc.pipelineLayout;
+			s.renderPass = inst.renderPass;
+			return true;
+		}
+		if (deferred && vertName == gbufferVert->name && fragName == gbufferFrag->name) {
+			s.vert = gbufferVert.get();
+			s.frag = gbufferFrag.get();
+			s.layout = gbufferDesc->pipelineLayout;
+			s.renderPass = deferred->renderPass;
+			return true;
+		}
+		return false;
+	});
+	if (deferred)
+		createGbufferPipeline();
+
+	PipelineState state;
+	state.vert = &vert;
+	state.frag = &frag;
+	state.layout = desc.pipelineLayout;
+	state.renderPass = inst.renderPass;
+	state.cullMode = VK_CULL_MODE_NONE;
+	state.addVertexLayout<Vertex>();
+	PipelineHandle pipeline = pipelines.getAsync(state);
+
+	ParticleSystem particles(inst, staging, pipelines);
+	GpuProfiler profiler(inst);
+	const float identity[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+
+	// the backbuffer is rebound to the acquired swapchain image every frame,
+	// the acquire semaphore is waited at color output
+	RenderGraph graph(inst);
+	unique_ptr<GpuScene> scene;
+	if (gpuDriven) {
+		scene = make_unique<GpuScene>(inst, staging, pipelines);
+		scene->addCullPasses(graph);
+	}
+	int backbuffer = graph.importImage("backbuffer", inst.swapImages[0].image, inst.swapImages[0].view,
+		inst.format, inst.width, inst.height, VK_IMAGE_LAYOUT_UNDEFINED,
+		headless ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+	int depth = graph.createImage("depth", inst.depthFormat);
+	VkClearValue clearColor, clearDepth;
+	clearColor.color = { { 0.2f, 0.2f, 0.2f, 1.0f } };
+	clearDepth.depthStencil = { 1.0f, 0 };
+	RenderGraph::Pass& mainPass = graph.addPass("main", [&](VkCommandBuffer cmd) {
+		// skip the draw until the pipeline has compiled and the vertices arrived
+		VkPipeline p = pipeline->get();
+		if (p && vbReady) {
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, p);
+			desc.pushConstants(cmd, DescriptorSetLayout::Vertex, identity, sizeof(identity));
+			VkDeviceSize offset = 0;
+			vkCmdBindVertexBuffers(cmd, 0, 1, &vb.buffer, &offset);
+			vkCmdDraw(cmd, (uint32_t)triangle.size(), 1, 0, 0);
+		}
+		particles.draw(cmd);
+		if (scene)
+			scene->draw(cmd);
+	})
+		.write(backbuffer, RenderGraph::ColorAttachment).clear(backbuffer, clearColor)
+		.write(depth, RenderGraph::DepthAttachment).clear(depth, clearDepth);
+	if (scene) {
+		scene->addDrawUses(mainPass);
+		scene->addHizPass(graph, depth);
+	}
+	graph.compile();
+	if (scene)
+		scene->setDepth(graph.view(depth));
+
+	uint32_t swapChainGeneration = inst.swapChainGeneration;
+
+	unique_ptr<FrameReadback> readback;
+	if (!capturePattern.empty()) {
+		readback = make_unique<FrameReadback>(inst);
+		bool png = capturePattern.size() > 4 && capturePattern.compare(capturePattern.size() - 4, 4, ".png") == 0;
+		readback->encodeTo(capturePattern, png ? FrameReadback::Png : FrameReadback::Raw);
+	}
 	
+	// run the frame loop for two seconds
+	auto start = chrono::steady_clock::now();
+	auto last = start;
+	while (chrono::steady_clock::now() - start < 2s) {
+		if (wnd && !wnd->pollEvents())
+			break;
+		VkCommandBuffer cmd = inst.beginFrame();
+		// minimized, nothing to render into
+		if (!cmd) {
+			wnd->waitEvents();
+			continue;
+		}
+		profiler.beginFrame(cmd);
+		vbReady = uploads.acquire(cmd) >= vbTicket;
+
+		// beginFrame recreated the swapchain, e.g. after a resize
+		if (swapChainGeneration != inst.swapChainGeneration) {
+			swapChainGeneration = inst.swapChainGeneration;
+			graph.resize(backbuffer, inst.width, inst.height);
+			if (scene)
+				scene->resize(graph);
+			graph.compile();
+			if (scene)
+				scene->setDepth(graph.view(depth));
+			if (deferred && deferred->resize())
+				createGbufferPipeline();
+		}
+
+		auto now = chrono::steady_clock::now();
+		particles.update(chrono::duration<float>(now - last).count());
+		last = now;
+
+		if (deferred) {
+			GpuScope scope(cmd, "deferred");
+			deferred->begin(cmd);
+			if (vbReady) {
+				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, gbufferPipeline);
+				gbufferDesc->pushConstants(cmd, DescriptorSetLayout::Vertex, identity, sizeof(identity));
+				VkDeviceSize offset = 0;
+				vkCmdBindVertexBuffers(cmd, 0, 1, &vb.buffer, &offset);
+				vkCmdDraw(cmd, (uint32_t)triangle.size(), 1, 0, 0);
+			}
+			deferred->end(cmd);
+		} else {
+			if (scene) {
+				// orbit around the field
+				float t = chrono::duration<float>(now - start).count() * 0.3f;
+				const float eye[3] = { 40.0f * cos(t), 8.0f, 40.0f * sin(t) }, target[3] = { 0.0f, 0.0f, 0.0f };
+				scene->setCamera(eye, target);
+				scene->update(cmd);
+			}
+			graph.setImage(backbuffer, inst.swapImages[inst.curSwap].image, inst.swapImages[inst.curSwap].view);
+			graph.execute(cmd);
+		}
+		if (readback)
+			readback->capture(cmd);
+		inst.endFrame();
+		if (readback)
+			readback->poll();
+	}
+	inst.waitIdle();
+	if (readback) {
+		readback->poll();
+		readback->finish();
+		FrameReadback::Stats s = readback->getStats();
+		cout << "captured " << s.encoded << " frames, " << s.dropped << " dropped, " << s.failed << " failed" << endl;
+	}
 
-	this_thread::sleep_for(2s);
+	for (auto& a : profiler.averages())
+		cout << a.first << ": " << a.second.durationMs << " ms" << endl;
+	cout << inst.frameStats.summary();
+	if (trace)
+		profiler.writeChromeTrace("gpu_trace.json");
+	if (frameStats)
+		inst.frameStats.writeJson("frame_stats.json");
 	return 0;
 }
 
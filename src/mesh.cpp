@@ -0,0 +1,120 @@
+#include "mesh.hpp"
+#include "vulkan/instance.hpp"
+#include "vulkan/staging.hpp"
+#include "util/archive.hpp"
+#include <fstream>
+#include <cstring>
+using namespace std;
+
+MeshAsset::MeshAsset(VulkanInstance& inst, StagingRing& staging, const string& name) :
+	name(name), inst(inst)
+{
+	string path = "mesh/" + name + ".mesh";
+	if (Archive::active) {
+		if (const ArchiveEntry* entry = Archive::active->find(path)) {
+			load(staging, (const char*)Archive::active->data(*entry), (size_t)entry->size);
+			return;
+		}
+	}
+
+	ifstream ifs(path, ios::binary | ios::ate);
+	if (!ifs.is_open())
+		fatalError("Can't open mesh " + name);
+	vector<char> data((size_t)ifs.tellg());
+	ifs.seekg(0, ios::beg);
+	ifs.read(data.data(), data.size());
+	load(staging, data.data(), data.size());
+}
+
+void MeshAsset::load(StagingRing& staging, const char* data, size_t size)
+{
+	if (size < sizeof(MeshHeader))
+		fatalError("Mesh " + name + " is truncated");
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, meshMagic, sizeof(meshMagic)) != 0 || header.version != meshVersion)
+		fatalError("Mesh " + name + " has an unknown format, rebuild it with fugu_meshopt");
+
+	// sections in file order
+	size_t offsets[7];
+	const size_t sizes[] = {
+		sizeof(MeshHeader), header.lodCount * sizeof(MeshLod), header.vertexCount * sizeof(MeshVertex),
+		header.indexCount * sizeof(uint32_t), header.meshletCount * sizeof(Meshlet),
+		header.meshletVertexCount * sizeof(uint32_t), ((size_t)header.meshletTriangleCount * 3 + 3) / 4 * 4
+	};
+	size_t end = 0;
+	for (int i = 0; i < 7; i++) {
+		offsets[i] = end;
+		end += sizes[i];
+	}
+	if (end > size || header.lodCount == 0 || header.vertexCount == 0)
+		fatalError("Mesh " + name + " is truncated");
+
+	lods.resize(header.lodCount);
+	memcpy(lods.data(), data + offsets[1], sizes[1]);
+	validate(data, offsets);
+
+	// the data goes to the staging ring in place, without an intermediate copy
+	vertices.reset(new VertexBuffer<MeshVertex>(*inst.allocator, (int)header.vertexCount));
+	vertices->upload(staging, (const MeshVertex*)(data + offsets[2]), header.vertexCount);
+	indices.reset(new IndexBuffer<uint32_t>(*inst.allocator, (int)header.indexCount));
+	indices->upload(staging, (const uint32_t*)(data + offsets[3]), header.indexCount);
+
+	if (header.meshletCount == 0)
+		return;
+	const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	meshlets.reset(new VulkanBuffer(*inst.allocator, sizes[4], usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+	meshlets->upload(staging, data + offsets[4], sizes[4]);
+	meshletVertices.reset(new VulkanBuffer(*inst.allocator, sizes[5], usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+	meshletVertices->upload(staging, data + offsets[5], sizes[5]);
+	meshletTriangles.reset(new VulkanBuffer(*inst.allocator, sizes[6], usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+	meshletTriangles->upload(staging, data + offsets[6], sizes[6]);
+}
+
+void MeshAsset::validate(const char* data, const size_t offsets[7]) const
+{
+	// the GPU would read out of bounds instead of failing
+	for (const MeshLod& l : lods) {
+		if ((uint64_t)l.firstIndex + l.indexCount > header.indexCount ||
+			(uint64_t)l.firstMeshlet + l.meshletCount > header.meshletCount)
+			fatalError("Mesh " + name + " has a LOD out of range");
+	}
+	const uint32_t* indices = (const uint32_t*)(data + offsets[3]);
+	for (uint32_t i = 0; i < header.indexCount; i++)
+		if (indices[i] >= header.vertexCount)
+			fatalError("Mesh " + name + " has an index out of range");
+
+	const Meshlet* meshlets = (const Meshlet*)(data + offsets[4]);
+	const uint32_t* meshletVertices = (const uint32_t*)(data + offsets[5]);
+	const uint8_t* meshletTriangles = (const uint8_t*)(data + offsets[6]);
+	for (uint32_t i = 0; i < header.meshletVertexCount; i++)
+		if (meshletVertices[i] >= header.vertexCount)
+			fatalError("Mesh " + name + " has a meshlet vertex out of range");
+	for (uint32_t i = 0; i < header.meshletCount; i++) {
+		const Meshlet& m = meshlets[i];
+		if ((uint64_t)m.vertexOffset + m.vertexCount > header.meshletVertexCount ||
+			(uint64_t)m.triangleOffset + m.triangleCount > header.meshletTriangleCount)
+			fatalError("Mesh " + name + " has a meshlet out of range");
+		const uint8_t* tri = meshletTriangles + (size_t)m.triangleOffset * 3;
+		for (size_t t = 0; t < (size_t)m.triangleCount * 3; t++)
+			if (tri[t] >= m.vertexCount)
+				fatalError("Mesh " + name + " has a meshlet triangle out of range");
+	}
+}
+
+int MeshAsset::selectLod(float pixels, float maxPixelError) const
+{
+	// errors are relative to the radius, which covers pixels / 2
+	int lod = 0;
+	while (lod + 1 < (int)lods.size() && lods[lod + 1].error * pixels * 0.5f <= maxPixelError)
+		lod++;
+	return lod;
+}
+
+void MeshAsset::draw(VkCommandBuffer cmd, int lod, uint32_t instanceCount, uint32_t firstInstance) const
+{
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(cmd, 0, 1, &vertices->buffer, &offset);
+	vkCmdBindIndexBuffer(cmd, indices->buffer, 0, indices->indexType);
+	const MeshLod& l = lods[lod];
+	vkCmdDrawIndexed(cmd, l.indexCount, instanceCount, l.firstIndex, 0, firstInstance);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include "vulkan/vkmain.hpp"
+#include "vulkan/buffer.hpp"
+#include "meshformat.hpp"
+
+class VulkanInstance;
+class StagingRing;
+
+// Mesh optimized by fugu_meshopt, uploaded to device-local buffers. Loaded
+// in place from mesh/<name>.mesh in Archive::active, or from the loose
+// file. The pipeline takes the vertex layout with
+//   state.addVertexLayout<MeshVertex>();
+class MeshAsset
+{
+public:
+	MeshAsset(VulkanInstance& inst, StagingRing& staging, const std::string& name);
+
+	// Coarsest LOD that stays within maxPixelError of LOD 0 when the mesh
+	// covers pixels on screen, see StreamingService::projectedSize
+	int selectLod(float pixels, float maxPixelError = 1.0f) const;
+	// Bind the vertex and index buffers, then draw lod
+	void draw(VkCommandBuffer cmd, int lod, uint32_t instanceCount = 1, uint32_t firstInstance = 0) const;
+
+	std::string name;
+	MeshHeader header;
+	std::vector<MeshLod> lods;
+	std::unique_ptr<VertexBuffer<MeshVertex>> vertices;
+	std::unique_ptr<IndexBuffer<uint32_t>> indices;
+	// Storage buffers for cluster culling, null if the mesh has no meshlets.
+	// meshletTriangles holds three uint8_t local indices per triangle.
+	std::unique_ptr<VulkanBuffer> meshlets, meshletVertices, meshletTriangles;
+
+private:
+	void load(StagingRing& staging, const char* data, size_t size);
+	// Every LOD, index and meshlet within its arrays, data is the whole file
+	void validate(const char* data, const size_t offsets[7]) const;
+
+	VulkanInstance& inst;
+};
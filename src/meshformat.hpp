@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include "vulkan/vertexformat.hpp"
+
+// Optimized mesh written by fugu_meshopt (src/tools/meshopt.cpp), loaded
+// by MeshAsset. All sections are 4 byte aligned and used in place:
+//
+//   MeshHeader
+//   MeshLod[lodCount]               finest first
+//   MeshVertex[vertexCount]         shared by every LOD, in fetch order
+//   uint32_t indices[indexCount]    every LOD's triangles, cache ordered
+//   Meshlet[meshletCount]           every LOD's clusters
+//   uint32_t meshletVertices[meshletVertexCount]
+//   uint8_t meshletTriangles[3 * meshletTriangleCount], padded to 4 bytes
+struct MeshHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t vertexCount, indexCount, lodCount;
+	uint32_t meshletCount, meshletVertexCount, meshletTriangleCount;
+	float center[3], radius; // bounding sphere
+};
+
+struct MeshLod {
+	uint32_t firstIndex, indexCount;
+	uint32_t firstMeshlet, meshletCount;
+	// geometric deviation from LOD 0, relative to MeshHeader::radius
+	float error;
+};
+
+// std430 compatible, for cluster culling in compute. The cluster faces away
+// from a camera at eye, and can be culled, if
+//   dot(center - eye, coneAxis) >= coneCutoff * length(center - eye) + radius
+struct Meshlet {
+	float center[3], radius;
+	float coneAxis[3], coneCutoff;
+	// into meshletVertices and meshletTriangles
+	uint32_t vertexOffset, triangleOffset;
+	uint32_t vertexCount, triangleCount;
+};
+
+struct MeshVertex {
+	float pos[3];
+	OctNormal normal;
+	Half2 uv; // may repeat outside [0,1]
+	static constexpr std::array<VertexAttribute, 3> attributes() {
+		return {{ vertexAttribute<float[3]>(0, offsetof(MeshVertex, pos)), vertexAttribute<OctNormal>(1, offsetof(MeshVertex, normal)),
+			vertexAttribute<Half2>(2, offsetof(MeshVertex, uv)) }};
+	}
+};
+
+static const char meshMagic[4] = { 'F', 'M', 'S', 'H' };
+static const uint32_t meshVersion = 1;
+// Per meshlet, small enough for one workgroup of a mesh or cluster culling shader
+static const uint32_t meshletMaxVertices = 64, meshletMaxTriangles = 124;
@@ -0,0 +1,94 @@
+#include "particles.hpp"
+#include "vulkan/instance.hpp"
+#include "vulkan/staging.hpp"
+#include <random>
+#include <cstddef>
+using namespace std;
+
+static DescriptorSetLayout& buildLayout(DescriptorSetLayout& layout, const Shader& a, const Shader* b = nullptr)
+{
+	layout.add(a);
+	if (b)
+		layout.add(*b);
+	layout.create();
+	return layout;
+}
+
+ParticleSystem::ParticleSystem(VulkanInstance& inst, StagingRing& staging, PipelineCache& pipelines, uint32_t count) :
+	inst(inst), count(count),
+	comp(inst.device, "particles.comp"), vert(inst.device, "particles.vert"), frag(inst.device, "simple.frag"),
+	simLayout(inst.device), drawLayout(inst.device),
+	sim(inst.device, comp, buildLayout(simLayout, comp).pipelineLayout, pipelines.cache),
+	queue(inst)
+{
+	buildLayout(drawLayout, vert, &frag);
+
+	mt19937 rng(1);
+	uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	vector<Particle> particles(count);
+	for (auto& p : particles) {
+		p = {
+			{ dist(rng) * 0.2f, dist(rng) * 0.2f + 0.5f, 0.0f, 1.0f },
+			{ dist(rng) * 0.5f, dist(rng) * 0.5f, 0.0f, 0.0f },
+			{ 0.5f + 0.5f * dist(rng), 0.6f, 1.0f, 1.0f },
+		};
+	}
+
+	// shared between the graphics and compute families, each starts with the initial state
+	for (int i = 0; i < inst.numFrames; i++) {
+		buffers.emplace_back(new VulkanBuffer(*inst.allocator, count * sizeof(Particle),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, { (uint32_t)inst.queueFamilyIndex, (uint32_t)inst.computeFamilyIndex }));
+		buffers.back()->upload(staging, particles.data(), count * sizeof(Particle));
+	}
+	staging.finish();
+
+	// slot i reads the previous slot and writes its own
+	for (int i = 0; i < inst.numFrames; i++) {
+		int prev = (i + inst.numFrames - 1) % inst.numFrames;
+		bindings.push_back(simLayout.createBinding());
+		bindings.back()->setBuffer(0, *buffers[prev]);
+		bindings.back()->setBuffer(1, *buffers[i]);
+		bindings.back()->apply();
+	}
+
+	PipelineState state;
+	state.vert = &vert;
+	state.frag = &frag;
+	state.layout = drawLayout.pipelineLayout;
+	state.renderPass = inst.renderPass;
+	state.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+	state.cullMode = VK_CULL_MODE_NONE;
+	state.setVertexStride(sizeof(Particle));
+	state.addVertexAttribute(0, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(Particle, pos));
+	state.addVertexAttribute(1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(Particle, color));
+	drawPipeline = pipelines.getAsync(state);
+}
+
+void ParticleSystem::update(float dt)
+{
+	struct {
+		float dt;
+		uint32_t count;
+	} params = { dt, count };
+
+	VkCommandBuffer cmd = queue.begin();
+	// the previous slot was written by the last dispatch
+	computeBarrier(cmd);
+	sim.bind(cmd);
+	bindings[inst.curFrame]->bind(cmd);
+	simLayout.pushConstants(cmd, DescriptorSetLayout::Compute, params);
+	sim.dispatchThreads(cmd, count);
+	queue.submit(VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+}
+
+void ParticleSystem::draw(VkCommandBuffer cmd)
+{
+	VkPipeline pipeline = drawPipeline->get();
+	if (!pipeline)
+		return;
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(cmd, 0, 1, &buffers[inst.curFrame]->buffer, &offset);
+	vkCmdDraw(cmd, count, 1, 0, 0);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include "vulkan/vkmain.hpp"
+#include "vulkan/shader.hpp"
+#include "vulkan/buffer.hpp"
+#include "vulkan/compute.hpp"
+#include "vulkan/pipeline.hpp"
+
+class VulkanInstance;
+class StagingRing;
+
+// GPU particle simulation, the reference workload for async compute. Every
+// frame the compute queue integrates the particles of the previous frame
+// slot into the current slot's buffer, which the graphics queue then draws
+// as points.
+class ParticleSystem
+{
+public:
+	struct Particle {
+		float pos[4];
+		float vel[4];
+		float color[4];
+	};
+
+	ParticleSystem(VulkanInstance& inst, StagingRing& staging, PipelineCache& pipelines, uint32_t count = 16384);
+
+	// Record and submit the simulation step, after VulkanInstance::beginFrame
+	void update(float dt);
+	// Inside the render pass; skipped until the pipeline is compiled
+	void draw(VkCommandBuffer cmd);
+
+	VulkanInstance& inst;
+	uint32_t count;
+	Shader comp, vert, frag;
+	DescriptorSetLayout simLayout, drawLayout;
+	ComputePipeline sim;
+	ComputeQueue queue;
+	std::vector<std::unique_ptr<VulkanBuffer>> buffers; // one per frame slot
+	std::vector<std::unique_ptr<Binding>> bindings;
+	PipelineHandle drawPipeline;
+};
@@ -1,6 +1,8 @@
 #include "window.hpp"
 #include "util/util.hpp"
 
+#ifdef _WIN32
+
 #define WIN32_LEAN_AND_MEAN
 #define VK_USE_PLATFORM_WIN32_KHR
 #define NOMINMAX
@@ -87,4 +89,55 @@ void* Window::getInstance()
 void* Window::getHandle()
 {
 	return impl->hWnd;
-}
\ No newline at end of file
+}
+
+bool Window::pollEvents()
+{
+	MSG msg;
+	while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
+		if (msg.message == WM_QUIT)
+			return false;
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+	}
+	return true;
+}
+
+void Window::waitEvents()
+{
+	WaitMessage();
+}
+
+#else
+
+// No windowing backend on this platform yet; use VulkanInstance's headless mode.
+struct Window::Impl {};
+
+Window::Window(const std::string&, int w, int h) :
+	width(w), height(h)
+{
+	fatalError("windowed mode is not supported on this platform, use headless");
+}
+
+Window::~Window() = default;
+
+void* Window::getInstance()
+{
+	return nullptr;
+}
+
+void* Window::getHandle()
+{
+	return nullptr;
+}
+
+bool Window::pollEvents()
+{
+	return true;
+}
+
+void Window::waitEvents()
+{
+}
+
+#endif // _WIN32
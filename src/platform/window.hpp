@@ -9,6 +9,10 @@ public:
 	~Window();
 	void* getInstance();
 	void* getHandle();
+	// Process pending window messages, returns false once the window was closed
+	bool pollEvents();
+	// Block until a message arrives, e.g. while minimized
+	void waitEvents();
 
 	int width, height;
 private:
@@ -0,0 +1,450 @@
+#include "scene.hpp"
+#include "vulkan/instance.hpp"
+#include "vulkan/staging.hpp"
+#include "vulkan/vkutil.hpp"
+#include <random>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+// Column-major 4x4 matrices, m[col * 4 + row]
+static void mul(float* r, const float* a, const float* b)
+{
+	for (int c = 0; c < 4; c++)
+		for (int i = 0; i < 4; i++)
+			r[c * 4 + i] = a[i] * b[c * 4] + a[4 + i] * b[c * 4 + 1] + a[8 + i] * b[c * 4 + 2] + a[12 + i] * b[c * 4 + 3];
+}
+
+static void normalize(float* v)
+{
+	float len = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	for (int i = 0; i < 3; i++)
+		v[i] /= len;
+}
+
+static void cross(float* r, const float* a, const float* b)
+{
+	r[0] = a[1] * b[2] - a[2] * b[1];
+	r[1] = a[2] * b[0] - a[0] * b[2];
+	r[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static float dot(const float* a, const float* b)
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Right-handed view looking down -z
+static void lookAt(float* m, const float* eye, const float* target)
+{
+	const float up[3] = { 0.0f, 1.0f, 0.0f };
+	float f[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] }, s[3], u[3];
+	normalize(f);
+	cross(s, f, up);
+	normalize(s);
+	cross(u, s, f);
+	const float view[16] = {
+		s[0], u[0], -f[0], 0.0f,
+		s[1], u[1], -f[1], 0.0f,
+		s[2], u[2], -f[2], 0.0f,
+		-dot(s, eye), -dot(u, eye), dot(f, eye), 1.0f,
+	};
+	copy(view, view + 16, m);
+}
+
+// Vulkan clip space: y points down, depth 0 at the near plane
+static void perspective(float* m, float fovY, float aspect, float zNear, float zFar)
+{
+	float f = 1.0f / tan(fovY * 0.5f);
+	fill(m, m + 16, 0.0f);
+	m[0] = f / aspect;
+	m[5] = -f;
+	m[10] = zFar / (zNear - zFar);
+	m[11] = -1.0f;
+	m[14] = zNear * zFar / (zNear - zFar);
+}
+
+// Frustum planes of a view projection, normals point inwards
+static void extractPlanes(float planes[6][4], const float* m)
+{
+	for (int i = 0; i < 4; i++) {
+		float r0 = m[i * 4], r1 = m[i * 4 + 1], r2 = m[i * 4 + 2], r3 = m[i * 4 + 3];
+		planes[0][i] = r3 + r0;
+		planes[1][i] = r3 - r0;
+		planes[2][i] = r3 + r1;
+		planes[3][i] = r3 - r1;
+		planes[4][i] = r2;
+		planes[5][i] = r3 - r2;
+	}
+	for (int p = 0; p < 6; p++) {
+		float len = sqrt(dot(planes[p], planes[p]));
+		for (int i = 0; i < 4; i++)
+			planes[p][i] /= len;
+	}
+}
+
+static DescriptorSetLayout& buildLayout(DescriptorSetLayout& layout, const Shader& a, const Shader* b = nullptr,
+	int dynamicUniform = -1)
+{
+	layout.add(a);
+	if (b)
+		layout.add(*b);
+	for (auto& binding : layout.bindings)
+		if ((int)binding.binding == dynamicUniform && binding.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+			binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	layout.create();
+	return layout;
+}
+
+GpuScene::GpuScene(VulkanInstance& inst, StagingRing& staging, PipelineCache& pipelines, uint32_t count) :
+	inst(inst), pipelines(pipelines), count(count),
+	cullComp(inst.device, "cull.comp"), hizComp(inst.device, "hiz.comp"),
+	vert(inst.device, "scene.vert"), frag(inst.device, "simple.frag"),
+	cullLayout(inst.device), hizLayout(inst.device), drawLayout(inst.device),
+	cull(inst.device, cullComp, buildLayout(cullLayout, cullComp, nullptr, 5).pipelineLayout, pipelines.cache),
+	hiz(inst.device, hizComp, buildLayout(hizLayout, hizComp).pipelineLayout, pipelines.cache)
+{
+	// the object index reaches the vertex shader as firstInstance
+	if (!inst.enabledFeatures.drawIndirectFirstInstance)
+		fatalError("GPU-driven rendering needs drawIndirectFirstInstance");
+	// without multiDrawIndirect only single draws are allowed, which the count variant can't batch
+	uint32_t maxDraws = inst.enabledFeatures.multiDrawIndirect ? inst.gpu->gpuProps.limits.maxDrawIndirectCount : 1;
+	compact = inst.drawIndirectCount && count <= maxDraws;
+	buildLayout(drawLayout, vert, &frag);
+
+	addMeshes(staging);
+
+	mt19937 rng(1);
+	uniform_real_distribution<float> dist(0.0f, 1.0f);
+	uint32_t side = (uint32_t)ceil(sqrt((float)count));
+	const float spacing = 3.0f;
+	vector<Object> objs(count);
+	for (uint32_t i = 0; i < count; i++) {
+		Object& o = objs[i];
+		float scale = 0.5f + dist(rng);
+		o = {
+			{ ((i % side) - side * 0.5f + dist(rng) * 0.5f) * spacing, scale,
+			  ((i / side) - side * 0.5f + dist(rng) * 0.5f) * spacing, scale },
+			{ 0.3f + 0.7f * dist(rng), 0.3f + 0.7f * dist(rng), 0.3f + 0.7f * dist(rng), 1.0f },
+			i % 2, { 0, 0, 0 },
+		};
+	}
+
+	objects.reset(new VulkanBuffer(*inst.allocator, count * sizeof(Object),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+	objects->upload(staging, objs.data(), count * sizeof(Object));
+	draws.reset(new VulkanBuffer(*inst.allocator, count * sizeof(VkDrawIndexedIndirectCommand),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+	drawCount.reset(new VulkanBuffer(*inst.allocator, sizeof(uint32_t),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+	staging.finish();
+
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.pNext = nullptr;
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.maxLod = 16.0f;
+	vkAssert(vkCreateSampler(inst.device, &samplerInfo, nullptr, &sampler), "create Hi-Z sampler");
+
+	createHiz();
+
+	// one set for every frame, the frames' parameters differ in the dynamic offset
+	params.reset(new UniformRing(*inst.allocator, *inst.gpu, sizeof(CullParams), inst.numFrames));
+	cullBinding = cullLayout.createBinding();
+	cullBinding->setBuffer(0, *objects);
+	cullBinding->setBuffer(1, *meshes);
+	cullBinding->setBuffer(2, *draws);
+	cullBinding->setBuffer(3, *drawCount);
+	cullBinding->setImage(4, hizView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, sampler);
+	cullBinding->setBuffer(5, params->buffer, 0, sizeof(CullParams));
+	cullBinding->apply();
+	drawBinding = drawLayout.createBinding();
+	drawBinding->setBuffer(0, *objects);
+	drawBinding->apply();
+
+	PipelineState state;
+	state.vert = &vert;
+	state.frag = &frag;
+	state.layout = drawLayout.pipelineLayout;
+	state.renderPass = inst.renderPass;
+	state.cullMode = VK_CULL_MODE_NONE;
+	state.addVertexLayout<Vertex>();
+	drawPipeline = pipelines.getAsync(state);
+
+	const float eye[3] = { 0.0f, 10.0f, 20.0f }, target[3] = { 0.0f, 0.0f, 0.0f };
+	setCamera(eye, target);
+	copy(viewProj, viewProj + 16, prevViewProj);
+}
+
+GpuScene::~GpuScene()
+{
+	// frames in flight may still cull and draw with all of this
+	pipelines.evict(&vert);
+	destroyHiz();
+	VkDevice device = inst.device;
+	VkSampler hizSampler = sampler;
+	VkPipeline cullPipeline = cull.pipeline, hizPipeline = hiz.pipeline;
+	cull.pipeline = hiz.pipeline = VK_NULL_HANDLE;
+	inst.defer([device, hizSampler, cullPipeline, hizPipeline] {
+		vkDestroyPipeline(device, cullPipeline, nullptr);
+		vkDestroyPipeline(device, hizPipeline, nullptr);
+		vkDestroySampler(device, hizSampler, nullptr);
+	});
+	for (DescriptorSetLayout* layout : { &cullLayout, &hizLayout, &drawLayout })
+		inst.retire(move(layout->sets));
+	inst.retire(move(vertices));
+	inst.retire(move(indices));
+	inst.retire(move(objects));
+	inst.retire(move(meshes));
+	inst.retire(move(draws));
+	inst.retire(move(drawCount));
+	inst.retire(move(params));
+}
+
+void GpuScene::addMeshes(StagingRing& staging)
+{
+	// a cube and an octahedron in one vertex and index buffer
+	vector<Vertex> verts;
+	for (int i = 0; i < 8; i++)
+		verts.push_back({ half4(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f) });
+	const vector<uint32_t> cube = {
+		0, 2, 1, 1, 2, 3,  4, 5, 6, 5, 7, 6,
+		0, 1, 4, 1, 5, 4,  2, 6, 3, 3, 6, 7,
+		0, 4, 2, 2, 4, 6,  1, 3, 5, 3, 7, 5,
+	};
+	const Vertex octa[6] = {
+		{ half4(1, 0, 0) }, { half4(-1, 0, 0) }, { half4(0, 1, 0) },
+		{ half4(0, -1, 0) }, { half4(0, 0, 1) }, { half4(0, 0, -1) },
+	};
+	verts.insert(verts.end(), octa, octa + 6);
+	const vector<uint32_t> octaIndices = {
+		0, 2, 4,  4, 2, 1,  1, 2, 5,  5, 2, 0,
+		0, 4, 3,  4, 1, 3,  1, 5, 3,  5, 0, 3,
+	};
+	vector<uint32_t> idx = cube;
+	idx.insert(idx.end(), octaIndices.begin(), octaIndices.end());
+
+	const Mesh meshList[2] = {
+		{ (uint32_t)cube.size(), 0, 0, sqrt(3.0f) },
+		{ (uint32_t)octaIndices.size(), (uint32_t)cube.size(), 8, 1.0f },
+	};
+
+	vertices.reset(new VertexBuffer<Vertex>(*inst.allocator, (int)verts.size()));
+	vertices->upload(staging, verts);
+	indices.reset(new IndexBuffer<uint32_t>(*inst.allocator, (int)idx.size()));
+	indices->upload(staging, idx);
+	meshes.reset(new VulkanBuffer(*inst.allocator, sizeof(meshList),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+	meshes->upload(staging, meshList, sizeof(meshList));
+}
+
+void GpuScene::createHiz()
+{
+	hizWidth = max(inst.width / 2, 1);
+	hizHeight = max(inst.height / 2, 1);
+	uint32_t levels = 1;
+	while ((max(hizWidth, hizHeight) >> levels) > 0)
+		levels++;
+
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.pNext = nullptr;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = VK_FORMAT_R32_SFLOAT;
+	imageInfo.extent.width = hizWidth;
+	imageInfo.extent.height = hizHeight;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = levels;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.queueFamilyIndexCount = 0;
+	imageInfo.pQueueFamilyIndices = nullptr;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+	imageInfo.flags = 0;
+	vkAssert(vkCreateImage(inst.device, &imageInfo, nullptr, &hizImage), "create Hi-Z image");
+	hizMem = inst.allocator->bindImage(hizImage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.pNext = nullptr;
+	viewInfo.format = VK_FORMAT_R32_SFLOAT;
+	viewInfo.components.r = VK_COMPONENT_SWIZZLE_R;
+	viewInfo.components.g = VK_COMPONENT_SWIZZLE_G;
+	viewInfo.components.b = VK_COMPONENT_SWIZZLE_B;
+	viewInfo.components.a = VK_COMPONENT_SWIZZLE_A;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = levels;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.flags = 0;
+	viewInfo.image = hizImage;
+	vkAssert(vkCreateImageView(inst.device, &viewInfo, nullptr, &hizView), "create Hi-Z view");
+
+	// one view per level: each level is written as a storage image and read by the next
+	viewInfo.subresourceRange.levelCount = 1;
+	for (uint32_t i = 0; i < levels; i++) {
+		viewInfo.subresourceRange.baseMipLevel = i;
+		hizLevels.push_back(VK_NULL_HANDLE);
+		vkAssert(vkCreateImageView(inst.device, &viewInfo, nullptr, &hizLevels.back()), "create Hi-Z level view");
+
+		if (hizBindings.size() <= i)
+			hizBindings.push_back(hizLayout.createBinding());
+		if (i > 0) {
+			hizBindings.back()->setImage(0, hizLevels[i - 1], VK_IMAGE_LAYOUT_GENERAL, sampler);
+			hizBindings.back()->setImage(1, hizLevels[i], VK_IMAGE_LAYOUT_GENERAL);
+			hizBindings.back()->apply();
+		}
+	}
+}
+
+void GpuScene::destroyHiz()
+{
+	VkDevice device = inst.device;
+	MemoryAllocator* allocator = inst.allocator.get();
+	vector<VkImageView> views = hizLevels;
+	views.push_back(hizView);
+	VkImage image = hizImage;
+	Allocation mem = hizMem;
+	inst.defer([device, allocator, views, image, mem] {
+		for (auto view : views)
+			vkDestroyImageView(device, view, nullptr);
+		vkDestroyImage(device, image, nullptr);
+		allocator->free(mem);
+	});
+	hizLevels.clear();
+}
+
+void GpuScene::resize(RenderGraph& graph)
+{
+	destroyHiz();
+	createHiz();
+	cullBinding->setImage(4, hizView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, sampler);
+	cullBinding->apply();
+	graph.setImage(hizResource, hizImage, hizView);
+	graph.resize(hizResource, hizWidth, hizHeight);
+	// the new pyramid is undefined until its first hiz pass
+	hizValid = false;
+}
+
+void GpuScene::setDepth(VkImageView depthView)
+{
+	// level 0 reads the depth buffer itself
+	hizBindings[0]->setImage(0, depthView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, sampler);
+	hizBindings[0]->setImage(1, hizLevels[0], VK_IMAGE_LAYOUT_GENERAL);
+	hizBindings[0]->apply();
+}
+
+void GpuScene::addCullPasses(RenderGraph& graph)
+{
+	// the previous frame reads both as indirect arguments
+	drawsResource = graph.importBuffer("draws", draws->buffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT);
+	countResource = graph.importBuffer("drawCount", drawCount->buffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT);
+	// left readable for the next frame's culling between frames
+	hizResource = graph.importImage("hiz", hizImage, hizView, VK_FORMAT_R32_SFLOAT, hizWidth, hizHeight,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+	if (compact) {
+		graph.addPass("cull-reset", [this](VkCommandBuffer cmd) {
+			vkCmdFillBuffer(cmd, drawCount->buffer, 0, sizeof(uint32_t), 0);
+		})
+			.write(countResource, RenderGraph::Transfer);
+	}
+	RenderGraph::Pass& pass = graph.addPass("cull", [this](VkCommandBuffer cmd) {
+		cull.bind(cmd);
+		cullBinding->bind(cmd, { cullOffset });
+		cull.dispatchThreads(cmd, count);
+	})
+		.read(hizResource, RenderGraph::ComputeShader)
+		.write(drawsResource, RenderGraph::ComputeShader);
+	if (compact)
+		pass.write(countResource, RenderGraph::ComputeShader);
+}
+
+void GpuScene::addDrawUses(RenderGraph::Pass& pass)
+{
+	pass.read(drawsResource, RenderGraph::IndirectBuffer);
+	if (compact)
+		pass.read(countResource, RenderGraph::IndirectBuffer);
+}
+
+void GpuScene::addHizPass(RenderGraph& graph, int depth)
+{
+	graph.addPass("hiz", [this](VkCommandBuffer cmd) {
+		hiz.bind(cmd);
+		for (size_t i = 0; i < hizLevels.size(); i++) {
+			if (i > 0)
+				computeBarrier(cmd);
+			hizBindings[i]->bind(cmd);
+			hiz.dispatchThreads(cmd, max(hizWidth >> i, 1u), max(hizHeight >> i, 1u));
+		}
+	})
+		.read(depth, RenderGraph::ComputeShader)
+		.write(hizResource, RenderGraph::ComputeShader);
+}
+
+void GpuScene::setCamera(const float eye[3], const float target[3])
+{
+	float view[16], proj[16];
+	lookAt(view, eye, target);
+	perspective(proj, 1.0f, (float)inst.width / inst.height, 0.5f, 500.0f);
+	mul(viewProj, proj, view);
+	extractPlanes(planes, viewProj);
+}
+
+void GpuScene::update(VkCommandBuffer cmd)
+{
+	// the pyramid holds garbage until the first hiz pass
+	if (!hizValid)
+		queueImageLayout(cmd, hizImage, VK_IMAGE_ASPECT_COLOR_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+	// the pyramid was built from depth rendered with last frame's camera
+	CullParams p;
+	copy(prevViewProj, prevViewProj + 16, p.prevViewProj);
+	copy(&planes[0][0], &planes[0][0] + 24, &p.planes[0][0]);
+	p.hizSize[0] = (float)hizWidth;
+	p.hizSize[1] = (float)hizHeight;
+	p.objectCount = count;
+	p.flags = (hizValid ? Occlusion : 0) | (compact ? Compact : 0);
+	// the slice holds exactly one block, it can't be full
+	params->beginFrame(inst.curFrame);
+	params->push(p, cullOffset);
+
+	copy(viewProj, viewProj + 16, prevViewProj);
+	hizValid = true;
+}
+
+void GpuScene::draw(VkCommandBuffer cmd)
+{
+	VkPipeline pipeline = drawPipeline->get();
+	if (!pipeline)
+		return;
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	drawBinding->bind(cmd);
+	drawLayout.pushConstants(cmd, DescriptorSetLayout::Vertex, viewProj, sizeof(viewProj));
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(cmd, 0, 1, &vertices->buffer, &offset);
+	vkCmdBindIndexBuffer(cmd, indices->buffer, 0, indices->indexType);
+
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	if (compact) {
+		inst.pfnCmdDrawIndexedIndirectCount(cmd, draws->buffer, 0, drawCount->buffer, 0, count, stride);
+		return;
+	}
+	// culled objects keep their slot with zero instances
+	uint32_t maxDraws = inst.enabledFeatures.multiDrawIndirect ? inst.gpu->gpuProps.limits.maxDrawIndirectCount : 1;
+	for (uint32_t first = 0; first < count; first += maxDraws)
+		vkCmdDrawIndexedIndirect(cmd, draws->buffer, first * stride, min(count - first, maxDraws), stride);
+}
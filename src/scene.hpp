@@ -0,0 +1,120 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include "vulkan/vkmain.hpp"
+#include "vulkan/shader.hpp"
+#include "vulkan/buffer.hpp"
+#include "vulkan/uniform.hpp"
+#include "vulkan/compute.hpp"
+#include "vulkan/pipeline.hpp"
+#include "vulkan/rendergraph.hpp"
+
+class VulkanInstance;
+class StagingRing;
+
+// GPU-driven scene: a compute pass culls every object against the frustum
+// and the Hi-Z pyramid of the previous frame's depth, and writes one
+// indexed indirect draw per object, so the CPU records a single draw call
+// regardless of the object count. With VK_KHR_draw_indirect_count the
+// visible draws are compacted and their count is read by the GPU; without
+// it every object keeps its slot and culled ones get instanceCount 0.
+//
+//   GpuScene scene(inst, staging, pipelines);
+//   scene.addCullPasses(graph);
+//   scene.addDrawUses(graph.addPass("main", ...));  // scene.draw(cmd) inside
+//   scene.addHizPass(graph, depth);
+//   graph.compile();
+//   scene.setDepth(graph.view(depth));
+//   // every frame, before graph.execute()
+//   scene.setCamera(eye, target);
+//   scene.update(cmd);
+class GpuScene
+{
+public:
+	// Position-only stream, half floats are exact for the unit meshes
+	struct Vertex {
+		Half4 pos;
+		static constexpr std::array<VertexAttribute, 1> attributes() {
+			return {{ vertexAttribute<Half4>(0, offsetof(Vertex, pos)) }};
+		}
+	};
+	struct Object {
+		float posScale[4]; // xyz position, w uniform scale
+		float color[4];
+		uint32_t mesh;
+		uint32_t pad[3];
+	};
+	struct Mesh {
+		uint32_t indexCount;
+		uint32_t firstIndex;
+		int32_t vertexOffset;
+		float radius; // bounding sphere around the origin
+	};
+	// std140 block of cull.comp
+	struct CullParams {
+		float prevViewProj[16];
+		float planes[6][4];
+		float hizSize[2];
+		uint32_t objectCount;
+		uint32_t flags;
+	};
+	enum CullFlags { Occlusion = 1, Compact = 2 };
+
+	GpuScene(VulkanInstance& inst, StagingRing& staging, PipelineCache& pipelines, uint32_t count = 65536);
+	~GpuScene();
+
+	void addCullPasses(RenderGraph& graph);
+	// Declare the indirect reads of the pass calling draw()
+	void addDrawUses(RenderGraph::Pass& pass);
+	// Downsample the depth written by the main pass for the next frame's culling
+	void addHizPass(RenderGraph& graph, int depth);
+	// The graph's depth view, again after every compile()
+	void setDepth(VkImageView depthView);
+	// Rebuild the pyramid at the instance's new size, before recompiling the graph
+	void resize(RenderGraph& graph);
+
+	void setCamera(const float eye[3], const float target[3]);
+	// Write this frame's culling parameters, before RenderGraph::execute
+	void update(VkCommandBuffer cmd);
+	// Inside the render pass; skipped until the pipeline is compiled
+	void draw(VkCommandBuffer cmd);
+
+	VulkanInstance& inst;
+	PipelineCache& pipelines;
+	uint32_t count;
+	bool compact;
+	Shader cullComp, hizComp, vert, frag;
+	DescriptorSetLayout cullLayout, hizLayout, drawLayout;
+	ComputePipeline cull, hiz;
+	PipelineHandle drawPipeline;
+
+	std::unique_ptr<VertexBuffer<Vertex>> vertices;
+	std::unique_ptr<IndexBuffer<uint32_t>> indices;
+	std::unique_ptr<VulkanBuffer> objects, meshes, draws, drawCount;
+	// a CullParams block per frame slot, bound at cullOffset
+	std::unique_ptr<UniformRing> params;
+	uint32_t cullOffset = 0;
+	std::unique_ptr<Binding> cullBinding;
+	std::unique_ptr<Binding> drawBinding;
+
+	// Farthest depth per texel, mip 0 is half the screen size
+	VkImage hizImage = VK_NULL_HANDLE;
+	Allocation hizMem;
+	VkImageView hizView = VK_NULL_HANDLE; // all levels, for culling
+	std::vector<VkImageView> hizLevels;
+	std::vector<std::unique_ptr<Binding>> hizBindings;
+	uint32_t hizWidth, hizHeight;
+	VkSampler sampler = VK_NULL_HANDLE;
+	bool hizValid = false;
+
+	float viewProj[16];
+	float prevViewProj[16];
+	float planes[6][4];
+
+private:
+	void createHiz();
+	void destroyHiz();
+	void addMeshes(StagingRing& staging);
+
+	int hizResource = -1, drawsResource = -1, countResource = -1;
+};
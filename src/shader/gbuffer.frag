@@ -0,0 +1,14 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout (location = 0) in vec4 color;
+layout (location = 1) in vec3 pos;
+layout (location = 0) out vec4 outAlbedo;
+layout (location = 1) out vec4 outNormal;
+
+void main() {
+   // flat normals from the position derivatives
+   vec3 n = normalize(cross(dFdx(pos), dFdy(pos)));
+   outAlbedo = color;
+   outNormal = vec4(n * 0.5 + 0.5, 1.0);
+}
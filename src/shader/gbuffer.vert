@@ -0,0 +1,25 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout (push_constant) uniform pushConstants {
+    mat4 mvp;
+} myBufferVals;
+
+layout (location = 0) in vec4 pos;
+layout (location = 1) in vec4 inColor;
+layout (location = 0) out vec4 outColor;
+layout (location = 1) out vec3 outPos;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+void main() {
+   outColor = inColor;
+   outPos = pos.xyz;
+   gl_Position = myBufferVals.mvp * pos;
+
+   // GL->VK conventions
+   gl_Position.y = -gl_Position.y;
+   gl_Position.z = (gl_Position.z + gl_Position.w) / 2.0;
+}
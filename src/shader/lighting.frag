@@ -0,0 +1,18 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout (input_attachment_index = 0, set = 0, binding = 0) uniform subpassInput albedo;
+layout (input_attachment_index = 1, set = 0, binding = 1) uniform subpassInput normal;
+layout (input_attachment_index = 2, set = 0, binding = 2) uniform subpassInput depth;
+layout (location = 0) out vec4 outColor;
+
+void main() {
+   if (subpassLoad(depth).r >= 1.0) {
+      outColor = vec4(0.2, 0.2, 0.2, 1.0);
+      return;
+   }
+   vec3 n = subpassLoad(normal).xyz * 2.0 - 1.0;
+   vec4 color = subpassLoad(albedo);
+   float light = 0.3 + 0.7 * abs(dot(n, normalize(vec3(0.3, 0.5, 1.0))));
+   outColor = vec4(color.rgb * light, color.a);
+}
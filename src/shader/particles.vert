@@ -0,0 +1,19 @@
+#version 400
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) in vec4 pos;
+layout (location = 1) in vec4 inColor;
+layout (location = 0) out vec4 outColor;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+    float gl_PointSize;
+};
+
+void main() {
+   outColor = inColor;
+   // GL->VK conventions
+   gl_Position = vec4(pos.x, -pos.y, 0.5, 1.0);
+   gl_PointSize = 1.0;
+}
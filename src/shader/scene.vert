@@ -0,0 +1,31 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout (push_constant) uniform pushConstants {
+    mat4 viewProj;
+} pc;
+
+struct Object {
+    vec4 posScale;
+    vec4 color;
+    uint mesh;
+    uint pad0, pad1, pad2;
+};
+
+layout (std430, set = 0, binding = 0) readonly buffer Objects { Object objects[]; };
+
+layout (location = 0) in vec4 pos;
+layout (location = 0) out vec4 outColor;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+// gl_InstanceIndex is the object index, written as firstInstance by the culling pass
+void main() {
+    Object obj = objects[gl_InstanceIndex];
+    vec3 world = pos.xyz * obj.posScale.w + obj.posScale.xyz;
+    // cheap shading, lighter towards the top
+    outColor = vec4(obj.color.rgb * (0.7 + 0.3 * pos.y), 1.0);
+    gl_Position = pc.viewProj * vec4(world, 1.0);
+}
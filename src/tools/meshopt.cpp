@@ -0,0 +1,558 @@
+#include "tools/meshopt.hpp"
+#include <algorithm>
+#include <unordered_map>
+#include <cmath>
+#include <cstring>
+#include <array>
+using namespace std;
+
+static void sub(float* r, const float* a, const float* b)
+{
+	for (int i = 0; i < 3; i++)
+		r[i] = a[i] - b[i];
+}
+
+static void cross(float* r, const float* a, const float* b)
+{
+	r[0] = a[1] * b[2] - a[2] * b[1];
+	r[1] = a[2] * b[0] - a[0] * b[2];
+	r[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static float dot(const float* a, const float* b)
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Unnormalized, its length is twice the area
+static void triangleNormal(float* n, const float* a, const float* b, const float* c)
+{
+	float e0[3], e1[3];
+	sub(e0, b, a);
+	sub(e1, c, a);
+	cross(n, e0, e1);
+}
+
+// ----------------------------------------------------
+// Vertex cache
+// ----------------------------------------------------
+
+static const int vertexCacheSize = 32;
+
+static float vertexScore(int cachePos, uint32_t activeTriangles)
+{
+	if (activeTriangles == 0)
+		return -1.0f;
+	float score = 0.0f;
+	// the last triangle's vertices score lower, so strips don't zig-zag
+	if (cachePos >= 0)
+		score = cachePos < 3 ? 0.75f : pow(1.0f - (float)(cachePos - 3) / (vertexCacheSize - 3), 1.5f);
+	// favour vertices with few triangles left, to finish them off
+	return score + 2.0f / sqrt((float)activeTriangles);
+}
+
+void optimizeVertexCache(vector<uint32_t>& indices, size_t vertexCount)
+{
+	size_t triCount = indices.size() / 3;
+	if (triCount == 0)
+		return;
+
+	// triangles of each vertex, the live ones in [offsets[v], offsets[v] + remaining[v])
+	vector<uint32_t> remaining(vertexCount, 0), offsets(vertexCount + 1, 0);
+	for (uint32_t v : indices)
+		remaining[v]++;
+	for (size_t v = 0; v < vertexCount; v++)
+		offsets[v + 1] = offsets[v] + remaining[v];
+	vector<uint32_t> adjacency(indices.size()), fill(offsets.begin(), offsets.end() - 1);
+	for (uint32_t t = 0; t < (uint32_t)triCount; t++)
+		for (int k = 0; k < 3; k++)
+			adjacency[fill[indices[t * 3 + k]]++] = t;
+
+	vector<int> cachePos(vertexCount, -1);
+	vector<float> score(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+		score[v] = vertexScore(-1, remaining[v]);
+	vector<bool> emitted(triCount, false);
+
+	vector<uint32_t> result, cache, newCache;
+	result.reserve(indices.size());
+	size_t cursor = 0;
+	int64_t best = -1;
+	while (result.size() < indices.size()) {
+		// nothing adjacent to the cache, continue in input order
+		if (best < 0) {
+			while (emitted[cursor])
+				cursor++;
+			best = (int64_t)cursor;
+		}
+		emitted[best] = true;
+		const uint32_t* tri = &indices[best * 3];
+		result.insert(result.end(), tri, tri + 3);
+
+		for (int k = 0; k < 3; k++) {
+			uint32_t v = tri[k];
+			uint32_t* first = &adjacency[offsets[v]];
+			uint32_t* last = first + remaining[v] - 1;
+			*find(first, last + 1, (uint32_t)best) = *last;
+			remaining[v]--;
+		}
+
+		// the triangle's vertices move to the front, the overflow is evicted
+		newCache.assign(tri, tri + 3);
+		for (uint32_t v : cache)
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				newCache.push_back(v);
+		for (size_t i = 0; i < newCache.size(); i++) {
+			uint32_t v = newCache[i];
+			cachePos[v] = i < vertexCacheSize ? (int)i : -1;
+			score[v] = vertexScore(cachePos[v], remaining[v]);
+		}
+
+		best = -1;
+		float bestScore = -1.0f;
+		for (uint32_t v : newCache) {
+			for (uint32_t i = offsets[v]; i < offsets[v] + remaining[v]; i++) {
+				uint32_t t = adjacency[i];
+				float s = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+				if (s > bestScore) {
+					bestScore = s;
+					best = t;
+				}
+			}
+		}
+		if (newCache.size() > vertexCacheSize)
+			newCache.resize(vertexCacheSize);
+		cache.swap(newCache);
+	}
+	indices.swap(result);
+}
+
+float averageCacheMissRatio(const vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize)
+{
+	if (indices.empty())
+		return 0.0f;
+	// FIFO: a vertex is cached if fewer than cacheSize misses happened since it was loaded
+	vector<uint32_t> loaded(vertexCount, 0);
+	uint32_t misses = 0;
+	for (uint32_t v : indices) {
+		if (loaded[v] == 0 || misses - loaded[v] >= cacheSize) {
+			misses++;
+			loaded[v] = misses;
+		}
+	}
+	return (float)misses / (indices.size() / 3);
+}
+
+// ----------------------------------------------------
+// Overdraw
+// ----------------------------------------------------
+
+void optimizeOverdraw(vector<uint32_t>& indices, const vector<ToolVertex>& vertices)
+{
+	size_t triCount = indices.size() / 3;
+	if (triCount == 0)
+		return;
+
+	// a triangle missing the cache with all three vertices starts a cluster,
+	// reordering whole clusters keeps the cache behaviour
+	const uint32_t fifoSize = 16;
+	vector<uint32_t> loaded(vertices.size(), 0);
+	uint32_t misses = 0;
+	vector<size_t> clusters;
+	for (size_t t = 0; t < triCount; t++) {
+		int triMisses = 0;
+		for (int k = 0; k < 3; k++) {
+			uint32_t v = indices[t * 3 + k];
+			if (loaded[v] == 0 || misses - loaded[v] >= fifoSize) {
+				misses++;
+				loaded[v] = misses;
+				triMisses++;
+			}
+		}
+		if (t == 0 || triMisses == 3)
+			clusters.push_back(t);
+	}
+	clusters.push_back(triCount);
+
+	// area weighted centroid and normal per cluster
+	size_t numClusters = clusters.size() - 1;
+	vector<float> centroids(numClusters * 3, 0.0f), normals(numClusters * 3, 0.0f), areas(numClusters, 0.0f);
+	float meshCenter[3] = { 0, 0, 0 }, meshArea = 0;
+	for (size_t c = 0; c < numClusters; c++) {
+		for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+			const float* p0 = vertices[indices[t * 3]].pos;
+			const float* p1 = vertices[indices[t * 3 + 1]].pos;
+			const float* p2 = vertices[indices[t * 3 + 2]].pos;
+			float n[3];
+			triangleNormal(n, p0, p1, p2);
+			float area = sqrt(dot(n, n));
+			for (int i = 0; i < 3; i++) {
+				centroids[c * 3 + i] += (p0[i] + p1[i] + p2[i]) / 3.0f * area;
+				normals[c * 3 + i] += n[i];
+			}
+			areas[c] += area;
+		}
+		for (int i = 0; i < 3; i++)
+			meshCenter[i] += centroids[c * 3 + i];
+		meshArea += areas[c];
+		if (areas[c] > 0)
+			for (int i = 0; i < 3; i++)
+				centroids[c * 3 + i] /= areas[c];
+	}
+	if (meshArea > 0)
+		for (int i = 0; i < 3; i++)
+			meshCenter[i] /= meshArea;
+
+	// facing away from the center first: on a convex-ish mesh those are in
+	// front of the others from most directions
+	vector<float> sortKey(numClusters);
+	for (size_t c = 0; c < numClusters; c++) {
+		float d[3];
+		sub(d, &centroids[c * 3], meshCenter);
+		float len = sqrt(dot(&normals[c * 3], &normals[c * 3]));
+		sortKey[c] = len > 0 ? dot(d, &normals[c * 3]) / len : 0.0f;
+	}
+	vector<uint32_t> order(numClusters);
+	for (size_t c = 0; c < numClusters; c++)
+		order[c] = (uint32_t)c;
+	stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKey[a] > sortKey[b]; });
+
+	vector<uint32_t> result;
+	result.reserve(indices.size());
+	for (uint32_t c : order)
+		result.insert(result.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+	indices.swap(result);
+}
+
+// ----------------------------------------------------
+// Vertex fetch
+// ----------------------------------------------------
+
+void optimizeVertexFetch(vector<ToolVertex>& vertices, vector<uint32_t>& indices)
+{
+	vector<uint32_t> remap(vertices.size(), ~0u);
+	vector<ToolVertex> result;
+	result.reserve(vertices.size());
+	for (uint32_t& i : indices) {
+		if (remap[i] == ~0u) {
+			remap[i] = (uint32_t)result.size();
+			result.push_back(vertices[i]);
+		}
+		i = remap[i];
+	}
+	vertices.swap(result);
+}
+
+// ----------------------------------------------------
+// Simplification
+// ----------------------------------------------------
+
+// Symmetric 4x4 matrix of the summed squared plane distances, with the
+// summed weights so errors are an average distance
+struct Quadric {
+	double xx, xy, xz, xw, yy, yz, yw, zz, zw, ww, weight;
+
+	void addPlane(const double* n, double d, double w)
+	{
+		xx += w * n[0] * n[0]; xy += w * n[0] * n[1]; xz += w * n[0] * n[2]; xw += w * n[0] * d;
+		yy += w * n[1] * n[1]; yz += w * n[1] * n[2]; yw += w * n[1] * d;
+		zz += w * n[2] * n[2]; zw += w * n[2] * d;
+		ww += w * d * d;
+		weight += w;
+	}
+	void add(const Quadric& q)
+	{
+		xx += q.xx; xy += q.xy; xz += q.xz; xw += q.xw; yy += q.yy; yz += q.yz; yw += q.yw;
+		zz += q.zz; zw += q.zw; ww += q.ww; weight += q.weight;
+	}
+	// squared distance
+	double error(const float* p) const
+	{
+		double x = p[0], y = p[1], z = p[2];
+		double e = xx * x * x + 2 * xy * x * y + 2 * xz * x * z + 2 * xw * x
+			+ yy * y * y + 2 * yz * y * z + 2 * yw * y
+			+ zz * z * z + 2 * zw * z + ww;
+		return weight > 0 ? fabs(e) / weight : 0.0;
+	}
+};
+
+static uint64_t edgeKey(uint32_t a, uint32_t b)
+{
+	return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+}
+
+vector<uint32_t> simplify(const vector<uint32_t>& indices, const vector<ToolVertex>& vertices,
+	size_t targetIndexCount, float targetError, float* error)
+{
+	size_t n = vertices.size();
+
+	// vertices sharing a position are split by attributes; collapses work on
+	// positions, represented by their first vertex
+	vector<uint32_t> rep(n);
+	vector<uint32_t> copies(n, 0);
+	{
+		struct PosHash {
+			size_t operator()(const array<float, 3>& p) const
+			{
+				uint32_t h[3];
+				memcpy(h, p.data(), sizeof(h));
+				return h[0] * 73856093u ^ h[1] * 19349663u ^ h[2] * 83492791u;
+			}
+		};
+		unordered_map<array<float, 3>, uint32_t, PosHash> first;
+		for (uint32_t v = 0; v < (uint32_t)n; v++) {
+			array<float, 3> p = {{ vertices[v].pos[0], vertices[v].pos[1], vertices[v].pos[2] }};
+			auto it = first.emplace(p, v).first;
+			rep[v] = it->second;
+			copies[rep[v]]++;
+		}
+	}
+
+	// result holds positions, corners the vertex each corner uses
+	vector<uint32_t> result(indices.size()), corners = indices;
+	for (size_t i = 0; i < indices.size(); i++)
+		result[i] = rep[indices[i]];
+
+	// borders and seams stay put
+	vector<bool> locked(n, false);
+	{
+		unordered_map<uint64_t, int> edgeUse;
+		for (size_t t = 0; t < result.size(); t += 3)
+			for (int k = 0; k < 3; k++)
+				edgeUse[edgeKey(result[t + k], result[t + (k + 1) % 3])]++;
+		for (auto& e : edgeUse) {
+			if (e.second == 1) {
+				locked[e.first >> 32] = true;
+				locked[e.first & 0xffffffff] = true;
+			}
+		}
+		for (size_t v = 0; v < n; v++)
+			if (copies[v] > 1)
+				locked[v] = true;
+	}
+
+	vector<Quadric> quadrics(n);
+	memset(quadrics.data(), 0, n * sizeof(Quadric));
+	for (size_t t = 0; t < result.size(); t += 3) {
+		const float* p0 = vertices[result[t]].pos;
+		float nf[3];
+		triangleNormal(nf, p0, vertices[result[t + 1]].pos, vertices[result[t + 2]].pos);
+		double len = sqrt((double)dot(nf, nf));
+		if (len == 0)
+			continue;
+		double nd[3] = { nf[0] / len, nf[1] / len, nf[2] / len };
+		double d = -(nd[0] * p0[0] + nd[1] * p0[1] + nd[2] * p0[2]);
+		for (int k = 0; k < 3; k++)
+			quadrics[result[t + k]].addPlane(nd, d, len * 0.5);
+	}
+
+	struct Collapse {
+		uint32_t from, to;
+		double cost;
+	};
+	double maxCost = 0, limit = (double)targetError * targetError;
+	vector<uint32_t> collapseTo(n);
+	vector<bool> touched(n);
+	vector<uint32_t> triOffsets(n + 1), triList, fill;
+
+	while (result.size() > targetIndexCount) {
+		// candidate collapses along every edge, in the cheaper direction
+		vector<uint64_t> edges;
+		edges.reserve(result.size());
+		for (size_t t = 0; t < result.size(); t += 3)
+			for (int k = 0; k < 3; k++)
+				edges.push_back(edgeKey(result[t + k], result[t + (k + 1) % 3]));
+		sort(edges.begin(), edges.end());
+		edges.erase(unique(edges.begin(), edges.end()), edges.end());
+
+		vector<Collapse> candidates;
+		for (uint64_t e : edges) {
+			uint32_t a = (uint32_t)(e >> 32), b = (uint32_t)(e & 0xffffffff);
+			Quadric q = quadrics[a];
+			q.add(quadrics[b]);
+			double ab = locked[a] ? -1 : q.error(vertices[b].pos);
+			double ba = locked[b] ? -1 : q.error(vertices[a].pos);
+			if (ab < 0 && ba < 0)
+				continue;
+			if (ba < 0 || (ab >= 0 && ab <= ba))
+				candidates.push_back({ a, b, ab });
+			else
+				candidates.push_back({ b, a, ba });
+		}
+		sort(candidates.begin(), candidates.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+		// triangles of each vertex, for the flip test
+		fill_n(triOffsets.begin(), n + 1, 0);
+		for (uint32_t v : result)
+			triOffsets[v + 1]++;
+		for (size_t v = 0; v < n; v++)
+			triOffsets[v + 1] += triOffsets[v];
+		triList.resize(result.size());
+		fill.assign(triOffsets.begin(), triOffsets.end() - 1);
+		for (uint32_t i = 0; i < (uint32_t)result.size(); i++)
+			triList[fill[result[i]]++] = i / 3;
+
+		for (size_t v = 0; v < n; v++)
+			collapseTo[v] = (uint32_t)v;
+		fill_n(touched.begin(), n, false);
+		size_t triangles = result.size() / 3, target = targetIndexCount / 3;
+		bool collapsed = false;
+		for (auto& c : candidates) {
+			if (c.cost > limit || triangles <= target)
+				break;
+			if (touched[c.from] || touched[c.to])
+				continue;
+
+			// moving from onto to must not flip any remaining triangle
+			bool flips = false;
+			int removed = 0;
+			for (uint32_t i = triOffsets[c.from]; i < triOffsets[c.from + 1] && !flips; i++) {
+				const uint32_t* tri = &result[triList[i] * 3];
+				if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) {
+					removed++;
+					continue;
+				}
+				const float* p[3], *q[3];
+				for (int k = 0; k < 3; k++) {
+					p[k] = vertices[tri[k]].pos;
+					q[k] = tri[k] == c.from ? vertices[c.to].pos : p[k];
+				}
+				float before[3], after[3];
+				triangleNormal(before, p[0], p[1], p[2]);
+				triangleNormal(after, q[0], q[1], q[2]);
+				flips = dot(before, after) <= 0;
+			}
+			if (flips)
+				continue;
+
+			collapseTo[c.from] = c.to;
+			quadrics[c.to].add(quadrics[c.from]);
+			// the one-ring moved, its other collapses wait for the next pass
+			for (uint32_t i = triOffsets[c.from]; i < triOffsets[c.from + 1]; i++)
+				for (int k = 0; k < 3; k++)
+					touched[result[triList[i] * 3 + k]] = true;
+			touched[c.to] = true;
+			triangles -= removed;
+			maxCost = max(maxCost, c.cost);
+			collapsed = true;
+		}
+		if (!collapsed)
+			break;
+
+		// a corner keeps its own vertex unless its position moved
+		size_t out = 0;
+		for (size_t t = 0; t < result.size(); t += 3) {
+			uint32_t a = collapseTo[result[t]], b = collapseTo[result[t + 1]], c = collapseTo[result[t + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = result[t + k];
+				corners[out + k] = collapseTo[v] != v ? collapseTo[v] : corners[t + k];
+				result[out + k] = collapseTo[v];
+			}
+			out += 3;
+		}
+		result.resize(out);
+		corners.resize(out);
+	}
+
+	if (error)
+		*error = (float)sqrt(maxCost);
+	return corners;
+}
+
+// ----------------------------------------------------
+// Meshlets
+// ----------------------------------------------------
+
+static void meshletBounds(Meshlet& m, const vector<ToolVertex>& vertices,
+	const vector<uint32_t>& meshletVertices, const vector<uint8_t>& meshletTriangles)
+{
+	float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+	for (uint32_t i = 0; i < m.vertexCount; i++) {
+		const float* p = vertices[meshletVertices[m.vertexOffset + i]].pos;
+		for (int k = 0; k < 3; k++) {
+			lo[k] = min(lo[k], p[k]);
+			hi[k] = max(hi[k], p[k]);
+		}
+	}
+	float r2 = 0;
+	for (int k = 0; k < 3; k++)
+		m.center[k] = (lo[k] + hi[k]) * 0.5f;
+	for (uint32_t i = 0; i < m.vertexCount; i++) {
+		float d[3];
+		sub(d, vertices[meshletVertices[m.vertexOffset + i]].pos, m.center);
+		r2 = max(r2, dot(d, d));
+	}
+	m.radius = sqrt(r2);
+
+	// the cone holds every triangle normal; its cutoff is the sine of the spread
+	vector<float> normals;
+	float axis[3] = { 0, 0, 0 };
+	for (uint32_t t = 0; t < m.triangleCount; t++) {
+		const uint8_t* tri = &meshletTriangles[(m.triangleOffset + t) * 3];
+		float n[3];
+		triangleNormal(n, vertices[meshletVertices[m.vertexOffset + tri[0]]].pos,
+			vertices[meshletVertices[m.vertexOffset + tri[1]]].pos, vertices[meshletVertices[m.vertexOffset + tri[2]]].pos);
+		float len = sqrt(dot(n, n));
+		if (len == 0)
+			continue;
+		for (int k = 0; k < 3; k++) {
+			normals.push_back(n[k] / len);
+			axis[k] += n[k] / len;
+		}
+	}
+	float len = sqrt(dot(axis, axis));
+	float minDot = 1.0f;
+	if (len > 0) {
+		for (int k = 0; k < 3; k++)
+			axis[k] /= len;
+		for (size_t i = 0; i < normals.size(); i += 3)
+			minDot = min(minDot, dot(axis, &normals[i]));
+	}
+	memcpy(m.coneAxis, axis, sizeof(axis));
+	// a cutoff of 1 never culls
+	m.coneCutoff = len > 0 && minDot > 0 ? sqrt(1.0f - minDot * minDot) : 1.0f;
+}
+
+void buildMeshlets(const vector<uint32_t>& indices, const vector<ToolVertex>& vertices,
+	vector<Meshlet>& meshlets, vector<uint32_t>& meshletVertices, vector<uint8_t>& meshletTriangles)
+{
+	vector<uint32_t> local(vertices.size(), ~0u);
+	Meshlet cur;
+	memset(&cur, 0, sizeof(cur));
+	cur.vertexOffset = (uint32_t)meshletVertices.size();
+	cur.triangleOffset = (uint32_t)meshletTriangles.size() / 3;
+
+	auto flush = [&]() {
+		if (cur.triangleCount == 0)
+			return;
+		meshletBounds(cur, vertices, meshletVertices, meshletTriangles);
+		meshlets.push_back(cur);
+		for (uint32_t i = 0; i < cur.vertexCount; i++)
+			local[meshletVertices[cur.vertexOffset + i]] = ~0u;
+		memset(&cur, 0, sizeof(cur));
+		cur.vertexOffset = (uint32_t)meshletVertices.size();
+		cur.triangleOffset = (uint32_t)meshletTriangles.size() / 3;
+	};
+
+	// in the cache optimized order neighbouring triangles are close, which
+	// keeps the meshlets compact
+	for (size_t t = 0; t < indices.size(); t += 3) {
+		uint32_t newVertices = 0;
+		for (int k = 0; k < 3; k++)
+			newVertices += local[indices[t + k]] == ~0u;
+		if (cur.vertexCount + newVertices > meshletMaxVertices || cur.triangleCount + 1 > meshletMaxTriangles)
+			flush();
+		for (int k = 0; k < 3; k++) {
+			uint32_t v = indices[t + k];
+			if (local[v] == ~0u) {
+				local[v] = cur.vertexCount++;
+				meshletVertices.push_back(v);
+			}
+			meshletTriangles.push_back((uint8_t)local[v]);
+		}
+		cur.triangleCount++;
+	}
+	flush();
+}
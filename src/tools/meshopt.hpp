@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "meshformat.hpp"
+
+// Offline mesh optimization for fugu_meshopt. Meshes are indexed triangle
+// lists of full precision vertices, quantized only when written.
+struct ToolVertex {
+	float pos[3];
+	float normal[3];
+	float uv[2];
+};
+
+// Reorder triangles for the post-transform vertex cache, Forsyth's
+// linear-speed algorithm
+void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount);
+// Split the cache optimized order where the cache restarts and draw the
+// outward facing clusters first, so they occlude the rest. Keeps the
+// cache efficiency, run after optimizeVertexCache.
+void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<ToolVertex>& vertices);
+// Order vertices by first use and drop unused ones. indices holds every
+// index referencing vertices, e.g. all LODs, and is remapped.
+void optimizeVertexFetch(std::vector<ToolVertex>& vertices, std::vector<uint32_t>& indices);
+// Quadric error edge collapse down to targetIndexCount, stopping early
+// before a collapse would move the surface by more than targetError.
+// Borders and attribute seams are kept in place. error is the largest
+// deviation introduced.
+std::vector<uint32_t> simplify(const std::vector<uint32_t>& indices, const std::vector<ToolVertex>& vertices,
+	size_t targetIndexCount, float targetError, float* error = nullptr);
+// Split the triangles into meshlets of at most meshletMaxVertices and
+// meshletMaxTriangles, with bounding spheres and normal cones. Appends to
+// the output arrays, offsets are into them.
+void buildMeshlets(const std::vector<uint32_t>& indices, const std::vector<ToolVertex>& vertices,
+	std::vector<Meshlet>& meshlets, std::vector<uint32_t>& meshletVertices, std::vector<uint8_t>& meshletTriangles);
+// Average vertex shader invocations per triangle with a FIFO cache
+float averageCacheMissRatio(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = 16);
@@ -0,0 +1,244 @@
+// fugu_meshopt: optimizes a Wavefront OBJ into the mesh format of meshformat.hpp
+//
+//   fugu_meshopt <input.obj> <output.mesh> [--lods N] [--lod-error E]
+//
+// Triangles are reordered for the vertex cache and overdraw, vertices for
+// fetch locality. LODs halve the triangle count each, as long as the
+// simplification error stays below E times the mesh radius. Every LOD is
+// split into meshlets.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <tuple>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "tools/meshopt.hpp"
+
+using namespace std;
+
+static bool loadObj(const string& path, vector<ToolVertex>& vertices, vector<uint32_t>& indices)
+{
+	ifstream ifs(path);
+	if (!ifs.is_open())
+		return false;
+
+	vector<float> pos, normal, uv;
+	map<tuple<int, int, int>, uint32_t> unique;
+	bool hasNormals = true;
+	string line;
+	while (getline(ifs, line)) {
+		istringstream is(line);
+		string type;
+		is >> type;
+		float x = 0, y = 0, z = 0;
+		if (type == "v") {
+			is >> x >> y >> z;
+			pos.insert(pos.end(), { x, y, z });
+		} else if (type == "vn") {
+			is >> x >> y >> z;
+			normal.insert(normal.end(), { x, y, z });
+		} else if (type == "vt") {
+			is >> x >> y;
+			uv.insert(uv.end(), { x, y });
+		} else if (type == "f") {
+			// v, v/t, v//n or v/t/n, negative indices count from the end
+			vector<uint32_t> face;
+			string corner;
+			while (is >> corner) {
+				int idx[3] = { 0, 0, 0 };
+				size_t start = 0;
+				for (int k = 0; k < 3 && start <= corner.size(); k++) {
+					size_t end = corner.find('/', start);
+					string part = corner.substr(start, end == string::npos ? string::npos : end - start);
+					if (!part.empty())
+						idx[k] = stoi(part);
+					if (end == string::npos)
+						break;
+					start = end + 1;
+				}
+				int counts[3] = { (int)pos.size() / 3, (int)uv.size() / 2, (int)normal.size() / 3 };
+				for (int k = 0; k < 3; k++)
+					idx[k] = idx[k] < 0 ? counts[k] + idx[k] : idx[k] - 1;
+				if (idx[0] < 0 || idx[0] >= counts[0] || idx[1] >= counts[1] || idx[2] >= counts[2])
+					return false;
+				hasNormals = hasNormals && idx[2] >= 0;
+
+				auto key = make_tuple(idx[0], idx[1], idx[2]);
+				auto it = unique.find(key);
+				if (it == unique.end()) {
+					ToolVertex v;
+					memset(&v, 0, sizeof(v));
+					memcpy(v.pos, &pos[idx[0] * 3], sizeof(v.pos));
+					if (idx[1] >= 0)
+						memcpy(v.uv, &uv[idx[1] * 2], sizeof(v.uv));
+					if (idx[2] >= 0)
+						memcpy(v.normal, &normal[idx[2] * 3], sizeof(v.normal));
+					it = unique.emplace(key, (uint32_t)vertices.size()).first;
+					vertices.push_back(v);
+				}
+				face.push_back(it->second);
+			}
+			// fan triangulation
+			for (size_t i = 2; i < face.size(); i++)
+				indices.insert(indices.end(), { face[0], face[i - 1], face[i] });
+		}
+	}
+
+	// area weighted smooth normals
+	if (!hasNormals) {
+		for (auto& v : vertices)
+			v.normal[0] = v.normal[1] = v.normal[2] = 0;
+		for (size_t t = 0; t < indices.size(); t += 3) {
+			const float* a = vertices[indices[t]].pos, *b = vertices[indices[t + 1]].pos, *c = vertices[indices[t + 2]].pos;
+			float e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] }, e1[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			float n[3] = { e0[1] * e1[2] - e0[2] * e1[1], e0[2] * e1[0] - e0[0] * e1[2], e0[0] * e1[1] - e0[1] * e1[0] };
+			for (int k = 0; k < 3; k++)
+				for (int i = 0; i < 3; i++)
+					vertices[indices[t + k]].normal[i] += n[i];
+		}
+	}
+	for (auto& v : vertices) {
+		float len = sqrt(v.normal[0] * v.normal[0] + v.normal[1] * v.normal[1] + v.normal[2] * v.normal[2]);
+		for (int i = 0; i < 3; i++)
+			v.normal[i] = len > 0 ? v.normal[i] / len : (i == 2 ? 1.0f : 0.0f);
+	}
+	return true;
+}
+
+template<class T>
+static void writeArray(ofstream& ofs, const vector<T>& v)
+{
+	ofs.write((const char*)v.data(), v.size() * sizeof(T));
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3) {
+		cerr << "usage: fugu_meshopt <input.obj> <output.mesh> [--lods N] [--lod-error E]" << endl;
+		return 1;
+	}
+	int maxLods = 4;
+	float lodError = 0.02f;
+	for (int i = 3; i + 1 < argc; i += 2) {
+		string arg = argv[i];
+		if (arg == "--lods")
+			maxLods = min(max(stoi(argv[i + 1]), 1), 16);
+		else if (arg == "--lod-error")
+			lodError = stof(argv[i + 1]);
+	}
+
+	vector<ToolVertex> vertices;
+	vector<uint32_t> indices;
+	if (!loadObj(argv[1], vertices, indices) || indices.empty()) {
+		cerr << "fugu_meshopt: can't load " << argv[1] << endl;
+		return 1;
+	}
+
+	MeshHeader header;
+	memset(&header, 0, sizeof(header));
+	float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+	for (auto& v : vertices) {
+		for (int k = 0; k < 3; k++) {
+			lo[k] = min(lo[k], v.pos[k]);
+			hi[k] = max(hi[k], v.pos[k]);
+		}
+	}
+	for (int k = 0; k < 3; k++)
+		header.center[k] = (lo[k] + hi[k]) * 0.5f;
+	for (auto& v : vertices) {
+		float d[3] = { v.pos[0] - header.center[0], v.pos[1] - header.center[1], v.pos[2] - header.center[2] };
+		header.radius = max(header.radius, sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]));
+	}
+
+	float acmrBefore = averageCacheMissRatio(indices, vertices.size());
+	optimizeVertexCache(indices, vertices.size());
+	optimizeOverdraw(indices, vertices);
+	float acmrAfter = averageCacheMissRatio(indices, vertices.size());
+
+	// each LOD from the previous one, errors add up
+	vector<vector<uint32_t>> lodIndices = { indices };
+	vector<float> lodErrors = { 0.0f };
+	while ((int)lodIndices.size() < maxLods) {
+		const vector<uint32_t>& prev = lodIndices.back();
+		size_t target = prev.size() / 6 * 3;
+		float stepError = 0;
+		float budget = lodError * header.radius - lodErrors.back() * header.radius;
+		if (budget <= 0)
+			break;
+		vector<uint32_t> lod = simplify(prev, vertices, target, budget, &stepError);
+		// stop when little came off, e.g. everything left is locked
+		if (lod.empty() || lod.size() > prev.size() * 9 / 10)
+			break;
+		optimizeVertexCache(lod, vertices.size());
+		optimizeOverdraw(lod, vertices);
+		lodErrors.push_back(lodErrors.back() + (header.radius > 0 ? stepError / header.radius : 0));
+		lodIndices.push_back(move(lod));
+	}
+
+	vector<MeshLod> lods(lodIndices.size());
+	vector<uint32_t> allIndices;
+	for (size_t i = 0; i < lodIndices.size(); i++) {
+		lods[i].firstIndex = (uint32_t)allIndices.size();
+		lods[i].indexCount = (uint32_t)lodIndices[i].size();
+		lods[i].error = lodErrors[i];
+		allIndices.insert(allIndices.end(), lodIndices[i].begin(), lodIndices[i].end());
+	}
+	optimizeVertexFetch(vertices, allIndices);
+
+	vector<Meshlet> meshlets;
+	vector<uint32_t> meshletVertices;
+	vector<uint8_t> meshletTriangles;
+	for (auto& lod : lods) {
+		vector<uint32_t> lodRange(allIndices.begin() + lod.firstIndex, allIndices.begin() + lod.firstIndex + lod.indexCount);
+		lod.firstMeshlet = (uint32_t)meshlets.size();
+		buildMeshlets(lodRange, vertices, meshlets, meshletVertices, meshletTriangles);
+		lod.meshletCount = (uint32_t)meshlets.size() - lod.firstMeshlet;
+	}
+
+	vector<MeshVertex> packed(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) {
+		const ToolVertex& v = vertices[i];
+		memcpy(packed[i].pos, v.pos, sizeof(v.pos));
+		packed[i].normal = octNormal(v.normal[0], v.normal[1], v.normal[2]);
+		packed[i].uv = half2(v.uv[0], v.uv[1]);
+	}
+
+	memcpy(header.magic, meshMagic, sizeof(header.magic));
+	header.version = meshVersion;
+	header.vertexCount = (uint32_t)packed.size();
+	header.indexCount = (uint32_t)allIndices.size();
+	header.lodCount = (uint32_t)lods.size();
+	header.meshletCount = (uint32_t)meshlets.size();
+	header.meshletVertexCount = (uint32_t)meshletVertices.size();
+	header.meshletTriangleCount = (uint32_t)meshletTriangles.size() / 3;
+	meshletTriangles.resize((meshletTriangles.size() + 3) / 4 * 4, 0);
+
+	ofstream ofs(argv[2], ios::binary | ios::trunc);
+	if (!ofs.is_open()) {
+		cerr << "fugu_meshopt: can't write " << argv[2] << endl;
+		return 1;
+	}
+	ofs.write((const char*)&header, sizeof(header));
+	writeArray(ofs, lods);
+	writeArray(ofs, packed);
+	writeArray(ofs, allIndices);
+	writeArray(ofs, meshlets);
+	writeArray(ofs, meshletVertices);
+	writeArray(ofs, meshletTriangles);
+	if (!ofs.good()) {
+		cerr << "fugu_meshopt: error writing " << argv[2] << endl;
+		return 1;
+	}
+
+	cout << "fugu_meshopt: " << argv[1] << ": " << packed.size() << " vertices, ACMR "
+		<< acmrBefore << " -> " << acmrAfter << endl;
+	for (size_t i = 0; i < lods.size(); i++)
+		cout << "  lod " << i << ": " << lods[i].indexCount / 3 << " triangles, " << lods[i].meshletCount
+			<< " meshlets, error " << lods[i].error << endl;
+	return 0;
+}
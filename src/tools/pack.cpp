@@ -0,0 +1,124 @@
+// fugu_pack: packs assets into an archive read by util/archive.hpp
+//
+//   fugu_pack <output> <root> <files...>
+//
+// Entries are named by their path relative to root, e.g. shader/simple.vert.spv
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include "util/archive.hpp"
+
+using namespace std;
+
+// multiple of VkPhysicalDeviceLimits::minMemoryMapAlignment and the SPIR-V word size
+static const uint32_t alignment = 64;
+
+static uint32_t entryType(const string& name)
+{
+	auto ends = [&](const char* ext) {
+		size_t n = strlen(ext);
+		return name.size() >= n && name.compare(name.size() - n, n, ext) == 0;
+	};
+	if (ends(".spv"))
+		return ArchiveEntry::Shader;
+	if (ends(".mesh"))
+		return ArchiveEntry::Mesh;
+	if (ends(".ktx") || ends(".dds"))
+		return ArchiveEntry::Texture;
+	return ArchiveEntry::Raw;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3) {
+		cerr << "usage: fugu_pack <output> <root> <files...>" << endl;
+		return 1;
+	}
+	string root = argv[2];
+	replace(root.begin(), root.end(), '\\', '/');
+	if (!root.empty() && root.back() != '/')
+		root += '/';
+
+	struct Input {
+		string name, path;
+		vector<char> data;
+	};
+	vector<Input> inputs;
+	for (int i = 3; i < argc; i++) {
+		Input in;
+		in.path = argv[i];
+		in.name = in.path;
+		replace(in.name.begin(), in.name.end(), '\\', '/');
+		if (in.name.compare(0, root.size(), root) == 0)
+			in.name = in.name.substr(root.size());
+		if (in.name.size() >= sizeof(ArchiveEntry::name)) {
+			cerr << "fugu_pack: name too long: " << in.name << endl;
+			return 1;
+		}
+		ifstream ifs(in.path, ios::binary | ios::ate);
+		if (!ifs.is_open()) {
+			cerr << "fugu_pack: can't open " << in.path << endl;
+			return 1;
+		}
+		in.data.resize((size_t)ifs.tellg());
+		ifs.seekg(0, ios::beg);
+		ifs.read(in.data.data(), in.data.size());
+		inputs.push_back(move(in));
+	}
+	// Archive::find binary searches the index
+	sort(inputs.begin(), inputs.end(), [](const Input& a, const Input& b) { return a.name < b.name; });
+	for (size_t i = 1; i < inputs.size(); i++) {
+		if (inputs[i].name == inputs[i - 1].name) {
+			cerr << "fugu_pack: duplicate entry " << inputs[i].name << endl;
+			return 1;
+		}
+	}
+
+	auto align = [](uint64_t v) { return (v + alignment - 1) / alignment * alignment; };
+	vector<ArchiveEntry> index(inputs.size());
+	uint64_t offset = align(sizeof(ArchiveHeader) + index.size() * sizeof(ArchiveEntry));
+	for (size_t i = 0; i < inputs.size(); i++) {
+		ArchiveEntry& e = index[i];
+		memset(&e, 0, sizeof(e));
+		memcpy(e.name, inputs[i].name.data(), inputs[i].name.size());
+		e.offset = offset;
+		e.size = inputs[i].data.size();
+		e.checksum = Archive::checksum(inputs[i].data.data(), inputs[i].data.size());
+		e.type = entryType(inputs[i].name);
+		offset = align(offset + e.size);
+	}
+
+	ArchiveHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, Archive::magic, sizeof(header.magic));
+	header.version = Archive::version;
+	header.numEntries = (uint32_t)index.size();
+	header.alignment = alignment;
+	header.indexChecksum = Archive::checksum(index.data(), index.size() * sizeof(ArchiveEntry));
+
+	ofstream ofs(argv[1], ios::binary | ios::trunc);
+	if (!ofs.is_open()) {
+		cerr << "fugu_pack: can't write " << argv[1] << endl;
+		return 1;
+	}
+	ofs.write((const char*)&header, sizeof(header));
+	ofs.write((const char*)index.data(), index.size() * sizeof(ArchiveEntry));
+	const char zeros[alignment] = {};
+	uint64_t pos = sizeof(header) + index.size() * sizeof(ArchiveEntry);
+	for (size_t i = 0; i < inputs.size(); i++) {
+		ofs.write(zeros, index[i].offset - pos);
+		ofs.write(inputs[i].data.data(), inputs[i].data.size());
+		pos = index[i].offset + index[i].size;
+	}
+	ofs.write(zeros, align(pos) - pos);
+	if (!ofs.good()) {
+		cerr << "fugu_pack: error writing " << argv[1] << endl;
+		return 1;
+	}
+	cout << "fugu_pack: " << inputs.size() << " entries, " << align(pos) << " bytes" << endl;
+	return 0;
+}
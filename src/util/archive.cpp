@@ -0,0 +1,130 @@
+#include "util/archive.hpp"
+#include "util/util.hpp"
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+const char Archive::magic[4] = { 'F', 'P', 'A', 'K' };
+Archive* Archive::active = nullptr;
+
+uint64_t Archive::checksum(const void* data, size_t size, uint64_t hash)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+bool Archive::open(const string& path, bool verify)
+{
+	close();
+	this->verify = verify;
+
+#ifdef _WIN32
+	HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (f == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	GetFileSizeEx(f, &size);
+	HANDLE m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m) {
+		CloseHandle(f);
+		fatalError("Can't map archive " + path);
+	}
+	file = f;
+	mapping = m;
+	fileSize = (size_t)size.QuadPart;
+	base = (const uint8_t*)MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	fstat(fd, &st);
+	fileSize = (size_t)st.st_size;
+	void* ptr = fileSize > 0 ? mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	// the mapping keeps the file alive
+	::close(fd);
+	base = ptr == MAP_FAILED ? nullptr : (const uint8_t*)ptr;
+#endif
+	if (!base)
+		fatalError("Can't map archive " + path);
+
+	header = (const ArchiveHeader*)base;
+	if (fileSize < sizeof(ArchiveHeader) || memcmp(header->magic, magic, sizeof(magic)) != 0)
+		fatalError("Not an asset archive: " + path);
+	if (header->version != version)
+		fatalError("Archive " + path + " has version " + to_string(header->version) + ", expected " + to_string(version));
+	// SPIR-V is used in place, so entries need at least word alignment
+	if (header->alignment < 4 || (header->alignment & (header->alignment - 1)) != 0)
+		fatalError("Archive " + path + " has a bad alignment " + to_string(header->alignment));
+	size_t indexSize = (size_t)header->numEntries * sizeof(ArchiveEntry);
+	if (fileSize < sizeof(ArchiveHeader) + indexSize)
+		fatalError("Archive " + path + " is truncated");
+	entries = (const ArchiveEntry*)(base + sizeof(ArchiveHeader));
+	if (checksum(entries, indexSize) != header->indexChecksum)
+		fatalError("Archive " + path + " has a corrupt index");
+	for (uint32_t i = 0; i < header->numEntries; i++) {
+		const ArchiveEntry& e = entries[i];
+		if (e.offset > fileSize || e.size > fileSize - e.offset || (e.offset & (header->alignment - 1)) != 0)
+			fatalError("Archive " + path + " has a bad entry " + string(e.name, strnlen(e.name, sizeof(e.name))));
+	}
+	return true;
+}
+
+void Archive::close()
+{
+	if (!base)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(base);
+	CloseHandle((HANDLE)mapping);
+	CloseHandle((HANDLE)file);
+#else
+	munmap((void*)base, fileSize);
+#endif
+	if (active == this)
+		active = nullptr;
+	base = nullptr;
+	header = nullptr;
+	entries = nullptr;
+	file = mapping = nullptr;
+	fileSize = 0;
+}
+
+const ArchiveEntry* Archive::find(const string& name) const
+{
+	if (!header || name.size() >= sizeof(ArchiveEntry::name))
+		return nullptr;
+
+	// names are zero padded, so strncmp orders them like the packer's sort
+	uint32_t lo = 0, hi = header->numEntries;
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		int cmp = strncmp(entries[mid].name, name.c_str(), sizeof(ArchiveEntry::name));
+		if (cmp == 0) {
+			const ArchiveEntry& e = entries[mid];
+			if (verify && checksum(data(e), (size_t)e.size) != e.checksum)
+				fatalError("Archive entry " + name + " is corrupt");
+			return &e;
+		}
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return nullptr;
+}
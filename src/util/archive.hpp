@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Packed asset archive, written by fugu_pack (src/tools/pack.cpp):
+//
+//   ArchiveHeader | ArchiveEntry[numEntries], sorted by name | data
+//
+// Every entry's data starts on an ArchiveHeader::alignment boundary, so
+// SPIR-V and vertex data can be used in place. Checksums are 64-bit FNV-1a.
+struct ArchiveHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t numEntries;
+	uint32_t alignment;
+	uint64_t indexChecksum;
+};
+
+struct ArchiveEntry {
+	enum Type { Raw, Shader, Mesh, Texture };
+
+	char name[64];
+	uint64_t offset, size, checksum;
+	uint32_t type;
+	uint32_t reserved;
+};
+
+// Read-only view of an archive mapped into memory. Nothing is read up
+// front besides the index: pages are faulted in when an entry is used and
+// are shared with every other process mapping the same file.
+//
+//   Archive assets;
+//   if (assets.open("assets.pak"))
+//       Archive::active = &assets;
+class Archive
+{
+public:
+	static const char magic[4];
+	static const uint32_t version = 1;
+
+	Archive() {}
+	~Archive() { close(); }
+	Archive(const Archive&) = delete;
+	Archive& operator=(const Archive&) = delete;
+
+	// False if the file doesn't exist, a malformed archive is a fatal error.
+	// With verify set, find checks the checksum of each entry it returns.
+	bool open(const std::string& path, bool verify = false);
+	void close();
+	bool isOpen() const { return base != nullptr; }
+
+	// Binary search of the index, nullptr if the archive has no such entry
+	const ArchiveEntry* find(const std::string& name) const;
+	const void* data(const ArchiveEntry& entry) const { return base + entry.offset; }
+	uint32_t numEntries() const { return header ? header->numEntries : 0; }
+	const ArchiveEntry& entry(uint32_t idx) const { return entries[idx]; }
+
+	static uint64_t checksum(const void* data, size_t size, uint64_t hash = 14695981039346656037ull);
+
+	// Used by Shader to load modules, falls back to loose files if null
+	static Archive* active;
+
+private:
+	const uint8_t* base = nullptr;
+	size_t fileSize = 0;
+	const ArchiveHeader* header = nullptr;
+	const ArchiveEntry* entries = nullptr;
+	bool verify = false;
+	void* file = nullptr;
+	void* mapping = nullptr;
+};
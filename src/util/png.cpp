@@ -0,0 +1,214 @@
+#include "util/png.hpp"
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const uint16_t distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const uint8_t distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+const int windowSize = 32768, minMatch = 3, maxMatch = 258;
+const int hashBits = 15;
+
+// deflate packs bits LSB first, Huffman codes MSB first
+struct BitWriter {
+	vector<uint8_t>& out;
+	uint32_t bits = 0;
+	int count = 0;
+
+	explicit BitWriter(vector<uint8_t>& out) : out(out) {}
+	void put(uint32_t value, int n)
+	{
+		bits |= value << count;
+		count += n;
+		while (count >= 8) {
+			out.push_back((uint8_t)bits);
+			bits >>= 8;
+			count -= 8;
+		}
+	}
+	void putCode(uint32_t code, int n)
+	{
+		uint32_t reversed = 0;
+		for (int i = 0; i < n; i++)
+			reversed |= ((code >> i) & 1) << (n - 1 - i);
+		put(reversed, n);
+	}
+	void flush()
+	{
+		if (count > 0)
+			out.push_back((uint8_t)bits);
+		bits = 0;
+		count = 0;
+	}
+};
+
+// fixed Huffman literal/length code of RFC 1951 3.2.6
+void putSymbol(BitWriter& w, int sym)
+{
+	if (sym < 144)
+		w.putCode(0x30 + sym, 8);
+	else if (sym < 256)
+		w.putCode(0x190 + sym - 144, 9);
+	else if (sym < 280)
+		w.putCode(sym - 256, 7);
+	else
+		w.putCode(0xc0 + sym - 280, 8);
+}
+
+void putMatch(BitWriter& w, int length, int dist)
+{
+	int l = 28;
+	while (lengthBase[l] > length)
+		l--;
+	putSymbol(w, 257 + l);
+	w.put(length - lengthBase[l], lengthExtra[l]);
+	int d = 29;
+	while (distBase[d] > dist)
+		d--;
+	w.putCode(d, 5);
+	w.put(dist - distBase[d], distExtra[d]);
+}
+
+uint32_t hash3(const uint8_t* p)
+{
+	return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - hashBits);
+}
+
+// zlib stream of one fixed-Huffman block
+void deflate(const vector<uint8_t>& in, vector<uint8_t>& out)
+{
+	out.push_back(0x78); // deflate, 32K window
+	out.push_back(0x01); // no dictionary, fastest
+	BitWriter w(out);
+	w.put(1, 1); // final block
+	w.put(1, 2); // fixed Huffman
+
+	// last position of each 3 byte hash, one candidate per match
+	vector<int> head(1 << hashBits, -1);
+	const int n = (int)in.size();
+	int i = 0;
+	while (i < n) {
+		int length = 0, dist = 0;
+		if (i + minMatch <= n) {
+			uint32_t h = hash3(&in[i]);
+			int cand = head[h];
+			head[h] = i;
+			if (cand >= 0 && i - cand <= windowSize) {
+				int limit = min(maxMatch, n - i);
+				while (length < limit && in[cand + length] == in[i + length])
+					length++;
+				dist = i - cand;
+			}
+		}
+		if (length >= minMatch) {
+			putMatch(w, length, dist);
+			// index the skipped positions too, runs find themselves again
+			for (int k = i + 1; k < i + length && k + minMatch <= n; k++)
+				head[hash3(&in[k])] = k;
+			i += length;
+		} else {
+			putSymbol(w, in[i]);
+			i++;
+		}
+	}
+	putSymbol(w, 256); // end of block
+	w.flush();
+
+	uint32_t a = 1, b = 0;
+	for (size_t k = 0; k < in.size(); k++) {
+		a = (a + in[k]) % 65521;
+		b = (b + a) % 65521;
+	}
+	uint32_t adler = b << 16 | a;
+	for (int s = 24; s >= 0; s -= 8)
+		out.push_back((uint8_t)(adler >> s));
+}
+
+struct CrcTable {
+	uint32_t entries[256];
+	CrcTable()
+	{
+		for (uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			entries[n] = c;
+		}
+	}
+};
+
+uint32_t crc32(const uint8_t* data, size_t size)
+{
+	static const CrcTable table;
+	uint32_t crc = ~0u;
+	for (size_t i = 0; i < size; i++)
+		crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+void putU32(vector<uint8_t>& out, uint32_t v)
+{
+	for (int s = 24; s >= 0; s -= 8)
+		out.push_back((uint8_t)(v >> s));
+}
+
+void putChunk(vector<uint8_t>& out, const char type[4], const vector<uint8_t>& data)
+{
+	putU32(out, (uint32_t)data.size());
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	putU32(out, crc32(&out[start], out.size() - start));
+}
+
+}
+
+vector<uint8_t> encodePng(const uint8_t* pixels, int width, int height, int channels, size_t stride)
+{
+	// filter byte, then each byte minus the same channel of the pixel to the left
+	const size_t rowSize = (size_t)width * channels;
+	vector<uint8_t> filtered((rowSize + 1) * height);
+	for (int y = 0; y < height; y++) {
+		const uint8_t* row = pixels + y * stride;
+		uint8_t* dst = &filtered[y * (rowSize + 1)];
+		dst[0] = 1; // Sub
+		for (size_t x = 0; x < rowSize; x++)
+			dst[x + 1] = (uint8_t)(row[x] - (x >= (size_t)channels ? row[x - channels] : 0));
+	}
+
+	vector<uint8_t> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	vector<uint8_t> ihdr;
+	putU32(ihdr, (uint32_t)width);
+	putU32(ihdr, (uint32_t)height);
+	ihdr.push_back(8); // bits per channel
+	ihdr.push_back(channels == 4 ? 6 : 2); // RGBA or RGB
+	ihdr.push_back(0); // deflate
+	ihdr.push_back(0); // adaptive filtering
+	ihdr.push_back(0); // not interlaced
+	putChunk(png, "IHDR", ihdr);
+	vector<uint8_t> idat;
+	deflate(filtered, idat);
+	putChunk(png, "IDAT", idat);
+	putChunk(png, "IEND", {});
+	return png;
+}
+
+bool writePng(const string& path, const uint8_t* pixels, int width, int height, int channels, size_t stride)
+{
+	vector<uint8_t> png = encodePng(pixels, width, height, channels, stride);
+	ofstream ofs(path, ios::binary | ios::trunc);
+	if (!ofs.is_open())
+		return false;
+	ofs.write((const char*)png.data(), png.size());
+	return ofs.good();
+}
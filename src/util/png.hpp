@@ -0,0 +1,15 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Minimal PNG writer for captured frames, no zlib needed. Rows use the Sub
+// filter and a single fixed-Huffman deflate block with greedy LZ77
+// matching: a fraction of zlib's ratio, but fast and good enough for
+// screenshots and image diffs.
+//
+// pixels holds height rows of width pixels, stride bytes apart, with
+// channels 3 (RGB) or 4 (RGBA) bytes each.
+std::vector<uint8_t> encodePng(const uint8_t* pixels, int width, int height, int channels, size_t stride);
+bool writePng(const std::string& path, const uint8_t* pixels, int width, int height, int channels, size_t stride);
@@ -0,0 +1,85 @@
+#include "threadpool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+using namespace std;
+
+ThreadPool::ThreadPool(int numThreads)
+{
+	if (numThreads <= 0)
+		numThreads = max(1, (int)thread::hardware_concurrency());
+	for (int i = 0; i < numThreads; i++)
+		workers.emplace_back([this] { run(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	cv.notify_all();
+	for (auto& t : workers)
+		t.join();
+}
+
+void ThreadPool::enqueue(function<void()> task)
+{
+	{
+		lock_guard<std::mutex> lock(mutex);
+		tasks.push_back(move(task));
+	}
+	cv.notify_one();
+}
+
+void ThreadPool::run()
+{
+	while (true) {
+		function<void()> task;
+		{
+			unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [this] { return stop || !tasks.empty(); });
+			if (stop && tasks.empty())
+				return;
+			task = move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+	}
+}
+
+void ThreadPool::parallelFor(int n, const function<void(int)>& fn)
+{
+	if (n <= 0)
+		return;
+
+	// Indices are claimed from a counter by the caller and by the workers.
+	// The caller never waits for a task still queued behind other work, e.g.
+	// pipeline compiles, only for calls that are already running. Tasks that
+	// start after the last index was claimed return at once, without
+	// touching fn, so they may outlive this call.
+	struct Shared {
+		atomic<int> next { 0 };
+		int done = 0;
+		std::mutex mutex;
+		condition_variable cv;
+	};
+	auto shared = make_shared<Shared>();
+	const function<void(int)>* body = &fn;
+	auto work = [shared, body, n] {
+		int i;
+		while ((i = shared->next++) < n) {
+			(*body)(i);
+			lock_guard<std::mutex> lock(shared->mutex);
+			if (++shared->done == n)
+				shared->cv.notify_all();
+		}
+	};
+	int helpers = min(n - 1, size());
+	for (int i = 0; i < helpers; i++)
+		enqueue(work);
+	work();
+
+	unique_lock<std::mutex> lock(shared->mutex);
+	shared->cv.wait(lock, [&] { return shared->done == n; });
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class ThreadPool
+{
+public:
+	// numThreads = 0 uses one worker per hardware thread
+	explicit ThreadPool(int numThreads = 0);
+	~ThreadPool();
+
+	void enqueue(std::function<void()> task);
+	// Run fn(0..n-1) on the workers and block until all calls returned.
+	// The calling thread takes indices too, so a pool busy with other
+	// tasks slows the loop down but never stalls it.
+	void parallelFor(int n, const std::function<void(int)>& fn);
+	int size() const { return (int)workers.size(); }
+
+private:
+	void run();
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool stop = false;
+};
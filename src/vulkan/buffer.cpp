@@ -1,43 +1,81 @@
 #include "vulkan/buffer.hpp"
-#include "vulkan/vkutil.hpp"
-#include "vulkan/instance.hpp"
+#include "vulkan/staging.hpp"
+#include <cstring>
+#include <algorithm>
 using namespace std;
 
-VulkanBuffer::VulkanBuffer(VkDevice device, const GpuInfo& gpu, size_t size, 
-	VkBufferUsageFlags usage) :
-	device(device), size(size)
+VulkanBuffer::VulkanBuffer(MemoryAllocator& allocator, size_t size, 
+	VkBufferUsageFlags usage, VkMemoryPropertyFlags props, initializer_list<uint32_t> queueFamilies) :
+	allocator(&allocator), device(allocator.device), size(size)
 {
+	vector<uint32_t> families;
+	for (uint32_t f : queueFamilies)
+		if (find(families.begin(), families.end(), f) == families.end())
+			families.push_back(f);
+	bool concurrent = families.size() > 1;
+
 	VkBufferCreateInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	info.pNext = nullptr;
 	info.usage = usage;
 	info.size = size;
-	info.queueFamilyIndexCount = 0;
-	info.pQueueFamilyIndices = nullptr;
-	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	info.queueFamilyIndexCount = concurrent ? (uint32_t)families.size() : 0;
+	info.pQueueFamilyIndices = concurrent ? families.data() : nullptr;
+	info.sharingMode = sharingMode = concurrent ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
 	info.flags = 0;
 	vkAssert(vkCreateBuffer(device, &info, nullptr, &buffer), "create buffer");
 
-	VkMemoryRequirements memReqs;
-	vkGetBufferMemoryRequirements(device, buffer, &memReqs);
-	physSize = memReqs.size;
+	mem = allocator.bindBuffer(buffer, props);
+	physSize = mem.size;
+}
+
+VulkanBuffer::~VulkanBuffer()
+{
+	release();
+}
+
+void VulkanBuffer::release()
+{
+	if (buffer == VK_NULL_HANDLE)
+		return;
+	vkDestroyBuffer(device, buffer, nullptr);
+	allocator->free(mem);
+	buffer = VK_NULL_HANDLE;
+}
 
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.pNext = nullptr;
-	allocInfo.memoryTypeIndex = 0;
-	allocInfo.allocationSize = memReqs.size;
-	allocInfo.memoryTypeIndex = memoryTypeFromProps(gpu.memoryProps,
-		memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	vkAssert(vkAllocateMemory(device, &allocInfo, nullptr, &mem), "alloc mem");
+VulkanBuffer::VulkanBuffer(VulkanBuffer&& o) :
+	allocator(o.allocator), device(o.device), buffer(o.buffer), mem(o.mem),
+	size(o.size), physSize(o.physSize), sharingMode(o.sharingMode)
+{
+	o.buffer = VK_NULL_HANDLE;
+}
 
-	vkAssert(vkBindBufferMemory(device, buffer, mem, 0), "bind mem");
+VulkanBuffer& VulkanBuffer::operator=(VulkanBuffer&& o)
+{
+	if (this != &o) {
+		release();
+		allocator = o.allocator;
+		device = o.device;
+		buffer = o.buffer;
+		mem = o.mem;
+		size = o.size;
+		physSize = o.physSize;
+		sharingMode = o.sharingMode;
+		o.buffer = VK_NULL_HANDLE;
+	}
+	return *this;
 }
 
 void VulkanBuffer::upload(void* data)
 {
-	uint8_t *pData;
-	vkAssert(vkMapMemory(device, mem, 0, physSize, 0, (void**)&pData), "map mem");
-	memcpy(pData, data, size);
-	vkUnmapMemory(device, mem);
+	if (!mem.mapped)
+		fatalError("upload to buffer that is not host visible");
+	memcpy(mem.mapped, data, size);
+}
+
+void VulkanBuffer::upload(StagingRing& staging, const void* data, size_t size, size_t offset)
+{
+	if (offset + size > this->size)
+		fatalError("upload out of buffer range");
+	staging.upload(*this, offset, data, size);
 }
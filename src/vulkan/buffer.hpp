@@ -1,32 +1,72 @@
 #pragma once
+#include <vector>
+#include <initializer_list>
 #include "vulkan/vkmain.hpp"
+#include "vulkan/memory.hpp"
 
-struct GpuInfo;
+class StagingRing;
 
+// Owns the buffer and its memory. Destruction is immediate, buffers the
+// GPU may still read go through VulkanInstance::retire.
 class VulkanBuffer
 {
 public:
-	VulkanBuffer(VkDevice device, const GpuInfo& gpu, size_t size, VkBufferUsageFlags usage);
+	// Buffers used by several queue families, e.g. graphics and async compute,
+	// list them in queueFamilies and are shared concurrently
+	VulkanBuffer(MemoryAllocator& allocator, size_t size, VkBufferUsageFlags usage,
+		VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		std::initializer_list<uint32_t> queueFamilies = {});
+	~VulkanBuffer();
+	VulkanBuffer(VulkanBuffer&& o);
+	VulkanBuffer& operator=(VulkanBuffer&& o);
+	VulkanBuffer(const VulkanBuffer&) = delete;
+	VulkanBuffer& operator=(const VulkanBuffer&) = delete;
 	void upload(void* ptr);
+	// Upload through the staging ring, for buffers that are not host visible
+	void upload(StagingRing& staging, const void* ptr, size_t size, size_t offset = 0);
 
+	MemoryAllocator* allocator;
 	VkDevice device;
 	VkBuffer buffer;
-	VkDeviceMemory mem;
+	Allocation mem;
 	size_t size, physSize;
+	VkSharingMode sharingMode;
+
+private:
+	void release();
 };
 
 template<class T>
 class UniformBuffer : public VulkanBuffer
 {
-	UniformBuffer(VkDevice device, const GpuInfo& gpu);
+public:
+	UniformBuffer(MemoryAllocator& allocator);
 	void upload(const T& data);
 };
 
+// Device-local vertex buffer, filled through a StagingRing
 template<class T>
 class VertexBuffer : public VulkanBuffer
 {
-	VertexBuffer(VkDevice device, const GpuInfo& gpu, int numElements);
-	//void upload(const T& data);
+public:
+	VertexBuffer(MemoryAllocator& allocator, int numElements);
+	void upload(StagingRing& staging, const T* data, size_t count, size_t first = 0);
+	void upload(StagingRing& staging, const std::vector<T>& data, size_t first = 0);
+
+	int numElements;
+};
+
+// Device-local index buffer of uint16_t or uint32_t indices
+template<class T>
+class IndexBuffer : public VulkanBuffer
+{
+public:
+	IndexBuffer(MemoryAllocator& allocator, int numElements);
+	void upload(StagingRing& staging, const T* data, size_t count, size_t first = 0);
+	void upload(StagingRing& staging, const std::vector<T>& data, size_t first = 0);
+
+	int numElements;
+	const VkIndexType indexType = sizeof(T) == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
 };
 
 
@@ -35,19 +75,54 @@ class VertexBuffer : public VulkanBuffer
 // ----------------------------------------------------
 
 template<class T>
-UniformBuffer<T>::UniformBuffer(VkDevice device, const GpuInfo& gpu) :
-	VulkanBuffer(device, gpu, sizeof(T), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
+UniformBuffer<T>::UniformBuffer(MemoryAllocator& allocator) :
+	VulkanBuffer(allocator, sizeof(T), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
 {
 }
 
 template<class T>
 void UniformBuffer<T>::upload(const T& data)
 {
-	upload((void*)&data);
+	VulkanBuffer::upload((void*)&data);
+}
+
+template<class T>
+VertexBuffer<T>::VertexBuffer(MemoryAllocator& allocator, int numElements) :
+	VulkanBuffer(allocator, numElements*sizeof(T), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+	numElements(numElements)
+{
+}
+
+template<class T>
+void VertexBuffer<T>::upload(StagingRing& staging, const T* data, size_t count, size_t first)
+{
+	VulkanBuffer::upload(staging, data, count*sizeof(T), first*sizeof(T));
+}
+
+template<class T>
+void VertexBuffer<T>::upload(StagingRing& staging, const std::vector<T>& data, size_t first)
+{
+	upload(staging, data.data(), data.size(), first);
+}
+
+template<class T>
+IndexBuffer<T>::IndexBuffer(MemoryAllocator& allocator, int numElements) :
+	VulkanBuffer(allocator, numElements*sizeof(T), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+	numElements(numElements)
+{
+	static_assert(sizeof(T) == 2 || sizeof(T) == 4, "indices must be 16 or 32 bit");
+}
+
+template<class T>
+void IndexBuffer<T>::upload(StagingRing& staging, const T* data, size_t count, size_t first)
+{
+	VulkanBuffer::upload(staging, data, count*sizeof(T), first*sizeof(T));
 }
 
 template<class T>
-VertexBuffer<T>::VertexBuffer(VkDevice device, const GpuInfo& gpu, int numElements) :
-	VulkanBuffer(device, gpu, numElements*sizeof(T), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)
+void IndexBuffer<T>::upload(StagingRing& staging, const std::vector<T>& data, size_t first)
 {
+	upload(staging, data.data(), data.size(), first);
 }
@@ -0,0 +1,135 @@
+#include "vulkan/compute.hpp"
+#include "vulkan/instance.hpp"
+#include "vulkan/shader.hpp"
+using namespace std;
+
+ComputePipeline::ComputePipeline(VkDevice device, const Shader& shader, VkPipelineLayout layout, VkPipelineCache cache) :
+	device(device)
+{
+	if (shader.reflection.stage != VK_SHADER_STAGE_COMPUTE_BIT)
+		fatalError("Shader " + shader.name + " is not a compute shader");
+	for (int i = 0; i < 3; i++)
+		localSize[i] = shader.reflection.localSize[i];
+
+	VkComputePipelineCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	info.pNext = nullptr;
+	info.flags = 0;
+	info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	info.stage.pNext = nullptr;
+	info.stage.flags = 0;
+	info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	info.stage.module = shader.module;
+	info.stage.pName = "main";
+	info.stage.pSpecializationInfo = nullptr;
+	info.layout = layout;
+	info.basePipelineHandle = VK_NULL_HANDLE;
+	info.basePipelineIndex = -1;
+	vkAssert(vkCreateComputePipelines(device, cache, 1, &info, nullptr, &pipeline), "create compute pipeline");
+}
+
+ComputePipeline::~ComputePipeline()
+{
+	vkDestroyPipeline(device, pipeline, nullptr);
+}
+
+void ComputePipeline::bind(VkCommandBuffer cmd)
+{
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+}
+
+void ComputePipeline::dispatch(VkCommandBuffer cmd, uint32_t groupsX, uint32_t groupsY, uint32_t groupsZ)
+{
+	vkCmdDispatch(cmd, groupsX, groupsY, groupsZ);
+}
+
+void ComputePipeline::dispatchThreads(VkCommandBuffer cmd, uint32_t x, uint32_t y, uint32_t z)
+{
+	vkCmdDispatch(cmd, (x + localSize[0] - 1) / localSize[0], (y + localSize[1] - 1) / localSize[1],
+		(z + localSize[2] - 1) / localSize[2]);
+}
+
+void computeBarrier(VkCommandBuffer cmd, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+{
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = dstAccess;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+ComputeQueue::ComputeQueue(VulkanInstance& inst) :
+	inst(inst), queue(inst.computeQueue), familyIndex(inst.computeFamilyIndex)
+{
+	frames.resize(inst.numFrames);
+	for (auto& frame : frames) {
+		VkCommandPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.pNext = nullptr;
+		poolInfo.queueFamilyIndex = familyIndex;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		vkAssert(vkCreateCommandPool(inst.device, &poolInfo, nullptr, &frame.pool), "create compute pool");
+
+		VkCommandBufferAllocateInfo cmdInfo = {};
+		cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		cmdInfo.pNext = nullptr;
+		cmdInfo.commandPool = frame.pool;
+		cmdInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		cmdInfo.commandBufferCount = 1;
+		vkAssert(vkAllocateCommandBuffers(inst.device, &cmdInfo, &frame.cmd), "alloc compute command buffer");
+
+		VkSemaphoreCreateInfo semInfo = {};
+		semInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semInfo.pNext = nullptr;
+		semInfo.flags = 0;
+		vkAssert(vkCreateSemaphore(inst.device, &semInfo, nullptr, &frame.done), "create semaphore");
+	}
+}
+
+ComputeQueue::~ComputeQueue()
+{
+	for (auto& frame : frames) {
+		vkDestroySemaphore(inst.device, frame.done, nullptr);
+		vkDestroyCommandPool(inst.device, frame.pool, nullptr);
+	}
+}
+
+VkCommandBuffer ComputeQueue::begin()
+{
+	// the graphics work of this slot's previous frame waited for its compute
+	// work, and beginFrame waited for that
+	Frame& frame = frames[inst.curFrame];
+	vkAssert(vkResetCommandPool(inst.device, frame.pool, 0), "reset compute pool");
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.pNext = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = nullptr;
+	vkAssert(vkBeginCommandBuffer(frame.cmd, &beginInfo), "begin compute command buffer");
+	return frame.cmd;
+}
+
+void ComputeQueue::submit(VkPipelineStageFlags waitStage)
+{
+	Frame& frame = frames[inst.curFrame];
+	vkAssert(vkEndCommandBuffer(frame.cmd), "end compute command buffer");
+
+	VkSubmitInfo submit = {};
+	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit.pNext = nullptr;
+	submit.waitSemaphoreCount = 0;
+	submit.pWaitSemaphores = nullptr;
+	submit.pWaitDstStageMask = nullptr;
+	submit.commandBufferCount = 1;
+	submit.pCommandBuffers = &frame.cmd;
+	submit.signalSemaphoreCount = 1;
+	submit.pSignalSemaphores = &frame.done;
+	{
+		lock_guard<mutex> lock(inst.queueMutex);
+		vkAssert(vkQueueSubmit(queue, 1, &submit, VK_NULL_HANDLE), "submit compute");
+	}
+
+	inst.addFrameWait(frame.done, waitStage);
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <vector>
+#include "vulkan/vkmain.hpp"
+
+class VulkanInstance;
+class Shader;
+
+class ComputePipeline
+{
+public:
+	ComputePipeline(VkDevice device, const Shader& shader, VkPipelineLayout layout, VkPipelineCache cache = VK_NULL_HANDLE);
+	~ComputePipeline();
+
+	void bind(VkCommandBuffer cmd);
+	void dispatch(VkCommandBuffer cmd, uint32_t groupsX, uint32_t groupsY = 1, uint32_t groupsZ = 1);
+	// Enough workgroups to cover the given number of invocations, using the
+	// shader's local size
+	void dispatchThreads(VkCommandBuffer cmd, uint32_t x, uint32_t y = 1, uint32_t z = 1);
+
+	VkDevice device;
+	VkPipeline pipeline;
+	uint32_t localSize[3];
+};
+
+// Makes shader writes of earlier dispatches, also from previous submissions
+// to the same queue, visible to the given stage
+void computeBarrier(VkCommandBuffer cmd, VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	VkAccessFlags dstAccess = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+// Per-frame compute work on the compute queue, which is a separate family
+// when the device has one (VulkanInstance::asyncCompute). The frame's
+// graphics submission waits on a semaphore signaled by the compute
+// submission, so only graphics work consuming the results is serialized;
+// everything recorded before it in the frame can overlap.
+// Resources shared between the queue families must be created concurrent,
+// see VulkanBuffer. Double buffer them per frame slot: when the frame slot
+// comes around again, beginFrame has already waited for its graphics work.
+class ComputeQueue
+{
+public:
+	ComputeQueue(VulkanInstance& inst);
+	~ComputeQueue();
+
+	// This frame's compute command buffer, call after VulkanInstance::beginFrame
+	VkCommandBuffer begin();
+	// Submit it; the frame's graphics work waits for it at waitStage
+	void submit(VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+
+	VulkanInstance& inst;
+	VkQueue queue;
+	uint32_t familyIndex;
+
+private:
+	struct Frame {
+		VkCommandPool pool;
+		VkCommandBuffer cmd;
+		VkSemaphore done;
+	};
+	std::vector<Frame> frames;
+};
@@ -0,0 +1,36 @@
+#include "vulkan/deletion.hpp"
+#include <vector>
+using namespace std;
+
+void DeletionQueue::push(uint64_t retireFrame, function<void()> fn)
+{
+	lock_guard<std::mutex> lock(mutex);
+	entries.push_back({ retireFrame, move(fn) });
+}
+
+void DeletionQueue::collect(uint64_t completedFrame)
+{
+	// run outside the lock, destructors may defer more work
+	vector<function<void()>> ready;
+	{
+		lock_guard<std::mutex> lock(mutex);
+		while (!entries.empty() && entries.front().frame <= completedFrame) {
+			ready.push_back(move(entries.front().fn));
+			entries.pop_front();
+		}
+	}
+	for (auto& fn : ready)
+		fn();
+}
+
+void DeletionQueue::flush()
+{
+	while (size() > 0)
+		collect(UINT64_MAX);
+}
+
+size_t DeletionQueue::size()
+{
+	lock_guard<std::mutex> lock(mutex);
+	return entries.size();
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+// Destruction of GPU objects deferred until the frames that may still use
+// them have retired, so assets can be freed mid-session (hot reload,
+// streaming) without vkDeviceWaitIdle. Entries retire in push order, as
+// frame numbers only grow. Thread safe, e.g. for loader threads.
+// VulkanInstance owns one and collects it in beginFrame, see
+// VulkanInstance::defer and VulkanInstance::retire.
+class DeletionQueue
+{
+public:
+	~DeletionQueue() { flush(); }
+
+	// Run fn once frame retireFrame has completed on the GPU
+	void push(uint64_t retireFrame, std::function<void()> fn);
+	// Run everything that retired by completedFrame
+	void collect(uint64_t completedFrame);
+	// Run everything, the device must be idle
+	void flush();
+	size_t size();
+
+private:
+	struct Entry {
+		uint64_t frame;
+		std::function<void()> fn;
+	};
+	std::deque<Entry> entries;
+	std::mutex mutex;
+};
@@ -0,0 +1,123 @@
+#include "vulkan/descriptor.hpp"
+#include "vulkan/shader.hpp"
+#include <algorithm>
+using namespace std;
+
+// descriptor types of Vulkan 1.0 are 0..INPUT_ATTACHMENT
+static const uint32_t numDescriptorTypes = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT + 1;
+
+DescriptorAllocator::DescriptorAllocator(VkDevice device, uint32_t initialSets) :
+	device(device), setsPerPool(initialSets), typeCounts(numDescriptorTypes, 0)
+{
+}
+
+DescriptorAllocator::~DescriptorAllocator()
+{
+	reset();
+	for (auto pool : freePools)
+		vkDestroyDescriptorPool(device, pool, nullptr);
+}
+
+VkDescriptorPool DescriptorAllocator::createPool()
+{
+	// size each type by its average count per set observed so far, with a
+	// little of everything so the first pool isn't useless for new layouts
+	vector<VkDescriptorPoolSize> sizes;
+	for (uint32_t i = 0; i < numDescriptorTypes; i++) {
+		uint64_t perSet = numSets ? (typeCounts[i] + numSets - 1) / numSets : 0;
+		VkDescriptorPoolSize size;
+		size.type = (VkDescriptorType)i;
+		size.descriptorCount = (uint32_t)max<uint64_t>(perSet * setsPerPool, setsPerPool / 4 + 1);
+		sizes.push_back(size);
+	}
+
+	VkDescriptorPoolCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	info.pNext = nullptr;
+	info.flags = 0;
+	info.maxSets = setsPerPool;
+	info.poolSizeCount = (uint32_t)sizes.size();
+	info.pPoolSizes = sizes.data();
+
+	VkDescriptorPool pool;
+	vkAssert(vkCreateDescriptorPool(device, &info, nullptr, &pool), "create desc pool");
+	setsPerPool = min(setsPerPool * 2, maxSetsPerPool);
+	return pool;
+}
+
+VkDescriptorPool DescriptorAllocator::nextPool()
+{
+	if (current)
+		usedPools.push_back(current);
+	if (!freePools.empty()) {
+		current = freePools.back();
+		freePools.pop_back();
+	} else {
+		current = createPool();
+	}
+	return current;
+}
+
+VkDescriptorSet DescriptorAllocator::allocate(const DescriptorSetLayout& layout)
+{
+	numSets++;
+	for (auto& b : layout.bindings)
+		typeCounts[b.descriptorType] += b.descriptorCount;
+
+	if (!current)
+		nextPool();
+
+	VkDescriptorSetAllocateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	info.pNext = nullptr;
+	info.descriptorPool = current;
+	info.descriptorSetCount = 1;
+	info.pSetLayouts = &layout.layout;
+
+	VkDescriptorSet set;
+	VkResult res = vkAllocateDescriptorSets(device, &info, &set);
+	if (res == VK_SUCCESS)
+		return set;
+
+	// pool exhausted; drivers without maintenance1 may report this as out of memory.
+	// Recycled pools were sized for earlier usage, so skip those that still don't fit.
+	while (res == VK_ERROR_OUT_OF_POOL_MEMORY_KHR || res == VK_ERROR_FRAGMENTED_POOL ||
+		res == VK_ERROR_OUT_OF_DEVICE_MEMORY || res == VK_ERROR_OUT_OF_HOST_MEMORY) {
+		bool fresh = freePools.empty();
+		info.descriptorPool = nextPool();
+		res = vkAllocateDescriptorSets(device, &info, &set);
+		if (fresh)
+			break;
+	}
+	vkAssert(res, "alloc desc set");
+	return set;
+}
+
+void DescriptorAllocator::reset()
+{
+	if (current)
+		usedPools.push_back(current);
+	current = VK_NULL_HANDLE;
+	for (auto pool : usedPools) {
+		vkResetDescriptorPool(device, pool, 0);
+		freePools.push_back(pool);
+	}
+	usedPools.clear();
+}
+
+FrameDescriptors::FrameDescriptors(VkDevice device, int numFrames)
+{
+	for (int i = 0; i < numFrames; i++)
+		frames.push_back(make_unique<DescriptorAllocator>(device, 64));
+}
+
+void FrameDescriptors::beginFrame(int frame)
+{
+	curFrame = frame;
+	frames[frame]->reset();
+}
+
+VkDescriptorSet FrameDescriptors::allocate(const DescriptorSetLayout& layout)
+{
+	return frames[curFrame]->allocate(layout);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include "vulkan/vkmain.hpp"
+
+class DescriptorSetLayout;
+
+// Allocates descriptor sets from a list of pools. When the current pool runs
+// out a new, larger one is created, sized by the descriptor types seen so
+// far, so allocation is O(1) amortized. reset() recycles all pools at once;
+// sets are never freed individually. Not thread safe, use one per thread.
+class DescriptorAllocator
+{
+public:
+	DescriptorAllocator(VkDevice device, uint32_t initialSets = 16);
+	~DescriptorAllocator();
+
+	VkDescriptorSet allocate(const DescriptorSetLayout& layout);
+	// Invalidates every set allocated so far
+	void reset();
+
+	VkDevice device;
+	uint32_t setsPerPool;
+	const uint32_t maxSetsPerPool = 4096;
+
+private:
+	VkDescriptorPool createPool();
+	VkDescriptorPool nextPool();
+
+	VkDescriptorPool current = VK_NULL_HANDLE;
+	std::vector<VkDescriptorPool> usedPools, freePools;
+	// observed usage, indexed by VkDescriptorType
+	std::vector<uint64_t> typeCounts;
+	uint64_t numSets = 0;
+};
+
+// Transient sets for per-draw data, one allocator per frame in flight. All
+// sets of a frame are released together when the frame slot comes around again.
+class FrameDescriptors
+{
+public:
+	FrameDescriptors(VkDevice device, int numFrames);
+
+	// The frame's previous sets must no longer be in use by the GPU
+	void beginFrame(int frame);
+	VkDescriptorSet allocate(const DescriptorSetLayout& layout);
+
+	std::vector<std::unique_ptr<DescriptorAllocator>> frames;
+	int curFrame = 0;
+};
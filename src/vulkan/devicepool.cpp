@@ -0,0 +1,77 @@
+#include "vulkan/devicepool.hpp"
+using namespace std;
+
+DevicePool::DevicePool(const string& appName, int width, int height, int devicesPerGpu, const VulkanConfig& config)
+{
+	// the first instance enumerates the devices for the others
+	VulkanConfig deviceConfig = config;
+	deviceConfig.deviceIndex = -1;
+	unique_ptr<VulkanInstance> first(new VulkanInstance(appName, width, height, deviceConfig));
+	int firstIndex = (int)(first->gpu - first->gpus.data());
+
+	for (int i = 0; i < (int)first->gpus.size(); i++) {
+		if (first->scoreDevice(first->gpus[i]) < 0)
+			continue;
+		for (int k = 0; k < devicesPerGpu; k++) {
+			if (i == firstIndex && k == 0) {
+				devices.push_back(move(first));
+				continue;
+			}
+			deviceConfig.deviceIndex = i;
+			devices.emplace_back(new VulkanInstance(appName, width, height, deviceConfig));
+		}
+	}
+
+	jobsRun.resize(devices.size(), 0);
+	for (int i = 0; i < (int)devices.size(); i++)
+		workers.emplace_back([this, i] { run(i); });
+}
+
+DevicePool::~DevicePool()
+{
+	{
+		lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	cv.notify_all();
+	for (auto& t : workers)
+		t.join();
+}
+
+void DevicePool::submit(Job job)
+{
+	{
+		lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(move(job));
+	}
+	cv.notify_one();
+}
+
+void DevicePool::wait()
+{
+	unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this] { return jobs.empty() && busy == 0; });
+}
+
+void DevicePool::run(int device)
+{
+	while (true) {
+		Job job;
+		{
+			unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [this] { return stop || !jobs.empty(); });
+			if (stop && jobs.empty())
+				return;
+			job = move(jobs.front());
+			jobs.pop_front();
+			busy++;
+		}
+		job(*devices[device], device);
+		{
+			lock_guard<std::mutex> lock(mutex);
+			jobsRun[device]++;
+			if (--busy == 0 && jobs.empty())
+				idle.notify_all();
+		}
+	}
+}
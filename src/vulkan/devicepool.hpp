@@ -0,0 +1,55 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <string>
+#include "vulkan/instance.hpp"
+
+// Runs independent offscreen jobs on every usable device in parallel, for
+// batch rendering. Each device is a headless VulkanInstance with its own
+// VkInstance and VkDevice, driven by one worker thread, so jobs on
+// different devices share nothing and need no locking. devicesPerGpu > 1
+// creates several logical devices on each physical device, which helps
+// fill devices whose single queue can't keep them busy, e.g. CPU
+// implementations that run each device's work on a few host threads.
+//
+//   DevicePool pool("batch", 1920, 1080);
+//   for (auto& tile : tiles)
+//       pool.submit([&](VulkanInstance& inst, int device) { render(inst, tile); });
+//   pool.wait();
+class DevicePool
+{
+public:
+	typedef std::function<void(VulkanInstance& inst, int device)> Job;
+
+	// config.deviceIndex is ignored, every device with a non-negative score is used
+	DevicePool(const std::string& appName, int width, int height, int devicesPerGpu = 1,
+		const VulkanConfig& config = VulkanConfig());
+	~DevicePool();
+
+	// Jobs go to whichever device is idle first. GPU work may still be in
+	// flight when a job returns; the device's next beginFrame or waitIdle
+	// waits for it.
+	void submit(Job job);
+	// Block until all submitted jobs have finished
+	void wait();
+	int size() const { return (int)devices.size(); }
+
+	std::vector<std::unique_ptr<VulkanInstance>> devices;
+	// Jobs each device has run
+	std::vector<uint64_t> jobsRun;
+
+private:
+	void run(int device);
+
+	std::vector<std::thread> workers;
+	std::deque<Job> jobs;
+	std::mutex mutex;
+	std::condition_variable cv, idle;
+	int busy = 0;
+	bool stop = false;
+};
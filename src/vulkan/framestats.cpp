@@ -0,0 +1,102 @@
+#include "vulkan/framestats.hpp"
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+using namespace std;
+
+Histogram::Histogram(double minMs, double maxMs, int numBuckets) :
+	minMs(minMs), maxMs(maxMs), buckets(numBuckets, 0)
+{
+	logMin = log(minMs);
+	logStep = (log(maxMs) - logMin) / (numBuckets - 1);
+}
+
+void Histogram::add(double ms)
+{
+	int bucket = 0;
+	if (ms > minMs)
+		bucket = min((int)((log(ms) - logMin) / logStep), (int)buckets.size() - 1);
+	buckets[bucket]++;
+	count++;
+	sum += ms;
+	max = std::max(max, ms);
+}
+
+void Histogram::reset()
+{
+	fill(buckets.begin(), buckets.end(), 0);
+	count = 0;
+	sum = max = 0;
+}
+
+double Histogram::bucketMs(int bucket) const
+{
+	return bucket == 0 ? 0.0 : exp(logMin + bucket * logStep);
+}
+
+double Histogram::percentile(double p) const
+{
+	if (count == 0)
+		return 0.0;
+	double target = p / 100.0 * count;
+	uint64_t seen = 0;
+	for (int i = 0; i < (int)buckets.size(); i++) {
+		if (buckets[i] == 0 || seen + buckets[i] < target) {
+			seen += buckets[i];
+			continue;
+		}
+		double lo = bucketMs(i), hi = i + 1 < (int)buckets.size() ? bucketMs(i + 1) : max;
+		double t = (target - seen) / buckets[i];
+		return min(lo + (hi - lo) * t, max);
+	}
+	return max;
+}
+
+void FrameStats::reset()
+{
+	cpuFrame.reset();
+	gpuFrame.reset();
+	acquireToPresent.reset();
+}
+
+static const char* names[] = { "cpuFrame", "gpuFrame", "acquireToPresent" };
+
+string FrameStats::summary() const
+{
+	ostringstream out;
+	const Histogram* hists[] = { &cpuFrame, &gpuFrame, &acquireToPresent };
+	for (int i = 0; i < 3; i++) {
+		const Histogram& h = *hists[i];
+		out << names[i] << ": " << h.count << " frames, mean " << h.mean() << " ms, p50 " << h.percentile(50)
+			<< " p90 " << h.percentile(90) << " p99 " << h.percentile(99) << " max " << h.max << " ms\n";
+	}
+	return out.str();
+}
+
+bool FrameStats::writeJson(const string& path) const
+{
+	ofstream ofs(path, ios::trunc);
+	if (!ofs.is_open())
+		return false;
+
+	const Histogram* hists[] = { &cpuFrame, &gpuFrame, &acquireToPresent };
+	ofs << "{";
+	for (int i = 0; i < 3; i++) {
+		const Histogram& h = *hists[i];
+		ofs << (i ? ",\n" : "\n") << "\"" << names[i] << "\":{\"count\":" << h.count << ",\"meanMs\":" << h.mean()
+			<< ",\"p50\":" << h.percentile(50) << ",\"p90\":" << h.percentile(90) << ",\"p99\":" << h.percentile(99)
+			<< ",\"maxMs\":" << h.max << ",\"buckets\":[";
+		// [lower bound in ms, count] of the non-empty buckets
+		bool first = true;
+		for (int b = 0; b < (int)h.buckets.size(); b++) {
+			if (!h.buckets[b])
+				continue;
+			ofs << (first ? "" : ",") << "[" << h.bucketMs(b) << "," << h.buckets[b] << "]";
+			first = false;
+		}
+		ofs << "]}";
+	}
+	ofs << "\n}\n";
+	return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Histogram of durations in milliseconds. Buckets are log spaced, so
+// sub-millisecond jitter and multi-frame stalls keep the same relative
+// resolution (about 6% per bucket with the defaults).
+class Histogram
+{
+public:
+	Histogram(double minMs = 0.01, double maxMs = 2000.0, int numBuckets = 200);
+
+	void add(double ms);
+	void reset();
+	// p in [0, 100], interpolated inside the bucket
+	double percentile(double p) const;
+	double mean() const { return count ? sum / count : 0.0; }
+	// Lower bound of a bucket, the last one also counts everything above maxMs
+	double bucketMs(int bucket) const;
+
+	double minMs, maxMs;
+	std::vector<uint64_t> buckets;
+	uint64_t count = 0;
+	double sum = 0, max = 0;
+
+private:
+	double logMin, logStep;
+};
+
+// Frame pacing measurements, filled in by VulkanInstance and GpuProfiler:
+//  - cpuFrame: time between consecutive beginFrame calls, including the
+//    frame limiter and waits for the GPU or the presentation engine
+//  - gpuFrame: first to last GPU scope of a frame, needs a GpuProfiler
+//  - acquireToPresent: from the swapchain image being acquired to it being
+//    queued for presentation, the part of the latency the CPU controls
+struct FrameStats
+{
+	Histogram cpuFrame, gpuFrame, acquireToPresent;
+
+	void reset();
+	// p50/p90/p99/max of each histogram, one line each
+	std::string summary() const;
+	// Percentiles and the non-empty buckets of each histogram
+	bool writeJson(const std::string& path) const;
+};
@@ -2,63 +2,77 @@
 #include "platform/window.hpp"
 #include "vulkan/vkutil.hpp"
 #include <algorithm>
+#include <cstring>
+#include <thread>
 using namespace std;
 
-void queueImageLayout(VkCommandBuffer cmd, VkImage image, VkImageAspectFlags aspectMask,
-	VkImageLayout oldLayout, VkImageLayout newLayout)
+bool GpuInfo::hasExtension(const char* name) const
 {
-	VkImageMemoryBarrier barrier = {};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.pNext = nullptr;
-	barrier.srcAccessMask = 0;
-	barrier.dstAccessMask = 0;
-	barrier.oldLayout = oldLayout;
-	barrier.newLayout = newLayout;
-	barrier.image = image;
-	barrier.subresourceRange.aspectMask = aspectMask;
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
-	barrier.subresourceRange.layerCount = 1;
-
-	if (oldLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
-		barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	for (auto& ext : extensions)
+		if (strcmp(ext.extensionName, name) == 0)
+			return true;
+	return false;
+}
 
-	if (newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+VulkanInstance::VulkanInstance(const string& appName, Window* wnd, const VulkanConfig& config) :
+	appName(appName), wnd(wnd), headless(false), width(wnd->width), height(wnd->height),
+	config(config), numFrames(config.framesInFlight)
+{
+	init();
+}
 
-	if (newLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL)
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+VulkanInstance::VulkanInstance(const string& appName, int width, int height, const VulkanConfig& config) :
+	appName(appName), wnd(nullptr), headless(true), width(width), height(height),
+	config(config), numFrames(config.framesInFlight)
+{
+	init();
+}
 
-	if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+VulkanInstance::~VulkanInstance()
+{
+	waitIdle();
+	deletionQueue.flush();
 
-	if (newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-		barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	for (auto& frame : frames) {
+		vkDestroyCommandPool(device, frame.cmdPool, nullptr);
+		vkDestroyFence(device, frame.fence, nullptr);
+		vkDestroySemaphore(device, frame.acquireSem, nullptr);
+		vkDestroySemaphore(device, frame.presentSem, nullptr);
 	}
-
-	if (newLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
-		barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-	if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
-		barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-	VkPipelineStageFlags srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-	VkPipelineStageFlags destStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-
-	vkCmdPipelineBarrier(cmd, srcStages, destStages, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	vkDestroySemaphore(device, timeline, nullptr);
+	destroyTargets();
+	if (headless) {
+		for (auto& target : swapImages)
+			vkDestroyImage(device, target.image, nullptr);
+		for (auto& mem : colorMem)
+			allocator->free(mem);
+	}
+	swapImages.clear();
+	if (swapChain)
+		vkDestroySwapchainKHR(device, swapChain, nullptr);
+	vkDestroyRenderPass(device, renderPass, nullptr);
+	vkDestroyCommandPool(device, cmdPool, nullptr);
+	allocator.reset();
+	vkDestroyDevice(device, nullptr);
+	if (surface)
+		vkDestroySurfaceKHR(instance, surface, nullptr);
+	vkDestroyInstance(instance, nullptr);
 }
 
-VulkanInstance::VulkanInstance(const string& appName, Window* wnd) :
-	appName(appName), wnd(wnd)
+void VulkanInstance::init()
 {
 	enumerateDevices();
-	createDevice(&gpus[0]);
+	createDevice(selectDevice());
 	createCommandBuffer();
-	createSwapChain();
+	if (headless)
+		createOffscreenTarget();
+	else
+		createSwapChain();
 	createDepthBuffer();
 	initRenderPass();
 	initFramebuffer();
+	createFrames();
+	submitSetup();
 }
 
 void VulkanInstance::enumerateDevices() 
@@ -85,11 +99,25 @@ void VulkanInstance::enumerateDevices()
 	appInfo.engineVersion = 1;
 	appInfo.apiVersion = VK_MAKE_VERSION(1, 0, 0);
 
+	uint32_t extCount;
+	vkAssert(vkEnumerateInstanceExtensionProperties(nullptr, &extCount, nullptr), "enum instance extensions");
+	instanceExtensions.resize(extCount);
+	vkAssert(vkEnumerateInstanceExtensionProperties(nullptr, &extCount, instanceExtensions.data()), "enum instance extensions");
+
+	// headless rendering needs no WSI extensions at all
+	vector<const char*> instanceExtNames;
+	if (!headless) {
 #ifdef _WIN32
-	vector<const char*> instanceExtNames{ VK_KHR_SURFACE_EXTENSION_NAME, VK_KHR_WIN32_SURFACE_EXTENSION_NAME };
+		instanceExtNames = { VK_KHR_SURFACE_EXTENSION_NAME, VK_KHR_WIN32_SURFACE_EXTENSION_NAME };
 #else
-	fatalError("missing: some Linux thingies");
+		// only Win32 surfaces so far, main.cpp switches other platforms to headless
+		fatalError("Windowed mode needs a Win32 surface, use headless rendering on this platform");
 #endif
+	}
+	// needed to enable device features such as timeline semaphores
+	for (auto& ext : instanceExtensions)
+		if (strcmp(ext.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0)
+			instanceExtNames.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
 
 	vector<const char*> instanceLayers{};
 
@@ -101,7 +129,7 @@ void VulkanInstance::enumerateDevices()
 	instInfo.enabledLayerCount = (uint32_t)instanceLayers.size();
 	instInfo.ppEnabledLayerNames = instanceLayers.empty() ? nullptr : instanceLayers.data();
 	instInfo.enabledExtensionCount = (uint32_t)instanceExtNames.size();
-	instInfo.ppEnabledExtensionNames = instanceExtNames.data();
+	instInfo.ppEnabledExtensionNames = instanceExtNames.empty() ? nullptr : instanceExtNames.data();
 	vkAssert(vkCreateInstance(&instInfo, nullptr, &instance), "create instance");
 
 	// enumerate devices
@@ -126,14 +154,208 @@ void VulkanInstance::enumerateDevices()
 
 		vkGetPhysicalDeviceMemoryProperties(phys, &gpu.memoryProps);
 		vkGetPhysicalDeviceProperties(phys, &gpu.gpuProps);
+		vkGetPhysicalDeviceFeatures(phys, &gpu.features);
+
+		uint32_t devExtCount;
+		vkAssert(vkEnumerateDeviceExtensionProperties(phys, nullptr, &devExtCount, nullptr), "enum device extensions");
+		gpu.extensions.resize(devExtCount);
+		vkAssert(vkEnumerateDeviceExtensionProperties(phys, nullptr, &devExtCount, gpu.extensions.data()), "enum device extensions");
 		gpus.push_back(gpu);
 	}
 }
 
+int VulkanInstance::scoreDevice(const GpuInfo& gpu) const
+{
+	bool graphics = false;
+	for (auto& family : gpu.queueProps)
+		graphics |= (family.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+	if (!graphics || (!headless && !gpu.hasExtension(VK_KHR_SWAPCHAIN_EXTENSION_NAME)))
+		return -1;
+	// VkPhysicalDeviceFeatures is a struct of VkBool32
+	const VkBool32* required = (const VkBool32*)&config.requiredFeatures;
+	const VkBool32* supported = (const VkBool32*)&gpu.features;
+	for (size_t i = 0; i < sizeof(VkPhysicalDeviceFeatures) / sizeof(VkBool32); i++)
+		if (required[i] && !supported[i])
+			return -1;
+
+	int score = 0;
+	switch (gpu.gpuProps.deviceType) {
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: score = 4000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score = 3000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: score = 2000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_CPU: score = 1000; break;
+	default: break;
+	}
+	// features used when present
+	for (VkBool32 feature : { gpu.features.multiDrawIndirect, gpu.features.drawIndirectFirstInstance,
+		gpu.features.pipelineStatisticsQuery })
+		score += feature ? 100 : 0;
+	if (gpu.hasExtension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME))
+		score += 100;
+	// largest device-local heap in GiB, capped to stay below the next device type
+	VkDeviceSize heap = 0;
+	for (uint32_t i = 0; i < gpu.memoryProps.memoryHeapCount; i++)
+		if (gpu.memoryProps.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+			heap = max(heap, gpu.memoryProps.memoryHeaps[i].size);
+	score += (int)min<VkDeviceSize>(heap >> 30, 99);
+	return score;
+}
+
+GpuInfo* VulkanInstance::selectDevice()
+{
+	if (config.deviceIndex >= 0) {
+		if (config.deviceIndex >= (int)gpus.size() || scoreDevice(gpus[config.deviceIndex]) < 0)
+			fatalError("Configured device " + to_string(config.deviceIndex) + " is missing or unusable");
+		return &gpus[config.deviceIndex];
+	}
+	GpuInfo* best = nullptr;
+	int bestScore = -1;
+	for (auto& gpu : gpus) {
+		int score = scoreDevice(gpu);
+		if (score > bestScore) {
+			best = &gpu;
+			bestScore = score;
+		}
+	}
+	if (!best)
+		fatalError("No usable GPU found");
+	return best;
+}
+
 void VulkanInstance::createDevice(GpuInfo* gpu)
 {
 	this->gpu = gpu;
-	
+
+	if (headless) {
+		// Any graphics queue will do, nothing is presented
+		for (uint32_t i = 0; i < gpu->queueProps.size(); i++) {
+			if (gpu->queueProps[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+				queueFamilyIndex = i;
+				break;
+			}
+		}
+		if (queueFamilyIndex < 0)
+			fatalError("Can't find a queue for graphics");
+
+		// Offscreen target format: RGBA8, with BGRA8 as fallback
+		format = VK_FORMAT_R8G8B8A8_UNORM;
+		VkFormatProperties props;
+		vkGetPhysicalDeviceFormatProperties(gpu->physDevice, format, &props);
+		if (!(props.optimalTilingFeatures & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT))
+			format = VK_FORMAT_B8G8R8A8_UNORM;
+	} else {
+		createSurface();
+	}
+
+	// Prefer a compute family without graphics, so compute work can overlap
+	// with rendering, and a transfer-only family for background copies.
+	// Otherwise they share the graphics queue.
+	computeFamilyIndex = queueFamilyIndex;
+	transferFamilyIndex = queueFamilyIndex;
+	for (uint32_t i = 0; i < gpu->queueProps.size(); i++) {
+		VkQueueFlags flags = gpu->queueProps[i].queueFlags;
+		if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) && computeFamilyIndex == queueFamilyIndex)
+			computeFamilyIndex = i;
+		if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) && transferFamilyIndex == queueFamilyIndex)
+			transferFamilyIndex = i;
+	}
+
+	vector<VkDeviceQueueCreateInfo> queueInfos;
+	float queue_priorities[1] = { 0.0 };
+	for (int family : { queueFamilyIndex, computeFamilyIndex, transferFamilyIndex }) {
+		bool exists = false;
+		for (auto& info : queueInfos)
+			exists |= info.queueFamilyIndex == (uint32_t)family;
+		if (exists)
+			continue;
+		VkDeviceQueueCreateInfo queueInfo = {};
+		queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+		queueInfo.pNext = nullptr;
+		queueInfo.queueCount = 1;
+		queueInfo.pQueuePriorities = queue_priorities;
+		queueInfo.queueFamilyIndex = family;
+		queueInfos.push_back(queueInfo);
+	}
+
+	vector<const char*> deviceExtensions;
+	if (!headless)
+		deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+	vector<const char*> deviceLayers;
+
+	// Timeline semaphores track retired frames with a single counter.
+	// Every implementation of the extension supports the feature.
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+	timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+	timelineFeatures.pNext = nullptr;
+	timelineFeatures.timelineSemaphore = VK_TRUE;
+	bool hasProps2 = false;
+	for (auto& ext : instanceExtensions)
+		if (strcmp(ext.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0)
+			hasProps2 = true;
+	timelineSemaphores = hasProps2 && gpu->hasExtension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+	if (timelineSemaphores)
+		deviceExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+
+	// lets GPU-driven rendering decide the number of indirect draws on the GPU
+	drawIndirectCount = gpu->hasExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	if (drawIndirectCount)
+		deviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+
+	// dedicated allocations tell the driver their resource, e.g. for render targets
+	bool dedicatedAllocation = gpu->hasExtension(VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME) &&
+		gpu->hasExtension(VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME);
+	if (dedicatedAllocation) {
+		deviceExtensions.push_back(VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME);
+		deviceExtensions.push_back(VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME);
+	}
+
+	// optional features, users check enabledFeatures
+	enabledFeatures = {};
+	enabledFeatures.pipelineStatisticsQuery = gpu->features.pipelineStatisticsQuery;
+	enabledFeatures.multiDrawIndirect = gpu->features.multiDrawIndirect;
+	enabledFeatures.drawIndirectFirstInstance = gpu->features.drawIndirectFirstInstance;
+	VkBool32* enabled = (VkBool32*)&enabledFeatures;
+	const VkBool32* required = (const VkBool32*)&config.requiredFeatures;
+	for (size_t i = 0; i < sizeof(VkPhysicalDeviceFeatures) / sizeof(VkBool32); i++)
+		enabled[i] |= required[i];
+
+	VkDeviceCreateInfo deviceInfo = {};
+	deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	deviceInfo.pNext = timelineSemaphores ? &timelineFeatures : nullptr;
+	deviceInfo.queueCreateInfoCount = (uint32_t)queueInfos.size();
+	deviceInfo.pQueueCreateInfos = queueInfos.data();
+	deviceInfo.enabledLayerCount = (uint32_t)deviceLayers.size();
+	deviceInfo.ppEnabledLayerNames = deviceLayers.empty() ? nullptr : deviceLayers.data();
+	deviceInfo.enabledExtensionCount = (uint32_t)deviceExtensions.size();
+	deviceInfo.ppEnabledExtensionNames = deviceExtensions.empty() ? nullptr : deviceExtensions.data();
+	deviceInfo.pEnabledFeatures = &enabledFeatures;
+	vkAssert(vkCreateDevice(gpu->physDevice, &deviceInfo, nullptr, &device), "create device");
+
+	vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
+	vkGetDeviceQueue(device, computeFamilyIndex, 0, &computeQueue);
+	vkGetDeviceQueue(device, transferFamilyIndex, 0, &transferQueue);
+
+	if (timelineSemaphores) {
+		pfnWaitSemaphores = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR");
+		pfnGetSemaphoreCounterValue = (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR");
+		if (!pfnWaitSemaphores || !pfnGetSemaphoreCounterValue)
+			timelineSemaphores = false;
+	}
+	if (drawIndirectCount) {
+		pfnCmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR");
+		drawIndirectCount = pfnCmdDrawIndexedIndirectCount != nullptr;
+	}
+
+	allocator = make_unique<MemoryAllocator>(device, *gpu);
+	if (dedicatedAllocation) {
+		allocator->pfnGetBufferMemoryRequirements2 = (PFN_vkGetBufferMemoryRequirements2KHR)vkGetDeviceProcAddr(device, "vkGetBufferMemoryRequirements2KHR");
+		allocator->pfnGetImageMemoryRequirements2 = (PFN_vkGetImageMemoryRequirements2KHR)vkGetDeviceProcAddr(device, "vkGetImageMemoryRequirements2KHR");
+		allocator->dedicatedAllocation = allocator->pfnGetBufferMemoryRequirements2 && allocator->pfnGetImageMemoryRequirements2;
+	}
+}
+
+void VulkanInstance::createSurface()
+{
 	// Construct the surface description:
 #ifdef _WIN32
 	VkWin32SurfaceCreateInfoKHR createInfo = {};
@@ -145,7 +367,7 @@ void VulkanInstance::createDevice(GpuInfo* gpu)
 #endif // _WIN32
 
 	// Iterate over each queue to learn whether it supports presenting:
-	for (int i = 0; i < gpu->queueProps.size(); i++) {
+	for (uint32_t i = 0; i < gpu->queueProps.size(); i++) {
 		VkBool32 supports = false;
 		vkGetPhysicalDeviceSurfaceSupportKHR(gpu->physDevice, i, surface, &supports);
 		if (supports && (gpu->queueProps[i].queueFlags & VK_QUEUE_GRAPHICS_BIT))
@@ -168,31 +390,6 @@ void VulkanInstance::createDevice(GpuInfo* gpu)
 	format = formats[0].format;
 	if (format == VK_FORMAT_UNDEFINED)
 		format = VK_FORMAT_B8G8R8A8_UNORM;
-
-	VkDeviceQueueCreateInfo queueInfo = {};
-	float queue_priorities[1] = { 0.0 };
-	queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-	queueInfo.pNext = nullptr;
-	queueInfo.queueCount = 1;
-	queueInfo.pQueuePriorities = queue_priorities;
-	queueInfo.queueFamilyIndex = queueFamilyIndex;
-
-	vector<const char*> deviceExtensions{ VK_KHR_SWAPCHAIN_EXTENSION_NAME };
-	vector<const char*> deviceLayers;
-
-	VkDeviceCreateInfo deviceInfo = {};
-	deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-	deviceInfo.pNext = nullptr;
-	deviceInfo.queueCreateInfoCount = 1;
-	deviceInfo.pQueueCreateInfos = &queueInfo;
-	deviceInfo.enabledLayerCount = (uint32_t)deviceLayers.size();
-	deviceInfo.ppEnabledLayerNames = deviceLayers.empty() ? nullptr : deviceLayers.data();
-	deviceInfo.enabledExtensionCount = (uint32_t)deviceExtensions.size();
-	deviceInfo.ppEnabledExtensionNames = deviceExtensions.empty() ? nullptr : deviceExtensions.data();
-	deviceInfo.pEnabledFeatures = nullptr;
-	vkAssert(vkCreateDevice(gpu->physDevice, &deviceInfo, nullptr, &device), "create device");
-
-	vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
 }
 
 void VulkanInstance::createCommandBuffer()
@@ -236,28 +433,35 @@ void VulkanInstance::createSwapChain()
 	{
 		// If the surface size is undefined, the size is set to
 		// the size of the images requested.
-		swapChainExtent.width = wnd->width;
-		swapChainExtent.height = wnd->height;
+		swapChainExtent.width = width;
+		swapChainExtent.height = height;
 	}
 	else {
 		// If the surface size is defined, the swap chain size must match
 		swapChainExtent = caps.currentExtent;
 	}
+	width = swapChainExtent.width;
+	height = swapChainExtent.height;
 
-	// If mailbox mode is available, use it, as is the lowest-latency non-
-	// tearing mode.  If not, try IMMEDIATE which will usually be available,
-	// and is fastest (though it tears).  If not, fall back to FIFO which is
+	// The configured mode if available. If not, MAILBOX is the lowest-latency
+	// non-tearing mode, IMMEDIATE is fastest (though it tears) and FIFO is
 	// always available.
-	VkPresentModeKHR swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
-	if (find(presentModes.begin(), presentModes.end(), VK_PRESENT_MODE_MAILBOX_KHR) != presentModes.end())
-		swapchainPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
-	else if (find(presentModes.begin(), presentModes.end(), VK_PRESENT_MODE_IMMEDIATE_KHR) != presentModes.end())
-		swapchainPresentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
-
-	// Determine the number of VkImages to use in the swap chain (we desire to
-	// own only 1 image at a time, besides the images being displayed and
-	// queued for display):
-	uint32_t swapChainImages = caps.minImageCount + 1;
+	auto supported = [&](VkPresentModeKHR mode) {
+		return find(presentModes.begin(), presentModes.end(), mode) != presentModes.end();
+	};
+	presentMode = VK_PRESENT_MODE_FIFO_KHR;
+	if (supported(config.presentMode))
+		presentMode = config.presentMode;
+	else if (supported(VK_PRESENT_MODE_MAILBOX_KHR))
+		presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+	else if (supported(VK_PRESENT_MODE_IMMEDIATE_KHR))
+		presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+
+	// By default own 1 image at a time, besides the images being displayed
+	// and queued for display. Fewer images cut FIFO latency, more smooth
+	// out frame time spikes.
+	uint32_t swapChainImages = config.imageCount ? config.imageCount : caps.minImageCount + 1;
+	swapChainImages = max(swapChainImages, caps.minImageCount);
 	if (caps.maxImageCount > 0)
 		swapChainImages = min(swapChainImages, caps.maxImageCount);
 
@@ -278,26 +482,31 @@ void VulkanInstance::createSwapChain()
 	swapChainInfo.preTransform = preTransform;
 	swapChainInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	swapChainInfo.imageArrayLayers = 1;
-	swapChainInfo.presentMode = swapchainPresentMode;
-	swapChainInfo.oldSwapchain = VK_NULL_HANDLE;
+	swapChainInfo.presentMode = presentMode;
+	// lets the driver hand over resources of the swapchain being replaced
+	swapChainInfo.oldSwapchain = swapChain;
 	swapChainInfo.clipped = true;
 	swapChainInfo.imageColorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
-	swapChainInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	// transfer source for FrameReadback, where the surface allows it
+	swapChainInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+		(caps.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+	swapImageUsage = swapChainInfo.imageUsage;
 	swapChainInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	swapChainInfo.queueFamilyIndexCount = 0;
 	swapChainInfo.pQueueFamilyIndices = nullptr;
 	vkAssert(vkCreateSwapchainKHR(device, &swapChainInfo, nullptr, &swapChain), "create swapchain");
+	if (swapChainInfo.oldSwapchain)
+		vkDestroySwapchainKHR(device, swapChainInfo.oldSwapchain, nullptr);
 
 	uint32_t imageCnt;
 	vkAssert(vkGetSwapchainImagesKHR(device, swapChain, &imageCnt, nullptr), "get images");
 	vector<VkImage> images(imageCnt);
 	vkAssert(vkGetSwapchainImagesKHR(device, swapChain, &imageCnt, images.data()), "get images");
 
+	// No layout transition here: images are not ours until acquired, and the
+	// render pass takes them from UNDEFINED anyway
 	for (uint32_t i = 0; i < imageCnt; i++)
 	{
-		queueImageLayout(cmd, images[i], VK_IMAGE_ASPECT_COLOR_BIT,
-			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-
 		BufferView buf;
 		buf.image = images[i];
 		VkImageViewCreateInfo imageViewInfo = {};
@@ -322,6 +531,103 @@ void VulkanInstance::createSwapChain()
 	}
 }
 
+bool VulkanInstance::recreateSwapChain()
+{
+	// a minimized window has no area, and no swapchain can be created for it
+	VkSurfaceCapabilitiesKHR caps;
+	vkAssert(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(gpu->physDevice, surface, &caps), "get caps");
+	if (caps.currentExtent.width == 0 || caps.currentExtent.height == 0) {
+		swapChainDirty = true;
+		return false;
+	}
+
+	// simpler than tracking which frames still use the old images
+	waitIdle();
+	destroyTargets();
+	swapImages.clear();
+
+	// the setup command buffer records the depth buffer's transition again
+	VkCommandBufferBeginInfo cmdBufInfo = {};
+	cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	cmdBufInfo.pNext = nullptr;
+	cmdBufInfo.flags = 0;
+	cmdBufInfo.pInheritanceInfo = nullptr;
+	vkAssert(vkBeginCommandBuffer(cmd, &cmdBufInfo), "begin command buffer");
+	createSwapChain();
+	createDepthBuffer();
+	initFramebuffer();
+	submitSetup();
+
+	swapChainDirty = false;
+	swapChainGeneration++;
+	return true;
+}
+
+void VulkanInstance::destroyTargets()
+{
+	for (auto fb : frameBuffers)
+		vkDestroyFramebuffer(device, fb, nullptr);
+	frameBuffers.clear();
+	for (auto& target : swapImages)
+		vkDestroyImageView(device, target.view, nullptr);
+	vkDestroyImageView(device, depthView, nullptr);
+	vkDestroyImage(device, depthImage, nullptr);
+	allocator->free(depthMem);
+}
+
+void VulkanInstance::createOffscreenTarget()
+{
+	// Engine-owned color images stand in for the swapchain, one per frame in
+	// flight, so the render pass and framebuffer setup below is shared with
+	// windowed mode.
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.pNext = nullptr;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = format;
+	imageInfo.extent.width = width;
+	imageInfo.extent.height = height;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = numSamples;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.queueFamilyIndexCount = 0;
+	imageInfo.pQueueFamilyIndices = nullptr;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	swapImageUsage = imageInfo.usage;
+	imageInfo.flags = 0;
+
+	for (int i = 0; i < numFrames; i++)
+	{
+		BufferView buf;
+		vkAssert(vkCreateImage(device, &imageInfo, nullptr, &buf.image), "create color target");
+		colorMem.push_back(allocator->bindImage(buf.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true));
+
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.pNext = nullptr;
+		viewInfo.format = format;
+		viewInfo.components.r = VK_COMPONENT_SWIZZLE_R;
+		viewInfo.components.g = VK_COMPONENT_SWIZZLE_G;
+		viewInfo.components.b = VK_COMPONENT_SWIZZLE_B;
+		viewInfo.components.a = VK_COMPONENT_SWIZZLE_A;
+		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.flags = 0;
+		viewInfo.image = buf.image;
+		vkAssert(vkCreateImageView(device, &viewInfo, nullptr, &buf.view), "create view");
+
+		swapImages.push_back(buf);
+	}
+}
+
 void VulkanInstance::createDepthBuffer() {
 	VkImageCreateInfo imageInfo = {};
 
@@ -340,8 +646,8 @@ void VulkanInstance::createDepthBuffer() {
 	imageInfo.pNext = nullptr;
 	imageInfo.imageType = VK_IMAGE_TYPE_2D;
 	imageInfo.format = depthFormat;
-	imageInfo.extent.width = wnd->width;
-	imageInfo.extent.height = wnd->height;
+	imageInfo.extent.width = width;
+	imageInfo.extent.height = height;
 	imageInfo.extent.depth = 1;
 	imageInfo.mipLevels = 1;
 	imageInfo.arrayLayers = 1;
@@ -351,15 +657,10 @@ void VulkanInstance::createDepthBuffer() {
 	imageInfo.queueFamilyIndexCount = 0;
 	imageInfo.pQueueFamilyIndices = nullptr;
 	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	// depth is cleared on load and never stored, so it can live in tile memory
+	imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
 	imageInfo.flags = 0;
 
-	VkMemoryAllocateInfo memAlloc = {};
-	memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memAlloc.pNext = nullptr;
-	memAlloc.allocationSize = 0;
-	memAlloc.memoryTypeIndex = 0;
-
 	VkImageViewCreateInfo viewInfo = {};
 	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 	viewInfo.pNext = nullptr;
@@ -384,22 +685,12 @@ void VulkanInstance::createDepthBuffer() {
 		viewInfo.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
 	}
 
-	VkMemoryRequirements memReqs; 
-
 	// Create image
 	vkAssert(vkCreateImage(device, &imageInfo, nullptr, &depthImage), "create depth");
-	vkGetImageMemoryRequirements(device, depthImage, &memReqs);
 
-	memAlloc.allocationSize = memReqs.size;
-
-	// Use the memory properties to determine the type of memory required
-	memAlloc.memoryTypeIndex = memoryTypeFromProps(gpu->memoryProps, memReqs.memoryTypeBits, 0); // 0: No requirements
-
-	// Allocate memory
-	vkAssert(vkAllocateMemory(device, &memAlloc, nullptr, &depthMem), "alloc mem");
-
-	// Bind memory
-	vkAssert(vkBindImageMemory(device, depthImage, depthMem, 0), "bind mem");
+	// Render targets get a dedicated allocation
+	depthMem = allocator->bindImage(depthImage,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, true);
 	
 	// Set the image layout to depth stencil optimal
 	queueImageLayout(cmd, depthImage, viewInfo.subresourceRange.aspectMask,
@@ -420,17 +711,17 @@ void VulkanInstance::initRenderPass()
 	attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-	attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachments[0].finalLayout = headless ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 	attachments[0].flags = 0;
 	
 	attachments[1].format = depthFormat;
 	attachments[1].samples = numSamples;
 	attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-	attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
-	attachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 	attachments[1].flags = 0;
 
@@ -454,6 +745,18 @@ void VulkanInstance::initRenderPass()
 	subpass.preserveAttachmentCount = 0;
 	subpass.pPreserveAttachments = nullptr;
 
+	// Frames in flight share the depth buffer, and the swapchain image is only
+	// available once the acquire semaphore (waited at color output) signals
+	VkSubpassDependency dependency = {};
+	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependency.dstSubpass = 0;
+	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependency.dependencyFlags = 0;
+
 	VkRenderPassCreateInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
 	info.pNext = nullptr;
@@ -461,8 +764,8 @@ void VulkanInstance::initRenderPass()
 	info.pAttachments = attachments;
 	info.subpassCount = 1;
 	info.pSubpasses = &subpass;
-	info.dependencyCount = 0;
-	info.pDependencies = nullptr;
+	info.dependencyCount = 1;
+	info.pDependencies = &dependency;
 
 	vkAssert(vkCreateRenderPass(device, &info, nullptr, &renderPass), "create render pass");
 }
@@ -478,12 +781,301 @@ void VulkanInstance::initFramebuffer()
 		info.renderPass = renderPass;
 		info.attachmentCount = 2;
 		info.pAttachments = attachments;
-		info.width = wnd->width;
-		info.height = wnd->height;
+		info.width = width;
+		info.height = height;
 		info.layers = 1;
 		
 		VkFramebuffer buf;
 		vkAssert(vkCreateFramebuffer(device, &info, nullptr, &buf), "create framebuffer");
 		frameBuffers.push_back(buf);
 	}
-}
\ No newline at end of file
+}
+
+void VulkanInstance::createFrames()
+{
+	VkSemaphoreTypeCreateInfoKHR timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+	timelineInfo.pNext = nullptr;
+	timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+	timelineInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semInfo = {};
+	semInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semInfo.pNext = nullptr;
+	semInfo.flags = 0;
+
+	if (timelineSemaphores) {
+		semInfo.pNext = &timelineInfo;
+		vkAssert(vkCreateSemaphore(device, &semInfo, nullptr, &timeline), "create timeline");
+		semInfo.pNext = nullptr;
+	}
+
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.pNext = nullptr;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	VkCommandPoolCreateInfo cmdPoolInfo = {};
+	cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	cmdPoolInfo.pNext = nullptr;
+	cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
+	cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	frames.resize(numFrames);
+	for (auto& frame : frames)
+	{
+		vkAssert(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &frame.cmdPool), "create pool");
+
+		VkCommandBufferAllocateInfo cmdInfo = {};
+		cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		cmdInfo.pNext = nullptr;
+		cmdInfo.commandPool = frame.cmdPool;
+		cmdInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		cmdInfo.commandBufferCount = 1;
+		vkAssert(vkAllocateCommandBuffers(device, &cmdInfo, &frame.cmd), "create command buffer");
+
+		vkAssert(vkCreateFence(device, &fenceInfo, nullptr, &frame.fence), "create fence");
+		vkAssert(vkCreateSemaphore(device, &semInfo, nullptr, &frame.acquireSem), "create semaphore");
+		vkAssert(vkCreateSemaphore(device, &semInfo, nullptr, &frame.presentSem), "create semaphore");
+	}
+}
+
+void VulkanInstance::submitSetup()
+{
+	vkAssert(vkEndCommandBuffer(cmd), "end command buffer");
+
+	VkSubmitInfo submit = {};
+	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit.pNext = nullptr;
+	submit.commandBufferCount = 1;
+	submit.pCommandBuffers = &cmd;
+	lock_guard<mutex> lock(queueMutex);
+	vkAssert(vkQueueSubmit(queue, 1, &submit, VK_NULL_HANDLE), "submit setup");
+	vkAssert(vkQueueWaitIdle(queue), "wait setup");
+}
+
+VkCommandBuffer VulkanInstance::beginFrame()
+{
+	FrameData& frame = frames[curFrame];
+
+	// wait until the GPU is done with this frame's resources
+	if (timelineSemaphores) {
+		VkSemaphoreWaitInfoKHR waitInfo = {};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+		waitInfo.pNext = nullptr;
+		waitInfo.flags = 0;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &timeline;
+		waitInfo.pValues = &frame.frameNumber;
+		vkAssert(pfnWaitSemaphores(device, &waitInfo, UINT64_MAX), "wait timeline");
+	} else {
+		vkAssert(vkWaitForFences(device, 1, &frame.fence, VK_TRUE, UINT64_MAX), "wait fence");
+	}
+	lastCompleted = max(lastCompleted, frame.frameNumber);
+	deletionQueue.collect(lastCompleted);
+
+	// skipped while minimized; the fence is only reset on submission, so
+	// the next attempt doesn't wait forever
+	if (!headless && swapChainDirty && !recreateSwapChain())
+		return VK_NULL_HANDLE;
+
+	// The limiter sleeps once the GPU has caught up, so the frame starts as
+	// late as possible instead of waiting with stale input in the queue
+	auto now = chrono::steady_clock::now();
+	if (config.maxFps > 0) {
+		// a late frame doesn't make the following ones catch up
+		nextFrame = max(nextFrame, now);
+		this_thread::sleep_until(nextFrame);
+		nextFrame += chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1.0 / config.maxFps));
+		now = chrono::steady_clock::now();
+	}
+	if (frameNumber > 0)
+		frameStats.cpuFrame.add(chrono::duration<double, milli>(now - frameStart).count());
+	frameStart = now;
+
+	if (headless) {
+		curSwap = curFrame;
+	} else {
+		// the semaphore is only signaled on success, so it can be reused for the retry
+		uint32_t imageIdx;
+		VkResult res;
+		while ((res = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, frame.acquireSem, VK_NULL_HANDLE, &imageIdx)) == VK_ERROR_OUT_OF_DATE_KHR) {
+			if (!recreateSwapChain())
+				return VK_NULL_HANDLE;
+		}
+		// still presentable, recreated next frame
+		if (res == VK_SUBOPTIMAL_KHR)
+			swapChainDirty = true;
+		else
+			vkAssert(res, "acquire image");
+		curSwap = imageIdx;
+		acquired = chrono::steady_clock::now();
+	}
+
+	vkAssert(vkResetCommandPool(device, frame.cmdPool, 0), "reset pool");
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.pNext = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = nullptr;
+	vkAssert(vkBeginCommandBuffer(frame.cmd, &beginInfo), "begin command buffer");
+	return frame.cmd;
+}
+
+void VulkanInstance::endFrame()
+{
+	FrameData& frame = frames[curFrame];
+	vkAssert(vkEndCommandBuffer(frame.cmd), "end command buffer");
+
+	frame.frameNumber = ++frameNumber;
+
+	vector<VkSemaphore> waitSems = frameWaits;
+	vector<VkPipelineStageFlags> waitStages = frameWaitStages;
+	if (!headless) {
+		waitSems.push_back(frame.acquireSem);
+		waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+	}
+	vector<uint64_t> waitValues = frameWaitValues;
+	waitValues.resize(waitSems.size(), 0);
+	vector<VkSemaphore> signalSems = frameSignals;
+	if (!headless)
+		signalSems.push_back(frame.presentSem);
+	vector<uint64_t> signalValues(signalSems.size(), 0);
+	if (timelineSemaphores) {
+		signalSems.push_back(timeline);
+		signalValues.push_back(frame.frameNumber);
+	}
+	frameWaits.clear();
+	frameWaitStages.clear();
+	frameWaitValues.clear();
+	frameSignals.clear();
+
+	VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+	timelineInfo.pNext = nullptr;
+	timelineInfo.waitSemaphoreValueCount = (uint32_t)waitValues.size();
+	timelineInfo.pWaitSemaphoreValues = waitValues.data();
+	timelineInfo.signalSemaphoreValueCount = (uint32_t)signalValues.size();
+	timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+	VkSubmitInfo submit = {};
+	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit.pNext = timelineSemaphores ? &timelineInfo : nullptr;
+	submit.waitSemaphoreCount = (uint32_t)waitSems.size();
+	submit.pWaitSemaphores = waitSems.empty() ? nullptr : waitSems.data();
+	submit.pWaitDstStageMask = waitStages.empty() ? nullptr : waitStages.data();
+	submit.commandBufferCount = 1;
+	submit.pCommandBuffers = &frame.cmd;
+	submit.signalSemaphoreCount = (uint32_t)signalSems.size();
+	submit.pSignalSemaphores = signalSems.empty() ? nullptr : signalSems.data();
+	if (!timelineSemaphores)
+		vkAssert(vkResetFences(device, 1, &frame.fence), "reset fence");
+	lock_guard<mutex> lock(queueMutex);
+	vkAssert(vkQueueSubmit(queue, 1, &submit, timelineSemaphores ? VK_NULL_HANDLE : frame.fence), "submit frame");
+
+	if (!headless) {
+		uint32_t imageIdx = curSwap;
+		VkPresentInfoKHR present = {};
+		present.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		present.pNext = nullptr;
+		present.waitSemaphoreCount = 1;
+		present.pWaitSemaphores = &frame.presentSem;
+		present.swapchainCount = 1;
+		present.pSwapchains = &swapChain;
+		present.pImageIndices = &imageIdx;
+		present.pResults = nullptr;
+		VkResult res = vkQueuePresentKHR(queue, &present);
+		if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR)
+			swapChainDirty = true;
+		else
+			vkAssert(res, "present");
+		frameStats.acquireToPresent.add(chrono::duration<double, milli>(chrono::steady_clock::now() - acquired).count());
+	}
+
+	curFrame = (curFrame + 1) % numFrames;
+}
+
+void VulkanInstance::setConfig(const VulkanConfig& newConfig)
+{
+	if (newConfig.presentMode != config.presentMode || newConfig.imageCount != config.imageCount)
+		swapChainDirty = !headless;
+	config = newConfig;
+	config.framesInFlight = numFrames;
+}
+
+void VulkanInstance::addFrameWait(VkSemaphore sem, VkPipelineStageFlags stage, uint64_t value)
+{
+	frameWaits.push_back(sem);
+	frameWaitStages.push_back(stage);
+	frameWaitValues.push_back(value);
+}
+
+void VulkanInstance::addFrameSignal(VkSemaphore sem)
+{
+	frameSignals.push_back(sem);
+}
+
+void VulkanInstance::setViewport(VkCommandBuffer cmd)
+{
+	VkViewport viewport;
+	viewport.x = 0;
+	viewport.y = 0;
+	viewport.width = (float)width;
+	viewport.height = (float)height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+	VkRect2D scissor;
+	scissor.offset.x = 0;
+	scissor.offset.y = 0;
+	scissor.extent.width = width;
+	scissor.extent.height = height;
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
+}
+
+void VulkanInstance::beginRenderPass(VkCommandBuffer cmd, VkSubpassContents contents)
+{
+	VkClearValue clearValues[2];
+	clearValues[0].color.float32[0] = 0.2f;
+	clearValues[0].color.float32[1] = 0.2f;
+	clearValues[0].color.float32[2] = 0.2f;
+	clearValues[0].color.float32[3] = 1.0f;
+	clearValues[1].depthStencil.depth = 1.0f;
+	clearValues[1].depthStencil.stencil = 0;
+
+	VkRenderPassBeginInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	info.pNext = nullptr;
+	info.renderPass = renderPass;
+	info.framebuffer = frameBuffers[curSwap];
+	info.renderArea.offset.x = 0;
+	info.renderArea.offset.y = 0;
+	info.renderArea.extent.width = width;
+	info.renderArea.extent.height = height;
+	info.clearValueCount = 2;
+	info.pClearValues = clearValues;
+	vkCmdBeginRenderPass(cmd, &info, contents);
+	if (contents == VK_SUBPASS_CONTENTS_INLINE)
+		setViewport(cmd);
+}
+
+uint64_t VulkanInstance::completedFrame()
+{
+	if (timelineSemaphores) {
+		uint64_t value;
+		vkAssert(pfnGetSemaphoreCounterValue(device, timeline, &value), "get timeline value");
+		lastCompleted = max(lastCompleted, value);
+	} else {
+		for (auto& frame : frames)
+			if (vkGetFenceStatus(device, frame.fence) == VK_SUCCESS)
+				lastCompleted = max(lastCompleted, frame.frameNumber);
+	}
+	return lastCompleted;
+}
+
+void VulkanInstance::waitIdle()
+{
+	vkAssert(vkDeviceWaitIdle(device), "wait idle");
+	lastCompleted = frameNumber;
+}
@@ -1,7 +1,14 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <type_traits>
 #include "vulkan/vkmain.hpp"
+#include "vulkan/memory.hpp"
+#include "vulkan/framestats.hpp"
+#include "vulkan/deletion.hpp"
 
 class Window;
 
@@ -12,48 +19,184 @@ struct BufferView {
 
 struct GpuInfo 
 {
+	bool hasExtension(const char* name) const;
+
 	VkPhysicalDevice physDevice;
 	std::vector<VkQueueFamilyProperties> queueProps;
 	VkPhysicalDeviceMemoryProperties memoryProps;
 	VkPhysicalDeviceProperties gpuProps;
+	VkPhysicalDeviceFeatures features;
+	std::vector<VkExtensionProperties> extensions;
+};
+
+// Per-frame resources of a frame in flight
+struct FrameData
+{
+	VkCommandPool cmdPool;
+	VkCommandBuffer cmd;
+	VkFence fence;
+	VkSemaphore acquireSem, presentSem;
+	uint64_t frameNumber = 0; // value signaled on the timeline when this frame retires
+};
+
+// Latency versus throughput settings
+struct VulkanConfig
+{
+	// Used if the surface supports it, otherwise MAILBOX, IMMEDIATE, FIFO in
+	// that order. FIFO never tears but queues up to imageCount frames.
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+	// Swapchain images, 0 for minImageCount + 1, clamped to the surface limits
+	uint32_t imageCount = 0;
+	// Frames the CPU may record ahead of the GPU, fixed at construction
+	int framesInFlight = 2;
+	// CPU frame limiter, 0 is unlimited. Frames start late rather than wait
+	// after presenting, so input sampled after beginFrame is fresh.
+	double maxFps = 0;
+	// Index into VulkanInstance::gpus, -1 picks the best scoring device
+	int deviceIndex = -1;
+	// Devices without all of these are skipped, they are enabled on the chosen one
+	VkPhysicalDeviceFeatures requiredFeatures = {};
 };
 
 class VulkanInstance
 {
 public:
-	VulkanInstance(const std::string& appName, Window* wnd);
+	// Windowed: renders into the swapchain of wnd
+	VulkanInstance(const std::string& appName, Window* wnd, const VulkanConfig& config = VulkanConfig());
+	// Headless: no surface or swapchain, renders into an offscreen color target
+	VulkanInstance(const std::string& appName, int width, int height, const VulkanConfig& config = VulkanConfig());
+	// Waits for the device, runs the deletion queue and destroys everything
+	// created here. Objects created from the instance must be gone by now.
+	~VulkanInstance();
+	VulkanInstance(const VulkanInstance&) = delete;
+	VulkanInstance& operator=(const VulkanInstance&) = delete;
+	void init();
 	void enumerateDevices();
+	// Higher is better, -1 if the device can't be used: no graphics queue,
+	// a required feature missing or, when windowed, no swapchain support.
+	// Device type dominates, then optional features, then device-local memory.
+	int scoreDevice(const GpuInfo& gpu) const;
+	// The configured device or the best scoring one
+	GpuInfo* selectDevice();
 	void createDevice(GpuInfo* gpu);
+	void createSurface();
 	void createCommandBuffer();
 	void createSwapChain();
+	// Also after VK_ERROR_OUT_OF_DATE_KHR or VK_SUBOPTIMAL_KHR, which beginFrame
+	// does itself. Waits for the device; width, height and swapChainGeneration
+	// change, so everything sized or bound to the swapchain images is rebuilt.
+	// False, and nothing changes, while the surface has no area (minimized).
+	bool recreateSwapChain();
+	void createOffscreenTarget();
 	void createDepthBuffer();
 	void initRenderPass();
 	void initFramebuffer();
+	void createFrames();
+	void submitSetup();
+
+	// Frame loop: beginFrame waits until the frame's resources are free again
+	// and returns its command buffer; endFrame submits and presents it.
+	// While the window is minimized beginFrame returns VK_NULL_HANDLE, skip
+	// the frame without calling endFrame.
+	VkCommandBuffer beginFrame();
+	void endFrame();
+	// Present mode and image count changes take effect with the next beginFrame
+	void setConfig(const VulkanConfig& config);
+	void beginRenderPass(VkCommandBuffer cmd, VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
+	void setViewport(VkCommandBuffer cmd);
+	// Extra semaphores for the current frame's submission, e.g. to hand work
+	// over from the compute queue. value is for timeline semaphores.
+	void addFrameWait(VkSemaphore sem, VkPipelineStageFlags stage, uint64_t value = 0);
+	void addFrameSignal(VkSemaphore sem);
+	// Whether compute runs on its own queue family
+	bool asyncCompute() const { return computeFamilyIndex != queueFamilyIndex; }
+	// Whether copies can run on a transfer-only queue family
+	bool dedicatedTransfer() const { return transferFamilyIndex != queueFamilyIndex; }
+	// Run fn once every frame submitted so far, and the one being recorded,
+	// has retired. From other threads, push to deletionQueue with a frame
+	// number obtained on the frame loop's thread.
+	void defer(std::function<void()> fn) { deletionQueue.push(frameNumber + 1, std::move(fn)); }
+	// Destroy a move-only resource (VulkanBuffer, Shader, unique_ptr, ...)
+	// once the GPU can no longer use it:
+	//   inst.retire(std::move(oldTexture));
+	template<class T> void retire(T&& obj)
+	{
+		auto holder = std::make_shared<typename std::decay<T>::type>(std::move(obj));
+		defer([holder]() mutable { holder.reset(); });
+	}
+	// Highest frame number known to have finished on the GPU
+	uint64_t completedFrame();
+	void waitIdle();
 
 	const VkSampleCountFlagBits numSamples = VK_SAMPLE_COUNT_1_BIT;
 
 	std::string appName;
 	std::vector<VkLayerProperties> instanceLayerProps;
 	VkInstance instance;
-	VkSurfaceKHR surface;
+	VkSurfaceKHR surface = VK_NULL_HANDLE;
 	VkFormat format;
 	VkQueue queue;
 	int queueFamilyIndex = -1;
+	VkQueue computeQueue;
+	int computeFamilyIndex = -1;
+	VkQueue transferQueue;
+	int transferFamilyIndex = -1;
 	std::vector<GpuInfo> gpus;
 	GpuInfo* gpu = nullptr;
 	VkDevice device;
+	VkPhysicalDeviceFeatures enabledFeatures;
+	std::unique_ptr<MemoryAllocator> allocator;
 	Window* wnd;
+	bool headless;
+	int width, height;
 	VkCommandPool cmdPool;
 	VkCommandBuffer cmd;
-	VkSwapchainKHR swapChain;
+	VkSwapchainKHR swapChain = VK_NULL_HANDLE;
 	std::vector<BufferView> swapImages;
+	VkImageUsageFlags swapImageUsage = 0;
 	int curSwap = 0;
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+	// Incremented whenever the swapchain is recreated
+	uint32_t swapChainGeneration = 0;
+	bool swapChainDirty = false;
+	VulkanConfig config;
+	FrameStats frameStats;
+	DeletionQueue deletionQueue;
 	VkRenderPass renderPass;
 
+	std::vector<Allocation> colorMem;
+
 	VkFormat depthFormat;
 	VkImage depthImage;
-	VkDeviceMemory depthMem;
+	Allocation depthMem;
 	VkImageView depthView;
 
 	std::vector<VkFramebuffer> frameBuffers;
+
+	int numFrames = 2;
+	std::vector<FrameData> frames;
+	int curFrame = 0;
+	uint64_t frameNumber = 0, lastCompleted = 0;
+	std::vector<VkSemaphore> frameWaits, frameSignals;
+	std::vector<VkPipelineStageFlags> frameWaitStages;
+	std::vector<uint64_t> frameWaitValues;
+	// Queues may alias (e.g. without a transfer-only family), so every
+	// vkQueueSubmit/vkQueuePresentKHR holds this
+	std::mutex queueMutex;
+
+	// Timeline semaphore counting retired frames, if supported
+	bool timelineSemaphores = false;
+	VkSemaphore timeline = VK_NULL_HANDLE;
+	PFN_vkWaitSemaphoresKHR pfnWaitSemaphores = nullptr;
+	PFN_vkGetSemaphoreCounterValueKHR pfnGetSemaphoreCounterValue = nullptr;
+	// VK_KHR_draw_indirect_count, if supported
+	bool drawIndirectCount = false;
+	PFN_vkCmdDrawIndexedIndirectCountKHR pfnCmdDrawIndexedIndirectCount = nullptr;
+	std::vector<VkExtensionProperties> instanceExtensions;
+
+private:
+	// Framebuffers, swapchain image views and the depth buffer
+	void destroyTargets();
+
+	std::chrono::steady_clock::time_point frameStart, nextFrame, acquired;
 };
\ No newline at end of file
@@ -0,0 +1,288 @@
+#include "vulkan/memory.hpp"
+#include "vulkan/instance.hpp"
+#include <algorithm>
+using namespace std;
+
+static VkDeviceSize roundUpPow2(VkDeviceSize v)
+{
+	VkDeviceSize p = 1;
+	while (p < v)
+		p <<= 1;
+	return p;
+}
+
+BuddyAllocator::BuddyAllocator(VkDeviceSize size, VkDeviceSize minSize) :
+	size(size), minSize(minSize)
+{
+	freeLists.resize(order(size) + 1);
+	freeLists.back().insert(0);
+}
+
+int BuddyAllocator::order(VkDeviceSize size) const
+{
+	int k = 0;
+	while ((minSize << k) < size)
+		k++;
+	return k;
+}
+
+bool BuddyAllocator::alloc(VkDeviceSize reqSize, VkDeviceSize alignment, VkDeviceSize& offset, VkDeviceSize& allocSize)
+{
+	VkDeviceSize need = roundUpPow2(max(max(reqSize, alignment), minSize));
+	if (need > size)
+		return false;
+
+	// find the smallest free block that fits
+	int k = order(need);
+	int j = k;
+	while (j < (int)freeLists.size() && freeLists[j].empty())
+		j++;
+	if (j == (int)freeLists.size())
+		return false;
+
+	offset = *freeLists[j].begin();
+	freeLists[j].erase(freeLists[j].begin());
+
+	// split down, returning the upper halves to the free lists
+	while (j > k) {
+		j--;
+		freeLists[j].insert(offset + (minSize << j));
+	}
+	allocSize = minSize << k;
+	used += allocSize;
+	return true;
+}
+
+void BuddyAllocator::free(VkDeviceSize offset, VkDeviceSize allocSize)
+{
+	used -= allocSize;
+	int k = order(allocSize);
+
+	// merge with free buddies as far up as possible
+	while (k + 1 < (int)freeLists.size()) {
+		VkDeviceSize buddy = offset ^ (minSize << k);
+		auto it = freeLists[k].find(buddy);
+		if (it == freeLists[k].end())
+			break;
+		freeLists[k].erase(it);
+		offset = min(offset, buddy);
+		k++;
+	}
+	freeLists[k].insert(offset);
+}
+
+MemoryAllocator::MemoryAllocator(VkDevice device, const GpuInfo& gpu) :
+	device(device), gpu(gpu)
+{
+}
+
+MemoryAllocator::~MemoryAllocator()
+{
+	for (auto& pool : pools)
+		for (auto& block : pool.blocks)
+			if (block.mem)
+				vkFreeMemory(device, block.mem, nullptr);
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags props) const
+{
+	const auto& memProps = gpu.memoryProps;
+	for (uint32_t i = 0; i < memProps.memoryTypeCount; i++) {
+		if ((typeBits & (1u << i)) && (memProps.memoryTypes[i].propertyFlags & props) == props)
+			return i;
+	}
+	// lazily allocated, host cached and device local are preferences, not requirements
+	if (props & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+		return findMemoryType(typeBits, props & ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+	if (props & VK_MEMORY_PROPERTY_HOST_CACHED_BIT)
+		return findMemoryType(typeBits, props & ~VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+	if (props & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+		return findMemoryType(typeBits, props & ~VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	fatalError("no suitable memory type");
+	return 0;
+}
+
+VkDeviceMemory MemoryAllocator::allocDevice(VkDeviceSize size, uint32_t memType, uint8_t** mapped, const void* pNext)
+{
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.pNext = pNext;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memType;
+	VkDeviceMemory mem;
+	vkAssert(vkAllocateMemory(device, &allocInfo, nullptr, &mem), "alloc mem");
+	numDeviceAllocations++;
+
+	// host visible memory stays mapped for its whole lifetime
+	*mapped = nullptr;
+	if (gpu.memoryProps.memoryTypes[memType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		vkAssert(vkMapMemory(device, mem, 0, VK_WHOLE_SIZE, 0, (void**)mapped), "map mem");
+	return mem;
+}
+
+Allocation MemoryAllocator::alloc(const VkMemoryRequirements& reqs, VkMemoryPropertyFlags props, bool linear, bool dedicated)
+{
+	return allocate(reqs, props, linear, dedicated, nullptr);
+}
+
+Allocation MemoryAllocator::allocate(const VkMemoryRequirements& reqs, VkMemoryPropertyFlags props, bool linear, bool dedicated,
+	const VkMemoryDedicatedAllocateInfoKHR* dedicatedInfo)
+{
+	Allocation a;
+	a.memType = findMemoryType(reqs.memoryTypeBits, props);
+
+	lock_guard<mutex> lock(allocMutex);
+
+	int poolIdx = -1;
+	for (int i = 0; i < (int)pools.size(); i++)
+		if (pools[i].memType == a.memType && pools[i].linear == linear)
+			poolIdx = i;
+	if (poolIdx < 0) {
+		// keep blocks well below the heap size on small heaps
+		const auto& heap = gpu.memoryProps.memoryHeaps[gpu.memoryProps.memoryTypes[a.memType].heapIndex];
+		VkDeviceSize blockSize = maxBlockSize;
+		while (blockSize > minAllocSize && blockSize > heap.size / 8)
+			blockSize >>= 1;
+
+		Pool pool;
+		pool.memType = a.memType;
+		pool.linear = linear;
+		pool.blockSize = blockSize;
+		pools.push_back(pool);
+		poolIdx = (int)pools.size() - 1;
+	}
+	Pool& pool = pools[poolIdx];
+
+	if (dedicated || reqs.size > pool.blockSize / 2) {
+		a.mem = allocDevice(reqs.size, a.memType, &a.mapped, dedicatedInfo);
+		a.size = reqs.size;
+		return a;
+	}
+
+	a.pool = poolIdx;
+	int freeSlot = -1;
+	for (int i = 0; i < (int)pool.blocks.size(); i++) {
+		Block& block = pool.blocks[i];
+		if (!block.mem) {
+			freeSlot = i;
+			continue;
+		}
+		if (block.buddy.alloc(reqs.size, reqs.alignment, a.offset, a.size)) {
+			a.block = i;
+			a.mem = block.mem;
+			a.mapped = block.mapped ? block.mapped + a.offset : nullptr;
+			return a;
+		}
+	}
+
+	// all blocks full, add a new one
+	Block block { VK_NULL_HANDLE, nullptr, BuddyAllocator(pool.blockSize, minAllocSize) };
+	block.mem = allocDevice(pool.blockSize, a.memType, &block.mapped);
+	if (!block.buddy.alloc(reqs.size, reqs.alignment, a.offset, a.size))
+		fatalError("sub-allocation failed");
+	if (freeSlot >= 0) {
+		pool.blocks[freeSlot] = block;
+		a.block = freeSlot;
+	} else {
+		pool.blocks.push_back(block);
+		a.block = (int)pool.blocks.size() - 1;
+	}
+	a.mem = block.mem;
+	a.mapped = block.mapped ? block.mapped + a.offset : nullptr;
+	return a;
+}
+
+void MemoryAllocator::free(const Allocation& a)
+{
+	if (a.mem == VK_NULL_HANDLE)
+		return;
+
+	lock_guard<mutex> lock(allocMutex);
+	if (a.block < 0) {
+		vkFreeMemory(device, a.mem, nullptr);
+		numDeviceAllocations--;
+		return;
+	}
+
+	Pool& pool = pools[a.pool];
+	Block& block = pool.blocks[a.block];
+	block.buddy.free(a.offset, a.size);
+	if (!block.buddy.empty())
+		return;
+	// one empty block stays for the next allocations, the others go back
+	for (auto& other : pool.blocks) {
+		if (&other != &block && other.mem && other.buddy.empty()) {
+			vkFreeMemory(device, block.mem, nullptr);
+			numDeviceAllocations--;
+			block.mem = VK_NULL_HANDLE;
+			block.mapped = nullptr;
+			return;
+		}
+	}
+}
+
+Allocation MemoryAllocator::bindBuffer(VkBuffer buffer, VkMemoryPropertyFlags props)
+{
+	if (!dedicatedAllocation) {
+		VkMemoryRequirements memReqs;
+		vkGetBufferMemoryRequirements(device, buffer, &memReqs);
+		Allocation a = alloc(memReqs, props, true);
+		vkAssert(vkBindBufferMemory(device, buffer, a.mem, a.offset), "bind mem");
+		return a;
+	}
+
+	VkMemoryDedicatedRequirementsKHR dedicatedReqs = {};
+	dedicatedReqs.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS_KHR;
+	dedicatedReqs.pNext = nullptr;
+	VkMemoryRequirements2KHR memReqs = {};
+	memReqs.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2_KHR;
+	memReqs.pNext = &dedicatedReqs;
+	VkBufferMemoryRequirementsInfo2KHR reqInfo = {};
+	reqInfo.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2_KHR;
+	reqInfo.pNext = nullptr;
+	reqInfo.buffer = buffer;
+	pfnGetBufferMemoryRequirements2(device, &reqInfo, &memReqs);
+
+	VkMemoryDedicatedAllocateInfoKHR dedicatedInfo = {};
+	dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO_KHR;
+	dedicatedInfo.pNext = nullptr;
+	dedicatedInfo.image = VK_NULL_HANDLE;
+	dedicatedInfo.buffer = buffer;
+	bool dedicated = dedicatedReqs.prefersDedicatedAllocation || dedicatedReqs.requiresDedicatedAllocation;
+	Allocation a = allocate(memReqs.memoryRequirements, props, true, dedicated, &dedicatedInfo);
+	vkAssert(vkBindBufferMemory(device, buffer, a.mem, a.offset), "bind mem");
+	return a;
+}
+
+Allocation MemoryAllocator::bindImage(VkImage image, VkMemoryPropertyFlags props, bool dedicated)
+{
+	if (!dedicatedAllocation) {
+		VkMemoryRequirements memReqs;
+		vkGetImageMemoryRequirements(device, image, &memReqs);
+		Allocation a = alloc(memReqs, props, false, dedicated);
+		vkAssert(vkBindImageMemory(device, image, a.mem, a.offset), "bind mem");
+		return a;
+	}
+
+	VkMemoryDedicatedRequirementsKHR dedicatedReqs = {};
+	dedicatedReqs.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS_KHR;
+	dedicatedReqs.pNext = nullptr;
+	VkMemoryRequirements2KHR memReqs = {};
+	memReqs.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2_KHR;
+	memReqs.pNext = &dedicatedReqs;
+	VkImageMemoryRequirementsInfo2KHR reqInfo = {};
+	reqInfo.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2_KHR;
+	reqInfo.pNext = nullptr;
+	reqInfo.image = image;
+	pfnGetImageMemoryRequirements2(device, &reqInfo, &memReqs);
+
+	VkMemoryDedicatedAllocateInfoKHR dedicatedInfo = {};
+	dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO_KHR;
+	dedicatedInfo.pNext = nullptr;
+	dedicatedInfo.image = image;
+	dedicatedInfo.buffer = VK_NULL_HANDLE;
+	dedicated = dedicated || dedicatedReqs.prefersDedicatedAllocation || dedicatedReqs.requiresDedicatedAllocation;
+	Allocation a = allocate(memReqs.memoryRequirements, props, false, dedicated, &dedicatedInfo);
+	vkAssert(vkBindImageMemory(device, image, a.mem, a.offset), "bind mem");
+	return a;
+}
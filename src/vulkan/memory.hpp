@@ -0,0 +1,93 @@
+#pragma once
+#include <vector>
+#include <unordered_set>
+#include <mutex>
+#include "vulkan/vkmain.hpp"
+
+struct GpuInfo;
+
+// A range of device memory handed out by MemoryAllocator
+struct Allocation
+{
+	VkDeviceMemory mem = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	uint8_t* mapped = nullptr; // persistent mapping at offset, null unless host visible
+	uint32_t memType = 0;
+	int pool = -1;
+	int block = -1; // -1 for dedicated allocations
+};
+
+// Power-of-two buddy sub-allocator over a single memory block.
+// Blocks are naturally aligned to their size, so any power-of-two alignment
+// up to the allocation size is satisfied for free.
+class BuddyAllocator
+{
+public:
+	BuddyAllocator(VkDeviceSize size, VkDeviceSize minSize);
+	bool alloc(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, VkDeviceSize& allocSize);
+	void free(VkDeviceSize offset, VkDeviceSize allocSize);
+	bool empty() const { return used == 0; }
+
+	VkDeviceSize size, minSize, used = 0;
+private:
+	int order(VkDeviceSize size) const;
+	std::vector<std::unordered_set<VkDeviceSize>> freeLists;
+};
+
+// Sub-allocates buffers and images from large per-memory-type blocks, so
+// creating a resource costs a free-list lookup instead of vkAllocateMemory.
+// Resources larger than half a block, or explicitly requested as dedicated
+// (e.g. render targets), get their own VkDeviceMemory. Each pool keeps at
+// most one empty block around, further blocks are freed once empty.
+class MemoryAllocator
+{
+public:
+	MemoryAllocator(VkDevice device, const GpuInfo& gpu);
+	~MemoryAllocator();
+
+	// Memory that may be bound to several resources, dedicated only means a VkDeviceMemory of its own
+	Allocation alloc(const VkMemoryRequirements& reqs, VkMemoryPropertyFlags props, bool linear, bool dedicated = false);
+	void free(const Allocation& allocation);
+
+	// Allocate and bind memory for a resource. Images are assumed to use optimal tiling.
+	Allocation bindBuffer(VkBuffer buffer, VkMemoryPropertyFlags props);
+	Allocation bindImage(VkImage image, VkMemoryPropertyFlags props, bool dedicated = false);
+
+	uint32_t findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags props) const;
+
+	VkDevice device;
+	const GpuInfo& gpu;
+	VkDeviceSize maxBlockSize = 64 * 1024 * 1024;
+	const VkDeviceSize minAllocSize = 256;
+	int numDeviceAllocations = 0;
+	// VK_KHR_dedicated_allocation, set up by the instance if the device has
+	// it: bindBuffer and bindImage then give the resources the driver prefers
+	// dedicated their own memory, and name the resource of each dedicated one
+	bool dedicatedAllocation = false;
+	PFN_vkGetBufferMemoryRequirements2KHR pfnGetBufferMemoryRequirements2 = nullptr;
+	PFN_vkGetImageMemoryRequirements2KHR pfnGetImageMemoryRequirements2 = nullptr;
+
+private:
+	struct Block {
+		VkDeviceMemory mem; // null once freed, the slot is reused by the next block
+		uint8_t* mapped;
+		BuddyAllocator buddy;
+	};
+	// Buffers/linear images and optimal images live in separate pools so
+	// bufferImageGranularity never has to be considered
+	struct Pool {
+		uint32_t memType;
+		bool linear;
+		VkDeviceSize blockSize;
+		std::vector<Block> blocks;
+	};
+
+	VkDeviceMemory allocDevice(VkDeviceSize size, uint32_t memType, uint8_t** mapped, const void* pNext = nullptr);
+	// dedicatedInfo names the only resource bound to a dedicated allocation
+	Allocation allocate(const VkMemoryRequirements& reqs, VkMemoryPropertyFlags props, bool linear, bool dedicated,
+		const VkMemoryDedicatedAllocateInfoKHR* dedicatedInfo);
+
+	std::vector<Pool> pools;
+	std::mutex allocMutex;
+};
@@ -0,0 +1,478 @@
+#include "vulkan/pipeline.hpp"
+#include "vulkan/instance.hpp"
+#include "vulkan/shader.hpp"
+#include "util/threadpool.hpp"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+using namespace std;
+
+static void hashCombine(size_t& seed, size_t v)
+{
+	seed ^= v + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+void PipelineState::addVertexAttribute(uint32_t location, VkFormat format, uint32_t offset)
+{
+	VkVertexInputAttributeDescription attr;
+	attr.location = location;
+	attr.binding = 0;
+	attr.format = format;
+	attr.offset = offset;
+	vertexAttributes.push_back(attr);
+}
+
+void PipelineState::setVertexStride(uint32_t stride, uint32_t binding)
+{
+	VkVertexInputBindingDescription desc;
+	desc.binding = binding;
+	desc.stride = stride;
+	desc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	vertexBindings.push_back(desc);
+}
+
+void PipelineState::setVertexInputs()
+{
+	if (!vert)
+		fatalError("setVertexInputs needs a vertex shader");
+	vertexAttributes.clear();
+	vertexBindings.clear();
+	uint32_t offset = 0;
+	for (auto& in : vert->reflection.inputs) {
+		addVertexAttribute(in.location, in.format, offset);
+		offset += in.size;
+	}
+	if (offset > 0)
+		setVertexStride(offset);
+}
+
+size_t PipelineState::hash() const
+{
+	size_t h = 0;
+	// the shader objects themselves, like operator==; entries are evicted
+	// before their shaders or render pass go away
+	hashCombine(h, std::hash<const void*>()(vert));
+	hashCombine(h, std::hash<const void*>()(frag));
+	hashCombine(h, std::hash<const void*>()((const void*)layout));
+	hashCombine(h, std::hash<const void*>()((const void*)renderPass));
+	hashCombine(h, subpass);
+	for (auto& b : vertexBindings) {
+		hashCombine(h, b.binding);
+		hashCombine(h, b.stride);
+		hashCombine(h, b.inputRate);
+	}
+	for (auto& a : vertexAttributes) {
+		hashCombine(h, a.location);
+		hashCombine(h, a.binding);
+		hashCombine(h, a.format);
+		hashCombine(h, a.offset);
+	}
+	hashCombine(h, topology);
+	hashCombine(h, polygonMode);
+	hashCombine(h, cullMode);
+	hashCombine(h, frontFace);
+	hashCombine(h, depthTest);
+	hashCombine(h, depthWrite);
+	hashCombine(h, depthCompare);
+	hashCombine(h, blend);
+	hashCombine(h, colorAttachments);
+	hashCombine(h, samples);
+	return h;
+}
+
+bool PipelineState::operator==(const PipelineState& o) const
+{
+	if (vertexBindings.size() != o.vertexBindings.size() || vertexAttributes.size() != o.vertexAttributes.size())
+		return false;
+	for (size_t i = 0; i < vertexBindings.size(); i++) {
+		auto& a = vertexBindings[i];
+		auto& b = o.vertexBindings[i];
+		if (a.binding != b.binding || a.stride != b.stride || a.inputRate != b.inputRate)
+			return false;
+	}
+	for (size_t i = 0; i < vertexAttributes.size(); i++) {
+		auto& a = vertexAttributes[i];
+		auto& b = o.vertexAttributes[i];
+		if (a.location != b.location || a.binding != b.binding || a.format != b.format || a.offset != b.offset)
+			return false;
+	}
+	return vert == o.vert && frag == o.frag && layout == o.layout && renderPass == o.renderPass &&
+		subpass == o.subpass && topology == o.topology && polygonMode == o.polygonMode &&
+		cullMode == o.cullMode && frontFace == o.frontFace && depthTest == o.depthTest &&
+		depthWrite == o.depthWrite && depthCompare == o.depthCompare && blend == o.blend &&
+		colorAttachments == o.colorAttachments && samples == o.samples;
+}
+
+PipelineCache::PipelineCache(VulkanInstance& inst, ThreadPool* threads, const string& path, const string& manifestPath) :
+	inst(inst), threads(threads), path(path), manifestPath(manifestPath)
+{
+	vector<char> data;
+	ifstream ifs(path, ios::binary | ios::ate);
+	if (ifs.is_open()) {
+		auto size = ifs.tellg();
+		data.resize((size_t)size);
+		ifs.seekg(0, ios::beg);
+		ifs.read(data.data(), size);
+	}
+	// a cache from another driver or device is discarded, not handed to the driver
+	loadedFromDisk = validateHeader(data);
+
+	VkPipelineCacheCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	info.pNext = nullptr;
+	info.flags = 0;
+	info.initialDataSize = loadedFromDisk ? data.size() : 0;
+	info.pInitialData = loadedFromDisk ? data.data() : nullptr;
+	vkAssert(vkCreatePipelineCache(inst.device, &info, nullptr, &cache), "create pipeline cache");
+}
+
+PipelineCache::~PipelineCache()
+{
+	// background compiles reference this object
+	for (auto& p : pipelines)
+		p.second->future.wait();
+	save();
+	for (auto& p : pipelines)
+		vkDestroyPipeline(inst.device, p.second->ready, nullptr);
+	vkDestroyPipelineCache(inst.device, cache, nullptr);
+}
+
+bool PipelineCache::validateHeader(const vector<char>& data)
+{
+	VkPipelineCacheHeaderVersionOne header;
+	if (data.size() < sizeof(header))
+		return false;
+	memcpy(&header, data.data(), sizeof(header));
+
+	const auto& props = inst.gpu->gpuProps;
+	return header.headerSize >= sizeof(header) &&
+		header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+		header.vendorID == props.vendorID &&
+		header.deviceID == props.deviceID &&
+		memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void PipelineCache::save()
+{
+	size_t size;
+	vkAssert(vkGetPipelineCacheData(inst.device, cache, &size, nullptr), "get pipeline cache");
+	vector<char> data(size);
+	vkAssert(vkGetPipelineCacheData(inst.device, cache, &size, data.data()), "get pipeline cache");
+
+	// write to a temporary first so a crash never leaves a truncated cache
+	string tmpPath = path + ".tmp";
+	{
+		ofstream ofs(tmpPath, ios::binary | ios::trunc);
+		if (!ofs.is_open())
+			return;
+		ofs.write(data.data(), size);
+	}
+	remove(path.c_str());
+	rename(tmpPath.c_str(), path.c_str());
+
+	saveManifest();
+}
+
+PipelineHandle PipelineCache::lookup(const PipelineState& state, bool async)
+{
+	PipelineHandle entry;
+	shared_ptr<promise<VkPipeline>> result;
+	{
+		lock_guard<std::mutex> lock(mutex);
+		auto it = pipelines.find(state);
+		if (it != pipelines.end())
+			return it->second;
+
+		entry = make_shared<PipelineEntry>();
+		result = make_shared<promise<VkPipeline>>();
+		entry->future = result->get_future().share();
+		pipelines[state] = entry;
+		// recorded now, while the shaders are known to be alive
+		if (state.vert)
+			manifest.insert(manifestLine(state));
+	}
+
+	// compile outside the lock; the driver cache is internally synchronized
+	auto compile = [this, state, entry, result] {
+		VkPipeline pipeline = create(state);
+		entry->ready = pipeline;
+		result->set_value(pipeline);
+	};
+	if (async && threads)
+		threads->enqueue(compile);
+	else
+		compile();
+	return entry;
+}
+
+VkPipeline PipelineCache::get(const PipelineState& state)
+{
+	return lookup(state, false)->wait();
+}
+
+PipelineHandle PipelineCache::getAsync(const PipelineState& state)
+{
+	return lookup(state, true);
+}
+
+void PipelineCache::evict(VkRenderPass renderPass)
+{
+	evictIf([renderPass](const PipelineState& s) { return s.renderPass == renderPass; });
+}
+
+void PipelineCache::evict(const Shader* shader)
+{
+	evictIf([shader](const PipelineState& s) { return s.vert == shader || s.frag == shader; });
+}
+
+void PipelineCache::evictIf(const function<bool(const PipelineState&)>& match)
+{
+	vector<PipelineHandle> evicted;
+	{
+		lock_guard<std::mutex> lock(mutex);
+		for (auto it = pipelines.begin(); it != pipelines.end();) {
+			if (match(it->first)) {
+				evicted.push_back(it->second);
+				it = pipelines.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+	VkDevice device = inst.device;
+	for (auto& entry : evicted) {
+		// a background compile still reads the render pass and shaders
+		VkPipeline pipeline = entry->wait();
+		inst.defer([device, pipeline] { vkDestroyPipeline(device, pipeline, nullptr); });
+	}
+}
+
+// Manifest format, one pipeline per line:
+// vert frag subpass topology polygonMode cullMode frontFace depthTest depthWrite depthCompare
+// blend colorAttachments samples numBindings {binding stride rate} numAttributes {location binding format offset}
+string PipelineCache::manifestLine(const PipelineState& s)
+{
+	ostringstream os;
+	os << s.vert->name << " " << (s.frag ? s.frag->name : "-") << " " << s.subpass << " "
+		<< s.topology << " " << s.polygonMode << " " << s.cullMode << " " << s.frontFace << " "
+		<< s.depthTest << " " << s.depthWrite << " " << s.depthCompare << " "
+		<< s.blend << " " << s.colorAttachments << " " << s.samples << " " << s.vertexBindings.size();
+	for (auto& b : s.vertexBindings)
+		os << " " << b.binding << " " << b.stride << " " << b.inputRate;
+	os << " " << s.vertexAttributes.size();
+	for (auto& a : s.vertexAttributes)
+		os << " " << a.location << " " << a.binding << " " << a.format << " " << a.offset;
+	return os.str();
+}
+
+void PipelineCache::saveManifest()
+{
+	ofstream ofs(manifestPath, ios::trunc);
+	if (!ofs.is_open())
+		return;
+
+	lock_guard<std::mutex> lock(mutex);
+	for (auto& line : manifest)
+		ofs << line << "\n";
+}
+
+int PipelineCache::prewarm(const Resolver& resolve)
+{
+	ifstream ifs(manifestPath);
+	if (!ifs.is_open())
+		return 0;
+
+	int queued = 0;
+	string line;
+	while (getline(ifs, line)) {
+		istringstream is(line);
+		string vert, frag;
+		int topology, polygonMode, cullMode, frontFace, depthTest, depthWrite, depthCompare, blend, samples;
+		size_t numBindings, numAttributes;
+		PipelineState state;
+		is >> vert >> frag >> state.subpass >> topology >> polygonMode >> cullMode >> frontFace
+			>> depthTest >> depthWrite >> depthCompare >> blend >> state.colorAttachments >> samples >> numBindings;
+		for (size_t i = 0; i < numBindings && is; i++) {
+			VkVertexInputBindingDescription b;
+			int rate;
+			is >> b.binding >> b.stride >> rate;
+			b.inputRate = (VkVertexInputRate)rate;
+			state.vertexBindings.push_back(b);
+		}
+		is >> numAttributes;
+		for (size_t i = 0; i < numAttributes && is; i++) {
+			VkVertexInputAttributeDescription a;
+			int format;
+			is >> a.location >> a.binding >> format >> a.offset;
+			a.format = (VkFormat)format;
+			state.vertexAttributes.push_back(a);
+		}
+		if (!is)
+			continue;
+		state.topology = (VkPrimitiveTopology)topology;
+		state.polygonMode = (VkPolygonMode)polygonMode;
+		state.cullMode = (VkCullModeFlags)cullMode;
+		state.frontFace = (VkFrontFace)frontFace;
+		state.depthTest = depthTest != 0;
+		state.depthWrite = depthWrite != 0;
+		state.depthCompare = (VkCompareOp)depthCompare;
+		state.blend = blend != 0;
+		state.samples = (VkSampleCountFlagBits)samples;
+
+		if (!resolve(vert, frag == "-" ? "" : frag, state))
+			continue;
+		getAsync(state);
+		queued++;
+	}
+	return queued;
+}
+
+VkPipeline PipelineCache::create(const PipelineState& state)
+{
+	vector<VkPipelineShaderStageCreateInfo> stages;
+	VkPipelineShaderStageCreateInfo stage = {};
+	stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stage.pNext = nullptr;
+	stage.flags = 0;
+	stage.pName = "main";
+	stage.pSpecializationInfo = nullptr;
+	if (state.vert) {
+		stage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+		stage.module = state.vert->module;
+		stages.push_back(stage);
+	}
+	if (state.frag) {
+		stage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		stage.module = state.frag->module;
+		stages.push_back(stage);
+	}
+
+	VkPipelineVertexInputStateCreateInfo vertexInput = {};
+	vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInput.pNext = nullptr;
+	vertexInput.flags = 0;
+	vertexInput.vertexBindingDescriptionCount = (uint32_t)state.vertexBindings.size();
+	vertexInput.pVertexBindingDescriptions = state.vertexBindings.empty() ? nullptr : state.vertexBindings.data();
+	vertexInput.vertexAttributeDescriptionCount = (uint32_t)state.vertexAttributes.size();
+	vertexInput.pVertexAttributeDescriptions = state.vertexAttributes.empty() ? nullptr : state.vertexAttributes.data();
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.pNext = nullptr;
+	inputAssembly.flags = 0;
+	inputAssembly.topology = state.topology;
+	inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+	VkPipelineViewportStateCreateInfo viewport = {};
+	viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewport.pNext = nullptr;
+	viewport.flags = 0;
+	viewport.viewportCount = 1;
+	viewport.pViewports = nullptr;
+	viewport.scissorCount = 1;
+	viewport.pScissors = nullptr;
+
+	VkPipelineRasterizationStateCreateInfo raster = {};
+	raster.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	raster.pNext = nullptr;
+	raster.flags = 0;
+	raster.depthClampEnable = VK_FALSE;
+	// depth-only pipelines have no fragment shader, but still rasterize
+	raster.rasterizerDiscardEnable = VK_FALSE;
+	raster.polygonMode = state.polygonMode;
+	raster.cullMode = state.cullMode;
+	raster.frontFace = state.frontFace;
+	raster.depthBiasEnable = VK_FALSE;
+	raster.depthBiasConstantFactor = 0;
+	raster.depthBiasClamp = 0;
+	raster.depthBiasSlopeFactor = 0;
+	raster.lineWidth = 1.0f;
+
+	VkPipelineMultisampleStateCreateInfo multisample = {};
+	multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisample.pNext = nullptr;
+	multisample.flags = 0;
+	multisample.rasterizationSamples = state.samples;
+	multisample.sampleShadingEnable = VK_FALSE;
+	multisample.minSampleShading = 0;
+	multisample.pSampleMask = nullptr;
+	multisample.alphaToCoverageEnable = VK_FALSE;
+	multisample.alphaToOneEnable = VK_FALSE;
+
+	VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+	depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencil.pNext = nullptr;
+	depthStencil.flags = 0;
+	depthStencil.depthTestEnable = state.depthTest;
+	depthStencil.depthWriteEnable = state.depthWrite;
+	depthStencil.depthCompareOp = state.depthCompare;
+	depthStencil.depthBoundsTestEnable = VK_FALSE;
+	depthStencil.stencilTestEnable = VK_FALSE;
+	depthStencil.back.failOp = VK_STENCIL_OP_KEEP;
+	depthStencil.back.passOp = VK_STENCIL_OP_KEEP;
+	depthStencil.back.depthFailOp = VK_STENCIL_OP_KEEP;
+	depthStencil.back.compareOp = VK_COMPARE_OP_ALWAYS;
+	depthStencil.back.compareMask = 0;
+	depthStencil.back.writeMask = 0;
+	depthStencil.back.reference = 0;
+	depthStencil.front = depthStencil.back;
+	depthStencil.minDepthBounds = 0;
+	depthStencil.maxDepthBounds = 1;
+
+	VkPipelineColorBlendAttachmentState blendAttachment = {};
+	blendAttachment.blendEnable = state.blend;
+	blendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+	blendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	blendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+	blendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	blendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+	blendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+	blendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+		VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	vector<VkPipelineColorBlendAttachmentState> blendAttachments(state.colorAttachments, blendAttachment);
+
+	VkPipelineColorBlendStateCreateInfo colorBlend = {};
+	colorBlend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlend.pNext = nullptr;
+	colorBlend.flags = 0;
+	colorBlend.logicOpEnable = VK_FALSE;
+	colorBlend.logicOp = VK_LOGIC_OP_NO_OP;
+	colorBlend.attachmentCount = (uint32_t)blendAttachments.size();
+	colorBlend.pAttachments = blendAttachments.empty() ? nullptr : blendAttachments.data();
+	for (int i = 0; i < 4; i++)
+		colorBlend.blendConstants[i] = 1.0f;
+
+	VkDynamicState dynamicStates[2] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	VkPipelineDynamicStateCreateInfo dynamic = {};
+	dynamic.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamic.pNext = nullptr;
+	dynamic.flags = 0;
+	dynamic.dynamicStateCount = 2;
+	dynamic.pDynamicStates = dynamicStates;
+
+	VkGraphicsPipelineCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	info.pNext = nullptr;
+	info.flags = 0;
+	info.stageCount = (uint32_t)stages.size();
+	info.pStages = stages.data();
+	info.pVertexInputState = &vertexInput;
+	info.pInputAssemblyState = &inputAssembly;
+	info.pTessellationState = nullptr;
+	info.pViewportState = &viewport;
+	info.pRasterizationState = &raster;
+	info.pMultisampleState = &multisample;
+	info.pDepthStencilState = &depthStencil;
+	info.pColorBlendState = &colorBlend;
+	info.pDynamicState = &dynamic;
+	info.layout = state.layout;
+	info.renderPass = state.renderPass;
+	info.subpass = state.subpass;
+	info.basePipelineHandle = VK_NULL_HANDLE;
+	info.basePipelineIndex = -1;
+
+	VkPipeline pipeline;
+	vkAssert(vkCreateGraphicsPipelines(inst.device, cache, 1, &info, nullptr, &pipeline), "create pipeline");
+	return pipeline;
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <set>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <future>
+#include <functional>
+#include "vulkan/vkmain.hpp"
+#include "vulkan/vertexformat.hpp"
+
+class VulkanInstance;
+class Shader;
+class ThreadPool;
+
+// Everything that goes into a graphics pipeline. Viewport and scissor are
+// always dynamic state, see VulkanInstance::setViewport.
+struct PipelineState
+{
+	const Shader* vert = nullptr;
+	const Shader* frag = nullptr;
+	VkPipelineLayout layout = VK_NULL_HANDLE;
+	VkRenderPass renderPass = VK_NULL_HANDLE;
+	uint32_t subpass = 0;
+
+	std::vector<VkVertexInputBindingDescription> vertexBindings;
+	std::vector<VkVertexInputAttributeDescription> vertexAttributes;
+
+	VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+	VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+	VkFrontFace frontFace = VK_FRONT_FACE_CLOCKWISE;
+	bool depthTest = true;
+	bool depthWrite = true;
+	VkCompareOp depthCompare = VK_COMPARE_OP_LESS_OR_EQUAL;
+	bool blend = false;
+	uint32_t colorAttachments = 1;
+	VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+
+	// Single interleaved vertex stream at binding 0
+	void addVertexAttribute(uint32_t location, VkFormat format, uint32_t offset);
+	void setVertexStride(uint32_t stride, uint32_t binding = 0);
+	// Attributes and stride from the reflected inputs of vert, assuming they
+	// are tightly packed in location order
+	void setVertexInputs();
+	// Binding and attributes of vertex type T, see VertexLayout. Call once
+	// per stream for split streams.
+	template<class T> void addVertexLayout(uint32_t binding = 0, VkVertexInputRate rate = VK_VERTEX_INPUT_RATE_VERTEX)
+	{
+		static_assert(VertexLayout<T>::valid(), "vertex attributes overlap the vertex end, are misaligned or share a location");
+		vertexBindings.push_back(VertexLayout<T>::binding(binding, rate));
+		// generated at compile time, only the binding is patched in
+		constexpr typename VertexLayout<T>::Attributes attrs = VertexLayout<T>::attributes();
+		for (auto attr : attrs) {
+			attr.binding = binding;
+			vertexAttributes.push_back(attr);
+		}
+	}
+
+	size_t hash() const;
+	bool operator==(const PipelineState& o) const;
+};
+
+struct PipelineStateHash
+{
+	size_t operator()(const PipelineState& s) const { return s.hash(); }
+};
+
+// A pipeline that may still be compiling on a worker thread
+struct PipelineEntry
+{
+	// Non-blocking: the pipeline, or VK_NULL_HANDLE while it is compiling
+	VkPipeline get() const { return ready.load(); }
+	// Block until compiled
+	VkPipeline wait() const { return future.get(); }
+
+	std::atomic<VkPipeline> ready { VK_NULL_HANDLE };
+	std::shared_future<VkPipeline> future;
+};
+typedef std::shared_ptr<PipelineEntry> PipelineHandle;
+
+// Creates graphics pipelines, deduplicated by state. Backed by a
+// VkPipelineCache that is loaded from and saved to disk, so a warm start
+// skips shader compilation in the driver.
+// With a thread pool, pipelines can also be compiled in the background:
+// getAsync() returns at once and the renderer skips draws (or uses a
+// fallback) until the handle is ready. Every pipeline created is recorded in
+// a manifest, which prewarm() replays in parallel on the next start.
+class PipelineCache
+{
+public:
+	// Maps the shader names of a manifest entry to shaders, layout and render
+	// pass; returns false to skip the entry
+	typedef std::function<bool(const std::string& vert, const std::string& frag, PipelineState& state)> Resolver;
+
+	PipelineCache(VulkanInstance& inst, ThreadPool* threads = nullptr,
+		const std::string& path = "pipeline.cache", const std::string& manifestPath = "pipeline.manifest");
+	~PipelineCache();
+
+	VkPipeline get(const PipelineState& state);
+	PipelineHandle getAsync(const PipelineState& state);
+	// Queue compilation of every manifest entry, returns the number queued
+	int prewarm(const Resolver& resolve);
+	// Forget the pipelines built for renderPass or with shader, before it is
+	// destroyed. Waits for their compiles, the pipelines themselves are
+	// destroyed once the frames using them retired. Handles to them dangle.
+	void evict(VkRenderPass renderPass);
+	void evict(const Shader* shader);
+	void save();
+
+	VulkanInstance& inst;
+	ThreadPool* threads;
+	std::string path, manifestPath;
+	VkPipelineCache cache;
+	bool loadedFromDisk = false;
+
+protected:
+	PipelineHandle lookup(const PipelineState& state, bool async);
+	VkPipeline create(const PipelineState& state);
+	bool validateHeader(const std::vector<char>& data);
+	void saveManifest();
+	static std::string manifestLine(const PipelineState& state);
+	void evictIf(const std::function<bool(const PipelineState&)>& match);
+
+	// Keyed by the shader objects and render pass handles, so entries must be
+	// evicted before those are destroyed and their addresses or handles reused
+	std::unordered_map<PipelineState, PipelineHandle, PipelineStateHash> pipelines;
+	// Every pipeline created this run, evicted ones included
+	std::set<std::string> manifest;
+	std::mutex mutex;
+};
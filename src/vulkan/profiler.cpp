@@ -0,0 +1,217 @@
+#include "vulkan/profiler.hpp"
+#include "vulkan/instance.hpp"
+#include <fstream>
+#include <algorithm>
+using namespace std;
+
+GpuProfiler* GpuProfiler::active = nullptr;
+
+// pipeline statistics queries of the same pool can't nest, so only the
+// outermost scope recorded by a thread gets them
+static thread_local int scopeDepth = 0;
+
+static const VkQueryPipelineStatisticFlags statFlags =
+	VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+static const char* statNames[] = { "inputVertices", "inputPrimitives", "vertexInvocations", "clippingPrimitives", "fragmentInvocations" };
+
+GpuProfiler::GpuProfiler(VulkanInstance& inst, uint32_t maxScopes) :
+	inst(inst), maxScopes(maxScopes)
+{
+	uint32_t validBits = inst.gpu->queueProps[inst.queueFamilyIndex].timestampValidBits;
+	enabled = validBits > 0 && inst.gpu->gpuProps.limits.timestampPeriod > 0;
+	pipelineStats = enabled && inst.enabledFeatures.pipelineStatisticsQuery;
+	timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+	frames.resize(inst.numFrames);
+	if (!enabled)
+		return;
+	for (auto& frame : frames) {
+		VkQueryPoolCreateInfo info = {};
+		info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		info.pNext = nullptr;
+		info.flags = 0;
+		info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		info.queryCount = 2 * maxScopes;
+		info.pipelineStatistics = 0;
+		vkAssert(vkCreateQueryPool(inst.device, &info, nullptr, &frame.timestamps), "create timestamp queries");
+
+		if (pipelineStats) {
+			info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+			info.queryCount = maxScopes;
+			info.pipelineStatistics = statFlags;
+			vkAssert(vkCreateQueryPool(inst.device, &info, nullptr, &frame.stats), "create statistics queries");
+		}
+	}
+	active = this;
+}
+
+GpuProfiler::~GpuProfiler()
+{
+	if (active == this)
+		active = nullptr;
+	for (auto& frame : frames) {
+		vkDestroyQueryPool(inst.device, frame.timestamps, nullptr);
+		vkDestroyQueryPool(inst.device, frame.stats, nullptr);
+	}
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer cmd)
+{
+	if (!enabled)
+		return;
+
+	// this slot's previous frame has retired, its queries are available
+	lock_guard<std::mutex> lock(mutex);
+	cur = &frames[inst.curFrame];
+	if (cur->pending)
+		collect(*cur);
+
+	vkCmdResetQueryPool(cmd, cur->timestamps, 0, 2 * maxScopes);
+	if (pipelineStats)
+		vkCmdResetQueryPool(cmd, cur->stats, 0, maxScopes);
+	cur->scopes.clear();
+	cur->numStats = 0;
+	cur->frameNumber = inst.frameNumber + 1;
+	cur->pending = true;
+}
+
+uint32_t GpuProfiler::beginScope(VkCommandBuffer cmd, const char* name)
+{
+	lock_guard<std::mutex> lock(mutex);
+	if (!cur || cur->scopes.size() >= maxScopes)
+		return ~0u;
+
+	uint32_t idx = (uint32_t)cur->scopes.size();
+	Scope scope;
+	scope.name = name;
+	scope.statsQuery = ~0u;
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, cur->timestamps, 2 * idx);
+	if (pipelineStats && scopeDepth == 0) {
+		scope.statsQuery = cur->numStats++;
+		vkCmdBeginQuery(cmd, cur->stats, scope.statsQuery, 0);
+	}
+	scopeDepth++;
+	cur->scopes.push_back(scope);
+	return idx;
+}
+
+void GpuProfiler::endScope(VkCommandBuffer cmd, uint32_t idx)
+{
+	lock_guard<std::mutex> lock(mutex);
+	if (!cur || idx >= cur->scopes.size())
+		return;
+
+	scopeDepth--;
+	if (cur->scopes[idx].statsQuery != ~0u)
+		vkCmdEndQuery(cmd, cur->stats, cur->scopes[idx].statsQuery);
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, cur->timestamps, 2 * idx + 1);
+}
+
+void GpuProfiler::collect(Frame& frame)
+{
+	frame.pending = false;
+	uint32_t n = (uint32_t)frame.scopes.size();
+	if (n == 0)
+		return;
+
+	// no WAIT_BIT: the frame has retired, and if a result is still missing
+	// the frame is dropped rather than stalling
+	vector<uint64_t> ticks(2 * n);
+	VkResult res = vkGetQueryPoolResults(inst.device, frame.timestamps, 0, 2 * n, ticks.size() * sizeof(uint64_t),
+		ticks.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	if (res != VK_SUCCESS)
+		return;
+	vector<uint64_t> stats(frame.numStats * NumStatistics);
+	if (frame.numStats > 0) {
+		res = vkGetQueryPoolResults(inst.device, frame.stats, 0, frame.numStats, stats.size() * sizeof(uint64_t),
+			stats.data(), NumStatistics * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+		if (res != VK_SUCCESS)
+			return;
+	}
+
+	const double msPerTick = inst.gpu->gpuProps.limits.timestampPeriod / 1e6;
+	uint64_t frameStart = ticks[0] & timestampMask;
+	for (uint32_t i = 0; i < n; i++) {
+		uint64_t t = ticks[2 * i] & timestampMask;
+		if (((t - frameStart) & timestampMask) > (timestampMask >> 1))
+			frameStart = t;
+	}
+	if (history.empty() && avg.empty())
+		firstTimestamp = frameStart;
+
+	FrameResult result;
+	result.frameNumber = frame.frameNumber;
+	result.gpuStartMs = ((frameStart - firstTimestamp) & timestampMask) * msPerTick;
+	double frameMs = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		const Scope& scope = frame.scopes[i];
+		uint64_t begin = ticks[2 * i] & timestampMask, end = ticks[2 * i + 1] & timestampMask;
+
+		ScopeResult s;
+		s.name = scope.name;
+		s.startMs = ((begin - frameStart) & timestampMask) * msPerTick;
+		s.durationMs = ((end - begin) & timestampMask) * msPerTick;
+		s.hasStats = scope.statsQuery != ~0u;
+		for (int k = 0; k < NumStatistics; k++)
+			s.stats[k] = s.hasStats ? stats[scope.statsQuery * NumStatistics + k] : 0;
+
+		Average& a = avg[s.name];
+		double w = a.samples == 0 ? 1.0 : smoothing;
+		a.durationMs += (s.durationMs - a.durationMs) * w;
+		a.lastMs = s.durationMs;
+		if (s.hasStats)
+			for (int k = 0; k < NumStatistics; k++)
+				a.stats[k] += (s.stats[k] - a.stats[k]) * w;
+		a.samples++;
+		frameMs = max(frameMs, s.startMs + s.durationMs);
+		result.scopes.push_back(s);
+	}
+	inst.frameStats.gpuFrame.add(frameMs);
+
+	history.push_back(move(result));
+	while (history.size() > historyFrames)
+		history.pop_front();
+}
+
+static string jsonEscape(const string& s)
+{
+	string res;
+	for (char c : s) {
+		if (c == '"' || c == '\\')
+			res += '\\';
+		if ((unsigned char)c >= 0x20)
+			res += c;
+	}
+	return res;
+}
+
+bool GpuProfiler::writeChromeTrace(const string& path) const
+{
+	ofstream ofs(path, ios::trunc);
+	if (!ofs.is_open())
+		return false;
+
+	ofs << "{\"traceEvents\":[";
+	bool first = true;
+	for (auto& frame : history) {
+		for (auto& s : frame.scopes) {
+			ofs << (first ? "\n" : ",\n");
+			first = false;
+			ofs << "{\"name\":\"" << jsonEscape(s.name) << "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":0,\"tid\":0"
+				<< ",\"ts\":" << (frame.gpuStartMs + s.startMs) * 1000.0
+				<< ",\"dur\":" << s.durationMs * 1000.0
+				<< ",\"args\":{\"frame\":" << frame.frameNumber;
+			if (s.hasStats)
+				for (int k = 0; k < NumStatistics; k++)
+					ofs << ",\"" << statNames[k] << "\":" << s.stats[k];
+			ofs << "}}";
+		}
+	}
+	ofs << "\n],\"displayTimeUnit\":\"ms\"}\n";
+	return true;
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include "vulkan/vkmain.hpp"
+
+class VulkanInstance;
+
+// Measures GPU time of named scopes with timestamp queries, plus pipeline
+// statistics for outermost scopes when the device supports them. Each frame
+// in flight has its own query pools; results are read back when the frame
+// slot comes around again, after VulkanInstance::beginFrame has waited for
+// it, so reading never stalls.
+// Scopes must be recorded into the frame's primary command buffer.
+// The span of each frame's scopes also goes to VulkanInstance::frameStats.
+class GpuProfiler
+{
+public:
+	enum Statistic { InputVertices, InputPrimitives, VertexInvocations, ClippingPrimitives, FragmentInvocations, NumStatistics };
+
+	struct ScopeResult {
+		std::string name;
+		double startMs, durationMs; // start is relative to the first scope of the frame
+		bool hasStats;
+		uint64_t stats[NumStatistics];
+	};
+	struct FrameResult {
+		uint64_t frameNumber;
+		double gpuStartMs; // relative to the first frame profiled
+		std::vector<ScopeResult> scopes;
+	};
+	struct Average {
+		double durationMs = 0, lastMs = 0;
+		double stats[NumStatistics] = {};
+		uint64_t samples = 0;
+	};
+
+	GpuProfiler(VulkanInstance& inst, uint32_t maxScopes = 256);
+	~GpuProfiler();
+
+	// Call right after VulkanInstance::beginFrame, outside a render pass
+	void beginFrame(VkCommandBuffer cmd);
+	uint32_t beginScope(VkCommandBuffer cmd, const char* name);
+	void endScope(VkCommandBuffer cmd, uint32_t scope);
+
+	// Exponential moving averages over roughly the last 1 / smoothing frames
+	const std::map<std::string, Average>& averages() const { return avg; }
+	// Writes the retained frames in the Chrome trace event format (chrome://tracing)
+	bool writeChromeTrace(const std::string& path) const;
+
+	// Used by GpuScope
+	static GpuProfiler* active;
+
+	VulkanInstance& inst;
+	uint32_t maxScopes;
+	bool enabled, pipelineStats;
+	double smoothing = 0.05;
+	size_t historyFrames = 300;
+
+private:
+	struct Scope {
+		std::string name;
+		uint32_t statsQuery; // ~0 without statistics
+	};
+	struct Frame {
+		VkQueryPool timestamps = VK_NULL_HANDLE, stats = VK_NULL_HANDLE;
+		std::vector<Scope> scopes;
+		uint32_t numStats = 0;
+		uint64_t frameNumber = 0;
+		bool pending = false;
+	};
+
+	void collect(Frame& frame);
+
+	std::vector<Frame> frames;
+	Frame* cur = nullptr;
+	std::mutex mutex;
+	uint64_t timestampMask;
+	uint64_t firstTimestamp = 0;
+	std::map<std::string, Average> avg;
+	std::deque<FrameResult> history;
+};
+
+// RAII scope on the active profiler, a no-op without one:
+//   { GpuScope s(cmd, "shadow"); ... }
+class GpuScope
+{
+public:
+	GpuScope(VkCommandBuffer cmd, const char* name) : cmd(cmd), profiler(GpuProfiler::active)
+	{
+		if (profiler)
+			scope = profiler->beginScope(cmd, name);
+	}
+	~GpuScope()
+	{
+		if (profiler)
+			profiler->endScope(cmd, scope);
+	}
+	GpuScope(const GpuScope&) = delete;
+	GpuScope& operator=(const GpuScope&) = delete;
+
+private:
+	VkCommandBuffer cmd;
+	GpuProfiler* profiler;
+	uint32_t scope = 0;
+};
@@ -0,0 +1,305 @@
+#include "vulkan/readback.hpp"
+#include "vulkan/instance.hpp"
+#include "vulkan/vkutil.hpp"
+#include "util/png.hpp"
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+
+using namespace std;
+
+// Bytes per pixel of the color formats targets are created with, 0 otherwise
+static size_t texelSize(VkFormat format)
+{
+	switch (format) {
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+	case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+		return 4;
+	case VK_FORMAT_R16G16B16A16_UNORM:
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+		return 8;
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+// The pattern with its one integer conversion rewritten to take an unsigned
+// long long, e.g. frame_%05d.png becomes frame_%05lld.png. Empty if there
+// isn't exactly one, or anything else printf would read an argument for.
+static string framePattern(const string& pattern)
+{
+	string out;
+	int conversions = 0;
+	for (size_t i = 0; i < pattern.size(); i++) {
+		out += pattern[i];
+		if (pattern[i] != '%')
+			continue;
+		if (++i < pattern.size() && pattern[i] == '%') {
+			out += '%';
+			continue;
+		}
+		size_t start = i;
+		while (i < pattern.size() && strchr("-+ #0", pattern[i]))
+			i++;
+		while (i < pattern.size() && isdigit((unsigned char)pattern[i]))
+			i++;
+		if (i < pattern.size() && pattern[i] == '.') {
+			i++;
+			while (i < pattern.size() && isdigit((unsigned char)pattern[i]))
+				i++;
+		}
+		out.append(pattern, start, i - start);
+		while (i < pattern.size() && strchr("hljzt", pattern[i]))
+			i++;
+		if (i >= pattern.size() || !strchr("diouxX", pattern[i]))
+			return string();
+		out += "ll";
+		out += pattern[i];
+		conversions++;
+	}
+	return conversions == 1 ? out : string();
+}
+
+FrameReadback::FrameReadback(VulkanInstance& inst, int numSlots) :
+	inst(inst)
+{
+	slots.resize(numSlots > 0 ? numSlots : inst.numFrames + 1);
+}
+
+FrameReadback::~FrameReadback()
+{
+	{
+		lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	cv.notify_all();
+	if (encoder.joinable())
+		encoder.join();
+	for (auto& slot : slots)
+		if (slot.buffer)
+			inst.retire(move(slot.buffer));
+}
+
+bool FrameReadback::capture(VkCommandBuffer cmd, VkImage image, uint32_t width, uint32_t height, VkFormat format, VkImageLayout layout)
+{
+	size_t texel = texelSize(format);
+	if (texel == 0)
+		fatalError("Can't read back this image format");
+
+	// the next free slot in ring order, delivery order is kept by pending
+	int idx = -1;
+	{
+		lock_guard<std::mutex> lock(mutex);
+		for (int i = 0; i < (int)slots.size() && idx < 0; i++) {
+			int s = (next + i) % (int)slots.size();
+			if (slots[s].state == Free)
+				idx = s;
+		}
+		if (idx < 0) {
+			stats.dropped++;
+			return false;
+		}
+		slots[idx].state = InFlight;
+		stats.captured++;
+	}
+	next = (idx + 1) % (int)slots.size();
+
+	// a free slot was delivered, so the GPU is done with its buffer.
+	// Cached memory makes the host reads fast where the device has it.
+	Slot& slot = slots[idx];
+	size_t size = (size_t)width * height * texel;
+	if (!slot.buffer || slot.buffer->size < size) {
+		slot.buffer.reset();
+		slot.buffer.reset(new VulkanBuffer(*inst.allocator, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT));
+	}
+	slot.frame = inst.frameNumber + 1;
+	slot.info.frameNumber = slot.frame;
+	slot.info.width = width;
+	slot.info.height = height;
+	slot.info.format = format;
+	slot.info.rowPitch = width * texel;
+	slot.info.pixels = nullptr;
+	pending.push_back(idx);
+
+	// PRESENT_SRC barriers only wait for BOTTOM_OF_PIPE, but the image was
+	// written as a color attachment, which the copy has to come after
+	VkPipelineStageFlags srcStages, dstStages;
+	VkAccessFlags srcAccess, dstAccess;
+	layoutAccess(layout, srcStages, srcAccess);
+	layoutAccess(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dstStages, dstAccess);
+	if (layout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR) {
+		srcStages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		srcAccess = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	}
+	VkImageMemoryBarrier toSrc = {};
+	toSrc.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	toSrc.pNext = nullptr;
+	toSrc.srcAccessMask = srcAccess;
+	toSrc.dstAccessMask = dstAccess;
+	toSrc.oldLayout = layout;
+	toSrc.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	toSrc.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toSrc.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toSrc.image = image;
+	toSrc.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	toSrc.subresourceRange.baseMipLevel = 0;
+	toSrc.subresourceRange.levelCount = 1;
+	toSrc.subresourceRange.baseArrayLayer = 0;
+	toSrc.subresourceRange.layerCount = 1;
+	vkCmdPipelineBarrier(cmd, srcStages, dstStages, 0, 0, nullptr, 0, nullptr, 1, &toSrc);
+
+	VkBufferImageCopy region = {};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { width, height, 1 };
+	vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer->buffer, 1, &region);
+	queueImageLayout(cmd, image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, layout);
+
+	// the fence only orders; the copy has to be made visible to host reads
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = slot.buffer->buffer;
+	barrier.offset = 0;
+	barrier.size = size;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+		0, nullptr, 1, &barrier, 0, nullptr);
+	return true;
+}
+
+bool FrameReadback::capture(VkCommandBuffer cmd)
+{
+	if (!(inst.swapImageUsage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT))
+		fatalError("The surface doesn't allow reading back swapchain images");
+	const BufferView& target = inst.swapImages[inst.curSwap];
+	return capture(cmd, target.image, (uint32_t)inst.width, (uint32_t)inst.height, inst.format,
+		inst.headless ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+}
+
+void FrameReadback::poll()
+{
+	if (pending.empty())
+		return;
+	uint64_t completed = inst.completedFrame();
+	while (!pending.empty() && slots[pending.front()].frame <= completed) {
+		int idx = pending.front();
+		pending.pop_front();
+		Slot& slot = slots[idx];
+		slot.info.pixels = slot.buffer->mem.mapped;
+		if (callback)
+			callback(slot.info);
+
+		lock_guard<std::mutex> lock(mutex);
+		stats.delivered++;
+		if (encoder.joinable()) {
+			slot.state = Writing;
+			encodeQueue.push_back(idx);
+			cv.notify_one();
+		} else {
+			slot.state = Free;
+		}
+	}
+}
+
+void FrameReadback::encodeTo(const string& pattern, Encoding enc)
+{
+	string format = framePattern(pattern);
+	if (format.empty())
+		fatalError("Capture pattern " + pattern + " needs exactly one integer conversion for the frame number, e.g. %05d");
+	{
+		lock_guard<std::mutex> lock(mutex);
+		pathFormat = format;
+		encoding = enc;
+	}
+	if (!encoder.joinable())
+		encoder = thread(&FrameReadback::encodeLoop, this);
+}
+
+void FrameReadback::finish()
+{
+	unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this] { return encodeQueue.empty(); });
+}
+
+FrameReadback::Stats FrameReadback::getStats()
+{
+	lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+void FrameReadback::encodeLoop()
+{
+	unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+		// the queue is drained before stopping
+		cv.wait(lock, [this] { return stop || !encodeQueue.empty(); });
+		if (encodeQueue.empty())
+			return;
+		int idx = encodeQueue.front();
+		lock.unlock();
+		bool ok = encode(slots[idx].info);
+		lock.lock();
+		// popped only now, so finish() also waits for this one
+		encodeQueue.pop_front();
+		slots[idx].state = Free;
+		if (ok)
+			stats.encoded++;
+		else
+			stats.failed++;
+		if (encodeQueue.empty())
+			idle.notify_all();
+	}
+}
+
+bool FrameReadback::encode(const Frame& frame)
+{
+	string format;
+	Encoding enc;
+	{
+		lock_guard<std::mutex> lock(mutex);
+		format = pathFormat;
+		enc = encoding;
+	}
+	char path[1024];
+	snprintf(path, sizeof(path), format.c_str(), (unsigned long long)frame.frameNumber);
+
+	bool bgra = frame.format == VK_FORMAT_B8G8R8A8_UNORM || frame.format == VK_FORMAT_B8G8R8A8_SRGB;
+	bool rgba = frame.format == VK_FORMAT_R8G8B8A8_UNORM || frame.format == VK_FORMAT_R8G8B8A8_SRGB;
+	if (enc == Png && (bgra || rgba)) {
+		// alpha of a swapchain image is meaningless, drop it
+		vector<uint8_t> rgb((size_t)frame.width * frame.height * 3);
+		for (uint32_t y = 0; y < frame.height; y++) {
+			const uint8_t* src = frame.pixels + y * frame.rowPitch;
+			uint8_t* dst = &rgb[(size_t)y * frame.width * 3];
+			for (uint32_t x = 0; x < frame.width; x++) {
+				dst[x * 3 + 0] = src[x * 4 + (bgra ? 2 : 0)];
+				dst[x * 3 + 1] = src[x * 4 + 1];
+				dst[x * 3 + 2] = src[x * 4 + (bgra ? 0 : 2)];
+			}
+		}
+		return writePng(path, rgb.data(), (int)frame.width, (int)frame.height, 3, (size_t)frame.width * 3);
+	}
+
+	ofstream ofs(path, ios::binary | ios::trunc);
+	if (!ofs.is_open())
+		return false;
+	ofs.write((const char*)frame.pixels, frame.rowPitch * frame.height);
+	return ofs.good();
+}
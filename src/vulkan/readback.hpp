@@ -0,0 +1,105 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include "vulkan/vkmain.hpp"
+#include "vulkan/buffer.hpp"
+
+class VulkanInstance;
+
+// Copies rendered frames back to the host without stalling the frame
+// loop, for video output and image diffs. capture() records a copy of the
+// image into one of a ring of host-visible buffers in the frame's command
+// buffer. poll() hands each copy over once its frame has retired, which
+// it checks through VulkanInstance::completedFrame, so the pixels arrive
+// about numFrames frames later and nothing waits on the GPU. When every
+// buffer is still in flight or being encoded, the capture is dropped and
+// counted instead.
+//
+//   FrameReadback readback(inst);
+//   readback.encodeTo("frame_%05d.png", FrameReadback::Png);
+//   // every frame, after the last pass writing the swapchain image
+//   readback.capture(cmd);
+//   inst.endFrame();
+//   readback.poll();
+class FrameReadback
+{
+public:
+	enum Encoding {
+		Raw, // the copied rows as they are, tightly packed in the image's format
+		Png  // RGB, for 8 bit RGBA and BGRA formats, others are written raw
+	};
+	struct Frame {
+		uint64_t frameNumber;
+		uint32_t width, height;
+		VkFormat format;
+		size_t rowPitch;
+		const uint8_t* pixels; // mapped memory, only valid during the callback
+	};
+	typedef std::function<void(const Frame&)> Callback;
+	struct Stats {
+		uint64_t captured = 0, delivered = 0, encoded = 0;
+		// captures without a free buffer, encodes that couldn't be written
+		uint64_t dropped = 0, failed = 0;
+	};
+
+	// numSlots = 0 uses one more than the frames in flight, which keeps up
+	// with one capture per frame as long as the consumer does
+	explicit FrameReadback(VulkanInstance& inst, int numSlots = 0);
+	// Finishes the queued encodes. Buffers still in flight are retired.
+	~FrameReadback();
+	FrameReadback(const FrameReadback&) = delete;
+	FrameReadback& operator=(const FrameReadback&) = delete;
+
+	// Copy a color image that was last used in layout, and leave it in
+	// layout again. False if the capture was dropped.
+	bool capture(VkCommandBuffer cmd, VkImage image, uint32_t width, uint32_t height, VkFormat format, VkImageLayout layout);
+	// The current swapchain image, or offscreen target when headless, in
+	// the layout the render pass leaves it in
+	bool capture(VkCommandBuffer cmd);
+	// From the frame's thread: deliver the copies whose frame completed,
+	// oldest first, to callback and to the encoder
+	void poll();
+	// Start a worker thread writing each delivered frame to a file.
+	// pattern is a printf format with one integer conversion for the frame
+	// number, e.g. %05d or %llu, its length modifier is ignored. Others are fatal.
+	void encodeTo(const std::string& pattern, Encoding enc);
+	// Block until the encoder has written every delivered frame
+	void finish();
+	Stats getStats();
+
+	VulkanInstance& inst;
+	// Called by poll on the frame's thread, before the frame is encoded
+	Callback callback;
+
+private:
+	enum State { Free, InFlight, Writing };
+	struct Slot {
+		std::unique_ptr<VulkanBuffer> buffer;
+		State state = Free;
+		uint64_t frame = 0;
+		Frame info;
+	};
+
+	void encodeLoop();
+	bool encode(const Frame& frame);
+
+	std::vector<Slot> slots;
+	int next = 0;
+	// slots in flight, in capture order
+	std::deque<int> pending;
+	Stats stats;
+
+	std::string pathFormat;
+	Encoding encoding = Raw;
+	std::thread encoder;
+	std::deque<int> encodeQueue;
+	std::mutex mutex;
+	std::condition_variable cv, idle;
+	bool stop = false;
+};
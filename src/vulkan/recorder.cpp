@@ -0,0 +1,105 @@
+#include "vulkan/recorder.hpp"
+#include "vulkan/instance.hpp"
+#include "util/threadpool.hpp"
+#include <algorithm>
+using namespace std;
+
+ParallelRecorder::ParallelRecorder(VulkanInstance& inst, ThreadPool& threads, int numSlices) :
+	inst(inst), threads(threads), numSlices(numSlices > 0 ? numSlices : threads.size())
+{
+	VkCommandPoolCreateInfo cmdPoolInfo = {};
+	cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	cmdPoolInfo.pNext = nullptr;
+	cmdPoolInfo.queueFamilyIndex = inst.queueFamilyIndex;
+	cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	pools.resize(inst.numFrames);
+	for (auto& framePools : pools) {
+		framePools.resize(this->numSlices);
+		for (auto& slice : framePools)
+			vkAssert(vkCreateCommandPool(inst.device, &cmdPoolInfo, nullptr, &slice.pool), "create pool");
+	}
+}
+
+ParallelRecorder::~ParallelRecorder()
+{
+	// destroying a pool frees its command buffers
+	VkDevice device = inst.device;
+	for (auto& framePools : pools)
+		for (auto& slice : framePools) {
+			VkCommandPool pool = slice.pool;
+			inst.defer([device, pool] { vkDestroyCommandPool(device, pool, nullptr); });
+		}
+}
+
+void ParallelRecorder::beginFrame()
+{
+	for (auto& slice : pools[inst.curFrame]) {
+		vkAssert(vkResetCommandPool(inst.device, slice.pool, 0), "reset pool");
+		slice.used = 0;
+	}
+}
+
+VkCommandBuffer ParallelRecorder::nextCommandBuffer(SlicePool& slice)
+{
+	if (slice.used == slice.cmds.size()) {
+		VkCommandBufferAllocateInfo cmdInfo = {};
+		cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		cmdInfo.pNext = nullptr;
+		cmdInfo.commandPool = slice.pool;
+		cmdInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		cmdInfo.commandBufferCount = 1;
+		VkCommandBuffer cmd;
+		vkAssert(vkAllocateCommandBuffers(inst.device, &cmdInfo, &cmd), "create command buffer");
+		slice.cmds.push_back(cmd);
+	}
+	return slice.cmds[slice.used++];
+}
+
+void ParallelRecorder::record(VkCommandBuffer primary, int numItems, const RecordFn& fn,
+	VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer)
+{
+	if (numItems <= 0)
+		return;
+
+	// don't bother spreading tiny lists over all workers
+	int slices = max(1, min(numSlices, (numItems + minItemsPerSlice - 1) / minItemsPerSlice));
+	auto& framePools = pools[inst.curFrame];
+	vector<VkCommandBuffer> cmds(slices);
+
+	threads.parallelFor(slices, [&](int i) {
+		VkCommandBuffer cmd = nextCommandBuffer(framePools[i]);
+
+		VkCommandBufferInheritanceInfo inheritance = {};
+		inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritance.pNext = nullptr;
+		inheritance.renderPass = renderPass;
+		inheritance.subpass = subpass;
+		inheritance.framebuffer = framebuffer;
+		inheritance.occlusionQueryEnable = VK_FALSE;
+		inheritance.queryFlags = 0;
+		inheritance.pipelineStatistics = 0;
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.pNext = nullptr;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		if (renderPass != VK_NULL_HANDLE)
+			beginInfo.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+		beginInfo.pInheritanceInfo = &inheritance;
+		vkAssert(vkBeginCommandBuffer(cmd, &beginInfo), "begin command buffer");
+
+		// dynamic state is not inherited by secondaries
+		if (renderPass != VK_NULL_HANDLE)
+			inst.setViewport(cmd);
+
+		int begin = (int)((int64_t)numItems * i / slices);
+		int end = (int)((int64_t)numItems * (i + 1) / slices);
+		fn(cmd, begin, end);
+
+		vkAssert(vkEndCommandBuffer(cmd), "end command buffer");
+		cmds[i] = cmd;
+	});
+
+	vkCmdExecuteCommands(primary, (uint32_t)cmds.size(), cmds.data());
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <vector>
+#include <functional>
+#include "vulkan/vkmain.hpp"
+
+class VulkanInstance;
+class ThreadPool;
+
+// Records slices of a draw list into secondary command buffers on worker
+// threads and stitches them into the frame's primary with vkCmdExecuteCommands.
+// Every (frame in flight, slice) pair owns its own command pool, so workers
+// never share a pool and pools are reset wholesale once per frame.
+class ParallelRecorder
+{
+public:
+	typedef std::function<void(VkCommandBuffer cmd, int begin, int end)> RecordFn;
+
+	// threads may be shared with other work, record() takes slices itself
+	// instead of waiting for busy workers
+	ParallelRecorder(VulkanInstance& inst, ThreadPool& threads, int numSlices = 0);
+	// The pools are destroyed once the frames using them have retired
+	~ParallelRecorder();
+	ParallelRecorder(const ParallelRecorder&) = delete;
+	ParallelRecorder& operator=(const ParallelRecorder&) = delete;
+
+	// Recycle the command buffers of the current frame in flight; call after
+	// VulkanInstance::beginFrame
+	void beginFrame();
+	// Split [0, numItems) into slices and record them in parallel. Inside a
+	// render pass (begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS)
+	// pass the render pass and subpass; pass VK_NULL_HANDLE outside of one.
+	void record(VkCommandBuffer primary, int numItems, const RecordFn& fn,
+		VkRenderPass renderPass, uint32_t subpass = 0, VkFramebuffer framebuffer = VK_NULL_HANDLE);
+
+	VulkanInstance& inst;
+	ThreadPool& threads;
+	int numSlices;
+	int minItemsPerSlice = 64;
+
+private:
+	struct SlicePool {
+		VkCommandPool pool;
+		std::vector<VkCommandBuffer> cmds;
+		size_t used = 0;
+	};
+	VkCommandBuffer nextCommandBuffer(SlicePool& pool);
+
+	std::vector<std::vector<SlicePool>> pools; // [frame][slice]
+};
@@ -0,0 +1,272 @@
+#include "vulkan/reflect.hpp"
+#include <algorithm>
+using namespace std;
+
+// The subset of the SPIR-V spec needed to recover a shader's interface
+namespace spv {
+	const uint32_t MagicNumber = 0x07230203;
+
+	enum Op {
+		OpEntryPoint = 15, OpExecutionMode = 16, OpTypeInt = 21, OpTypeFloat = 22, OpTypeVector = 23, OpTypeMatrix = 24,
+		OpTypeImage = 25, OpTypeSampler = 26, OpTypeSampledImage = 27, OpTypeArray = 28,
+		OpTypeRuntimeArray = 29, OpTypeStruct = 30, OpTypePointer = 32, OpConstant = 43,
+		OpVariable = 59, OpDecorate = 71, OpMemberDecorate = 72
+	};
+	enum Decoration {
+		Block = 2, BufferBlock = 3, ArrayStride = 6, MatrixStride = 7, BuiltIn = 11,
+		Location = 30, Binding = 33, DescriptorSet = 34, Offset = 35
+	};
+	enum StorageClass { UniformConstant = 0, Input = 1, Uniform = 2, PushConstant = 9, StorageBuffer = 12 };
+	enum ExecutionModel { Vertex = 0, TessControl = 1, TessEval = 2, Geometry = 3, Fragment = 4, GLCompute = 5 };
+	enum Dim { DimBuffer = 5, DimSubpassData = 6 };
+	enum ExecutionMode { LocalSize = 17 };
+}
+
+namespace {
+	const uint32_t none = ~0u;
+
+	struct Member {
+		uint32_t offset = 0;
+		uint32_t matrixStride = 0;
+	};
+
+	struct Id {
+		uint32_t op = 0;
+		vector<uint32_t> args; // operands following the result id
+		uint32_t set = none, binding = none, location = none;
+		uint32_t arrayStride = 0;
+		bool builtIn = false, bufferBlock = false;
+		vector<Member> members;
+	};
+
+	class Parser
+	{
+	public:
+		Parser(const uint32_t* code, size_t numWords) : ids(numWords >= 5 ? code[3] : 0) {}
+
+		Id& id(uint32_t i) { return ids.at(i); }
+		Member& member(uint32_t i, uint32_t m)
+		{
+			auto& members = id(i).members;
+			if (members.size() <= m)
+				members.resize(m + 1);
+			return members[m];
+		}
+
+		uint32_t constant(uint32_t i) { return id(i).op == spv::OpConstant ? id(i).args[1] : 1; }
+
+		uint32_t typeSize(uint32_t i, uint32_t matrixStride = 0)
+		{
+			const Id& t = id(i);
+			switch (t.op) {
+			case spv::OpTypeInt:
+			case spv::OpTypeFloat:
+				return t.args[0] / 8;
+			case spv::OpTypeVector:
+				return t.args[1] * typeSize(t.args[0]);
+			case spv::OpTypeMatrix:
+				return t.args[1] * (matrixStride ? matrixStride : typeSize(t.args[0]));
+			case spv::OpTypeArray:
+				return constant(t.args[1]) * (t.arrayStride ? t.arrayStride : typeSize(t.args[0]));
+			case spv::OpTypeStruct: {
+				uint32_t size = 0;
+				for (uint32_t m = 0; m < t.args.size(); m++) {
+					Member mem = m < t.members.size() ? t.members[m] : Member();
+					size = max(size, mem.offset + typeSize(t.args[m], mem.matrixStride));
+				}
+				return size;
+			}
+			default:
+				return 0;
+			}
+		}
+
+		VkFormat vertexFormat(uint32_t i)
+		{
+			const Id& t = id(i);
+			uint32_t count = 1;
+			const Id* scalar = &t;
+			if (t.op == spv::OpTypeVector) {
+				count = t.args[1];
+				scalar = &id(t.args[0]);
+			}
+			if (scalar->args.empty() || scalar->args[0] != 32 || count < 1 || count > 4)
+				return VK_FORMAT_UNDEFINED;
+
+			static const VkFormat floats[] = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+			static const VkFormat sints[] = { VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+			static const VkFormat uints[] = { VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+			if (scalar->op == spv::OpTypeFloat)
+				return floats[count - 1];
+			if (scalar->op == spv::OpTypeInt)
+				return scalar->args[1] ? sints[count - 1] : uints[count - 1];
+			return VK_FORMAT_UNDEFINED;
+		}
+
+		bool descriptorType(uint32_t storage, uint32_t i, VkDescriptorType& type)
+		{
+			const Id& t = id(i);
+			if (storage == spv::StorageBuffer) {
+				type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				return true;
+			}
+			if (storage == spv::Uniform) {
+				type = t.bufferBlock ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+				return true;
+			}
+			if (storage != spv::UniformConstant)
+				return false;
+
+			switch (t.op) {
+			case spv::OpTypeSampler:
+				type = VK_DESCRIPTOR_TYPE_SAMPLER;
+				return true;
+			case spv::OpTypeSampledImage:
+				type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+				return true;
+			case spv::OpTypeImage: {
+				// args: sampled type, dim, depth, arrayed, ms, sampled (1 = with sampler, 2 = storage), format
+				uint32_t dim = t.args[1], sampled = t.args[5];
+				if (dim == spv::DimSubpassData)
+					type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+				else if (dim == spv::DimBuffer)
+					type = sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+				else
+					type = sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+				return true;
+			}
+			default:
+				return false;
+			}
+		}
+
+		vector<Id> ids;
+	};
+}
+
+ShaderReflection reflectSpirv(const uint32_t* code, size_t numWords)
+{
+	if (numWords < 5 || code[0] != spv::MagicNumber)
+		fatalError("Invalid SPIR-V");
+
+	Parser p(code, numWords);
+	ShaderReflection refl;
+	vector<uint32_t> variables;
+
+	// first pass: record types, constants, decorations and variables by id
+	for (size_t pos = 5; pos < numWords;) {
+		uint32_t op = code[pos] & 0xffff;
+		uint32_t count = code[pos] >> 16;
+		if (count == 0 || pos + count > numWords)
+			fatalError("Truncated SPIR-V");
+		const uint32_t* w = code + pos;
+
+		switch (op) {
+		case spv::OpEntryPoint:
+			switch (w[1]) {
+			case spv::Vertex: refl.stage = VK_SHADER_STAGE_VERTEX_BIT; break;
+			case spv::TessControl: refl.stage = VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT; break;
+			case spv::TessEval: refl.stage = VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT; break;
+			case spv::Geometry: refl.stage = VK_SHADER_STAGE_GEOMETRY_BIT; break;
+			case spv::Fragment: refl.stage = VK_SHADER_STAGE_FRAGMENT_BIT; break;
+			case spv::GLCompute: refl.stage = VK_SHADER_STAGE_COMPUTE_BIT; break;
+			}
+			break;
+		case spv::OpExecutionMode:
+			if (w[2] == spv::LocalSize && count >= 6) {
+				refl.localSize[0] = w[3];
+				refl.localSize[1] = w[4];
+				refl.localSize[2] = w[5];
+			}
+			break;
+		case spv::OpTypeInt: case spv::OpTypeFloat: case spv::OpTypeVector: case spv::OpTypeMatrix:
+		case spv::OpTypeImage: case spv::OpTypeSampler: case spv::OpTypeSampledImage: case spv::OpTypeArray:
+		case spv::OpTypeRuntimeArray: case spv::OpTypeStruct: case spv::OpTypePointer: {
+			Id& id = p.id(w[1]);
+			id.op = op;
+			id.args.assign(w + 2, w + count);
+			break;
+		}
+		case spv::OpConstant:
+		case spv::OpVariable: {
+			// result type first, then result id
+			Id& id = p.id(w[2]);
+			id.op = op;
+			id.args.assign(w + 1, w + count);
+			id.args.erase(id.args.begin() + 1);
+			if (op == spv::OpVariable)
+				variables.push_back(w[2]);
+			break;
+		}
+		case spv::OpDecorate: {
+			Id& id = p.id(w[1]);
+			switch (w[2]) {
+			case spv::BufferBlock: id.bufferBlock = true; break;
+			case spv::ArrayStride: id.arrayStride = w[3]; break;
+			case spv::BuiltIn: id.builtIn = true; break;
+			case spv::Location: id.location = w[3]; break;
+			case spv::Binding: id.binding = w[3]; break;
+			case spv::DescriptorSet: id.set = w[3]; break;
+			}
+			break;
+		}
+		case spv::OpMemberDecorate:
+			if (w[3] == spv::Offset)
+				p.member(w[1], w[2]).offset = w[4];
+			else if (w[3] == spv::MatrixStride)
+				p.member(w[1], w[2]).matrixStride = w[4];
+			else if (w[3] == spv::BuiltIn)
+				p.id(w[1]).builtIn = true;
+			break;
+		}
+		pos += count;
+	}
+
+	// second pass: classify the variables now that all types are known
+	for (uint32_t v : variables) {
+		const Id& var = p.id(v);
+		uint32_t storage = var.args[1];
+		const Id& ptr = p.id(var.args[0]);
+		uint32_t type = ptr.args[1];
+
+		if (storage == spv::PushConstant) {
+			const Id& block = p.id(type);
+			uint32_t offset = none;
+			for (auto& m : block.members)
+				offset = min(offset, m.offset);
+			if (offset == none)
+				offset = 0;
+			refl.pushConstants.stageFlags = refl.stage;
+			refl.pushConstants.offset = offset;
+			refl.pushConstants.size = p.typeSize(type) - offset;
+		} else if (storage == spv::Input) {
+			if (refl.stage != VK_SHADER_STAGE_VERTEX_BIT || var.builtIn || var.location == none || p.id(type).builtIn)
+				continue;
+			VkFormat format = p.vertexFormat(type);
+			if (format == VK_FORMAT_UNDEFINED)
+				fatalError("Unsupported vertex input type");
+			refl.inputs.push_back({ var.location, format, p.typeSize(type) });
+		} else if (var.binding != none) {
+			// arrays of descriptors
+			uint32_t count = 1;
+			if (p.id(type).op == spv::OpTypeArray) {
+				count = p.constant(p.id(type).args[1]);
+				type = p.id(type).args[0];
+			} else if (p.id(type).op == spv::OpTypeRuntimeArray) {
+				type = p.id(type).args[0];
+			}
+			VkDescriptorType descType;
+			if (!p.descriptorType(storage, type, descType))
+				continue;
+			refl.bindings.push_back({ var.set == none ? 0 : var.set, var.binding, descType, count });
+		}
+	}
+
+	sort(refl.inputs.begin(), refl.inputs.end(), [](const ShaderReflection::VertexInput& a, const ShaderReflection::VertexInput& b) {
+		return a.location < b.location;
+	});
+	sort(refl.bindings.begin(), refl.bindings.end(), [](const ShaderReflection::DescriptorBinding& a, const ShaderReflection::DescriptorBinding& b) {
+		return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+	});
+	return refl;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <vector>
+#include "vulkan/vkmain.hpp"
+
+// Interface of a shader module, read from its SPIR-V
+struct ShaderReflection
+{
+	struct DescriptorBinding {
+		uint32_t set;
+		uint32_t binding;
+		VkDescriptorType type;
+		uint32_t count;
+	};
+	struct VertexInput {
+		uint32_t location;
+		VkFormat format;
+		uint32_t size;
+	};
+
+	VkShaderStageFlagBits stage = VK_SHADER_STAGE_VERTEX_BIT;
+	std::vector<DescriptorBinding> bindings;
+	// size 0 when the shader has no push constant block
+	VkPushConstantRange pushConstants = {};
+	// vertex shaders only, sorted by location
+	std::vector<VertexInput> inputs;
+	// compute shaders only, workgroup size
+	uint32_t localSize[3] = { 1, 1, 1 };
+};
+
+ShaderReflection reflectSpirv(const uint32_t* code, size_t numWords);
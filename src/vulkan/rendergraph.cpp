@@ -0,0 +1,712 @@
+#include "vulkan/rendergraph.hpp"
+#include "vulkan/instance.hpp"
+#include "vulkan/vkutil.hpp"
+#include "vulkan/profiler.hpp"
+#include <algorithm>
+using namespace std;
+
+static bool isDepthFormat(VkFormat format)
+{
+	return format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_X8_D24_UNORM_PACK32 ||
+		format == VK_FORMAT_D32_SFLOAT || format == VK_FORMAT_D16_UNORM_S8_UINT ||
+		format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
+
+static VkImageAspectFlags aspectOf(VkFormat format)
+{
+	if (format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT ||
+		format == VK_FORMAT_D32_SFLOAT_S8_UINT)
+		return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+	return isDepthFormat(format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+}
+
+static bool isAttachment(RenderGraph::Usage usage)
+{
+	return usage == RenderGraph::ColorAttachment || usage == RenderGraph::DepthAttachment ||
+		usage == RenderGraph::InputAttachment;
+}
+
+RenderGraph::Pass& RenderGraph::Pass::read(int resource, Usage usage)
+{
+	uses.push_back({ resource, usage, false });
+	return *this;
+}
+
+RenderGraph::Pass& RenderGraph::Pass::write(int resource, Usage usage)
+{
+	if (usage == InputAttachment || usage == VertexBuffer || usage == IndexBuffer || usage == IndirectBuffer)
+		fatalError("Pass " + name + " writes a read-only usage");
+	uses.push_back({ resource, usage, true });
+	return *this;
+}
+
+RenderGraph::Pass& RenderGraph::Pass::clear(int resource, VkClearValue value)
+{
+	clears[resource] = value;
+	return *this;
+}
+
+RenderGraph::RenderGraph(VulkanInstance& inst) :
+	inst(inst)
+{
+}
+
+RenderGraph::~RenderGraph()
+{
+	destroy();
+}
+
+int RenderGraph::importImage(const string& name, VkImage image, VkImageView view, VkFormat format,
+	uint32_t width, uint32_t height, VkImageLayout initialLayout, VkImageLayout finalLayout,
+	VkPipelineStageFlags initialStages, VkAccessFlags initialAccess)
+{
+	Resource res;
+	res.name = name;
+	res.image = true;
+	res.imported = true;
+	res.img = image;
+	res.view = view;
+	res.format = format;
+	res.aspect = aspectOf(format);
+	res.width = width;
+	res.height = height;
+	res.initialLayout = initialLayout;
+	res.finalLayout = finalLayout;
+	res.initialStages = initialStages;
+	res.initialAccess = initialAccess;
+	resources.push_back(res);
+	return (int)resources.size() - 1;
+}
+
+int RenderGraph::importBuffer(const string& name, VkBuffer buffer, VkPipelineStageFlags initialStages, VkAccessFlags initialAccess)
+{
+	Resource res;
+	res.name = name;
+	res.image = false;
+	res.imported = true;
+	res.buffer = buffer;
+	res.initialStages = initialStages;
+	res.initialAccess = initialAccess;
+	resources.push_back(res);
+	return (int)resources.size() - 1;
+}
+
+int RenderGraph::createImage(const string& name, VkFormat format, uint32_t width, uint32_t height)
+{
+	Resource res;
+	res.name = name;
+	res.image = true;
+	res.imported = false;
+	res.format = format;
+	res.aspect = aspectOf(format);
+	res.instanceSized = !width && !height;
+	res.width = width ? width : inst.width;
+	res.height = height ? height : inst.height;
+	resources.push_back(res);
+	return (int)resources.size() - 1;
+}
+
+void RenderGraph::setImage(int resource, VkImage image, VkImageView view)
+{
+	resources[resource].img = image;
+	resources[resource].view = view;
+}
+
+void RenderGraph::resize(int resource, uint32_t width, uint32_t height)
+{
+	resources[resource].width = width;
+	resources[resource].height = height;
+	resources[resource].instanceSized = false;
+}
+
+RenderGraph::Pass& RenderGraph::addPass(const string& name, function<void(VkCommandBuffer)> record)
+{
+	passes.emplace_back();
+	passes.back().name = name;
+	passes.back().record = move(record);
+	return passes.back();
+}
+
+void RenderGraph::markOutput(int resource)
+{
+	resources[resource].output = true;
+}
+
+void RenderGraph::mergeUses(Pass& pass)
+{
+	pass.accesses.clear();
+	for (auto& use : pass.uses) {
+		const Resource& res = resources[use.resource];
+		bool depth = isDepthFormat(res.format);
+		Pass::Access a = { use.resource, use.write, 0, 0, VK_IMAGE_LAYOUT_UNDEFINED, 0 };
+		VkImageUsageFlags& usage = a.usage;
+
+		switch (use.usage) {
+		case ColorAttachment:
+			a.stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			a.access = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | (use.write ? VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT : 0);
+			a.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+			usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+			break;
+		case DepthAttachment:
+			a.stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+			a.access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | (use.write ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT : 0);
+			a.layout = use.write ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+			usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+			break;
+		case InputAttachment:
+			a.stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+			a.access = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+			a.layout = depth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			usage = VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+			break;
+		case VertexShader:
+		case FragmentShader:
+		case ComputeShader:
+			a.stages = use.usage == VertexShader ? VK_PIPELINE_STAGE_VERTEX_SHADER_BIT :
+				use.usage == FragmentShader ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+			a.access = VK_ACCESS_SHADER_READ_BIT | (use.write ? VK_ACCESS_SHADER_WRITE_BIT : 0);
+			if (!res.image)
+				a.access |= VK_ACCESS_UNIFORM_READ_BIT;
+			if (use.write)
+				a.layout = VK_IMAGE_LAYOUT_GENERAL;
+			else
+				a.layout = depth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			usage = use.write ? VK_IMAGE_USAGE_STORAGE_BIT : VK_IMAGE_USAGE_SAMPLED_BIT;
+			break;
+		case VertexBuffer:
+			a.stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+			a.access = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+			break;
+		case IndexBuffer:
+			a.stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+			a.access = VK_ACCESS_INDEX_READ_BIT;
+			break;
+		case IndirectBuffer:
+			a.stages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+			a.access = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+			break;
+		case Transfer:
+			a.stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+			a.access = use.write ? VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_TRANSFER_READ_BIT;
+			a.layout = use.write ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			usage = use.write ? VK_IMAGE_USAGE_TRANSFER_DST_BIT : VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+			break;
+		}
+		bool bufferOnly = use.usage == VertexBuffer || use.usage == IndexBuffer || use.usage == IndirectBuffer;
+		if (res.image ? bufferOnly : isAttachment(use.usage))
+			fatalError("Pass " + pass.name + " uses " + res.name + " as the wrong kind of resource");
+		if (!res.image) {
+			a.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			usage = 0;
+		}
+
+		// a pass sees one state per resource
+		auto it = find_if(pass.accesses.begin(), pass.accesses.end(),
+			[&](const Pass::Access& other) { return other.resource == a.resource; });
+		if (it == pass.accesses.end()) {
+			pass.accesses.push_back(a);
+		} else {
+			if (it->layout != a.layout)
+				fatalError("Pass " + pass.name + " needs " + res.name + " in two layouts");
+			it->write |= a.write;
+			it->stages |= a.stages;
+			it->access |= a.access;
+			it->usage |= a.usage;
+		}
+	}
+}
+
+void RenderGraph::cull()
+{
+	// walk backwards from the outputs, a pass lives if something needs what it writes
+	vector<bool> needed(resources.size());
+	for (size_t i = 0; i < resources.size(); i++)
+		needed[i] = resources[i].imported || resources[i].output;
+
+	numCulled = 0;
+	for (int i = (int)passes.size() - 1; i >= 0; i--) {
+		Pass& pass = passes[i];
+		pass.live = pass.sideEffects;
+		for (auto& a : pass.accesses)
+			if (a.write && needed[a.resource])
+				pass.live = true;
+		if (!pass.live) {
+			numCulled++;
+			continue;
+		}
+		for (auto& a : pass.accesses)
+			needed[a.resource] = true;
+	}
+
+	for (auto& res : resources) {
+		res.firstPass = res.lastPass = -1;
+		if (!res.imported)
+			res.usage = 0;
+	}
+	for (int i = 0; i < (int)passes.size(); i++) {
+		if (!passes[i].live)
+			continue;
+		for (auto& a : passes[i].accesses) {
+			Resource& res = resources[a.resource];
+			if (res.firstPass < 0)
+				res.firstPass = i;
+			res.lastPass = i;
+			// usage of culled passes doesn't count
+			if (!res.imported)
+				res.usage |= a.usage;
+		}
+	}
+}
+
+void RenderGraph::allocateTransients()
+{
+	vector<int> transients;
+	vector<VkMemoryRequirements> reqs(resources.size());
+	for (int i = 0; i < (int)resources.size(); i++) {
+		Resource& res = resources[i];
+		if (res.imported || res.firstPass < 0)
+			continue;
+		// never loaded or stored, tilers can keep it on chip
+		const VkImageUsageFlags attachmentUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+		bool lazy = res.firstPass == res.lastPass && !res.output && !(res.usage & ~attachmentUsage);
+		if (lazy)
+			res.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+
+		VkImageCreateInfo imageInfo = {};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.pNext = nullptr;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = res.format;
+		imageInfo.extent.width = res.width;
+		imageInfo.extent.height = res.height;
+		imageInfo.extent.depth = 1;
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = inst.numSamples;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageInfo.queueFamilyIndexCount = 0;
+		imageInfo.pQueueFamilyIndices = nullptr;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.usage = res.usage;
+		imageInfo.flags = 0;
+		vkAssert(vkCreateImage(inst.device, &imageInfo, nullptr, &res.img), "create transient " + res.name);
+		vkGetImageMemoryRequirements(inst.device, res.img, &reqs[i]);
+		transients.push_back(i);
+	}
+
+	// largest first, each goes into the first slot whose occupants are all
+	// dead before it starts or born after it ends
+	sort(transients.begin(), transients.end(), [&](int a, int b) { return reqs[a].size > reqs[b].size; });
+	transientBytes = aliasedBytes = 0;
+	for (int i : transients) {
+		Resource& res = resources[i];
+		transientBytes += reqs[i].size;
+		bool lazy = (res.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) != 0;
+		for (int s = 0; s < (int)slots.size() && res.slot < 0 && !lazy; s++) {
+			Slot& slot = slots[s];
+			if (slot.lazy || !(slot.reqs.memoryTypeBits & reqs[i].memoryTypeBits))
+				continue;
+			bool overlaps = false;
+			for (int other : slot.resources)
+				overlaps |= res.firstPass <= resources[other].lastPass && resources[other].firstPass <= res.lastPass;
+			if (overlaps)
+				continue;
+			res.slot = s;
+			slot.reqs.size = max(slot.reqs.size, reqs[i].size);
+			slot.reqs.alignment = max(slot.reqs.alignment, reqs[i].alignment);
+			slot.reqs.memoryTypeBits &= reqs[i].memoryTypeBits;
+			slot.resources.push_back(i);
+		}
+		if (res.slot < 0) {
+			Slot slot;
+			slot.lazy = lazy;
+			slot.reqs = reqs[i];
+			slot.resources.push_back(i);
+			slots.push_back(slot);
+			res.slot = (int)slots.size() - 1;
+		}
+	}
+
+	for (auto& slot : slots) {
+		VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		if (slot.lazy)
+			props |= VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+		slot.mem = inst.allocator->alloc(slot.reqs, props, false, true);
+		aliasedBytes += slot.reqs.size;
+		for (int i : slot.resources) {
+			Resource& res = resources[i];
+			vkAssert(vkBindImageMemory(inst.device, res.img, slot.mem.mem, slot.mem.offset), "bind transient " + res.name);
+
+			VkImageViewCreateInfo viewInfo = {};
+			viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			viewInfo.pNext = nullptr;
+			viewInfo.format = res.format;
+			viewInfo.components.r = VK_COMPONENT_SWIZZLE_R;
+			viewInfo.components.g = VK_COMPONENT_SWIZZLE_G;
+			viewInfo.components.b = VK_COMPONENT_SWIZZLE_B;
+			viewInfo.components.a = VK_COMPONENT_SWIZZLE_A;
+			viewInfo.subresourceRange.aspectMask = res.aspect;
+			viewInfo.subresourceRange.baseMipLevel = 0;
+			viewInfo.subresourceRange.levelCount = 1;
+			viewInfo.subresourceRange.baseArrayLayer = 0;
+			viewInfo.subresourceRange.layerCount = 1;
+			viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewInfo.flags = 0;
+			viewInfo.image = res.img;
+			vkAssert(vkCreateImageView(inst.device, &viewInfo, nullptr, &res.view), "create transient view " + res.name);
+		}
+	}
+}
+
+void RenderGraph::createRenderPass(int passIdx)
+{
+	Pass& pass = passes[passIdx];
+	vector<VkAttachmentDescription> descs;
+	vector<VkAttachmentReference> colorRefs, inputRefs;
+	VkAttachmentReference depthRef = {};
+	bool hasDepth = false;
+
+	for (auto& use : pass.uses) {
+		if (!isAttachment(use.usage))
+			continue;
+		if (find(pass.attachments.begin(), pass.attachments.end(), use.resource) != pass.attachments.end())
+			continue;
+		const Resource& res = resources[use.resource];
+		auto access = find_if(pass.accesses.begin(), pass.accesses.end(),
+			[&](const Pass::Access& a) { return a.resource == use.resource; });
+
+		// load only what an earlier pass (or the importer) left behind, store
+		// only what a later pass (or the importer) looks at
+		bool defined = res.imported ? res.initialLayout != VK_IMAGE_LAYOUT_UNDEFINED : res.firstPass < passIdx;
+		bool used = res.imported || res.output || res.lastPass > passIdx;
+		auto clear = pass.clears.find(use.resource);
+
+		VkAttachmentDescription desc = {};
+		desc.format = res.format;
+		desc.samples = inst.numSamples;
+		desc.loadOp = clear != pass.clears.end() ? VK_ATTACHMENT_LOAD_OP_CLEAR :
+			defined ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		desc.storeOp = access->write && used ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		bool stencil = (res.aspect & VK_IMAGE_ASPECT_STENCIL_BIT) != 0;
+		desc.stencilLoadOp = stencil ? desc.loadOp : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		desc.stencilStoreOp = stencil ? desc.storeOp : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		// the graph's barriers do the transitions
+		desc.initialLayout = access->layout;
+		desc.finalLayout = access->layout;
+		desc.flags = 0;
+
+		VkAttachmentReference ref = { (uint32_t)descs.size(), access->layout };
+		if (use.usage == ColorAttachment) {
+			colorRefs.push_back(ref);
+		} else if (use.usage == DepthAttachment) {
+			depthRef = ref;
+			hasDepth = true;
+		} else {
+			inputRefs.push_back(ref);
+		}
+		descs.push_back(desc);
+		pass.attachments.push_back(use.resource);
+		VkClearValue value = {};
+		pass.clearValues.push_back(clear != pass.clears.end() ? clear->second : value);
+		pass.width = res.width;
+		pass.height = res.height;
+	}
+	if (descs.empty())
+		return;
+
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.flags = 0;
+	subpass.inputAttachmentCount = (uint32_t)inputRefs.size();
+	subpass.pInputAttachments = inputRefs.empty() ? nullptr : inputRefs.data();
+	subpass.colorAttachmentCount = (uint32_t)colorRefs.size();
+	subpass.pColorAttachments = colorRefs.empty() ? nullptr : colorRefs.data();
+	subpass.pResolveAttachments = nullptr;
+	subpass.pDepthStencilAttachment = hasDepth ? &depthRef : nullptr;
+	subpass.preserveAttachmentCount = 0;
+	subpass.pPreserveAttachments = nullptr;
+
+	VkRenderPassCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	info.pNext = nullptr;
+	info.attachmentCount = (uint32_t)descs.size();
+	info.pAttachments = descs.data();
+	info.subpassCount = 1;
+	info.pSubpasses = &subpass;
+	info.dependencyCount = 0;
+	info.pDependencies = nullptr;
+	vkAssert(vkCreateRenderPass(inst.device, &info, nullptr, &pass.renderPass), "create render pass " + pass.name);
+}
+
+void RenderGraph::walk(vector<State>& states)
+{
+	for (auto& pass : passes) {
+		pass.barriers = Pass::Barriers();
+		if (!pass.live)
+			continue;
+		Pass::Barriers& b = pass.barriers;
+
+		for (auto& a : pass.accesses) {
+			const Resource& res = resources[a.resource];
+			State& s = states[a.resource];
+			bool transition = res.image && s.layout != a.layout;
+
+			// writes and transitions wait for every earlier access, reads only
+			// for the last write and only if it isn't visible to them yet
+			VkPipelineStageFlags src;
+			bool hazard;
+			if (a.write || transition) {
+				src = s.writeStages | s.readStages;
+				hazard = transition || src != 0;
+			} else {
+				src = s.writeStages;
+				hazard = src && ((a.stages & ~s.readStages) || (a.access & ~s.visibleAccess));
+			}
+
+			if (hazard) {
+				b.srcStages |= src ? src : (VkPipelineStageFlags)VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+				b.dstStages |= a.stages;
+				if (transition) {
+					b.images.push_back({ a.resource, s.layout, a.layout, s.writeAccess, a.access });
+				} else if (s.writeAccess) {
+					b.srcAccess |= s.writeAccess;
+					b.dstAccess |= a.access;
+				}
+			}
+
+			if (a.write || transition) {
+				s.layout = a.layout;
+				s.writeStages = a.stages;
+				s.writeAccess = a.write ? writeAccess(a.access) : 0;
+				s.readStages = a.write ? 0 : a.stages;
+				s.visibleAccess = a.write ? 0 : a.access;
+			} else {
+				s.readStages |= a.stages;
+				s.visibleAccess |= a.access;
+			}
+		}
+	}
+
+	finalBarriers = Pass::Barriers();
+	for (int i = 0; i < (int)resources.size(); i++) {
+		const Resource& res = resources[i];
+		State& s = states[i];
+		if (!res.imported || !res.image || res.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED || res.finalLayout == s.layout)
+			continue;
+		VkPipelineStageFlags dstStages;
+		VkAccessFlags dstAccess;
+		layoutAccess(res.finalLayout, dstStages, dstAccess);
+		VkPipelineStageFlags src = s.writeStages | s.readStages;
+		finalBarriers.srcStages |= src ? src : (VkPipelineStageFlags)VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		finalBarriers.dstStages |= dstStages;
+		finalBarriers.images.push_back({ i, s.layout, res.finalLayout, s.writeAccess, dstAccess });
+		s.layout = res.finalLayout;
+	}
+}
+
+void RenderGraph::compile()
+{
+	destroy();
+	for (auto& res : resources) {
+		if (res.instanceSized) {
+			res.width = inst.width;
+			res.height = inst.height;
+		}
+	}
+	for (auto& pass : passes)
+		mergeUses(pass);
+	cull();
+	allocateTransients();
+	for (int i = 0; i < (int)passes.size(); i++)
+		if (passes[i].live)
+			createRenderPass(i);
+
+	// Imported resources start every frame in their declared state. A
+	// transient's first barrier has to wait for the previous user of its
+	// memory: the alias that died before it in this frame, or the slot's
+	// last user in the previous frame. Those are end states, so walk twice.
+	vector<State> states(resources.size());
+	auto init = [&](const vector<State>& end) {
+		for (int i = 0; i < (int)resources.size(); i++) {
+			const Resource& res = resources[i];
+			State& s = states[i];
+			s = { res.initialLayout, res.initialStages, 0, res.initialAccess, 0 };
+			if (res.imported || res.slot < 0 || end.empty())
+				continue;
+			int prev = -1, last = -1;
+			for (int other : slots[res.slot].resources) {
+				int otherLast = resources[other].lastPass;
+				if (otherLast < res.firstPass && (prev < 0 || otherLast > resources[prev].lastPass))
+					prev = other;
+				if (last < 0 || otherLast > resources[last].lastPass)
+					last = other;
+			}
+			const State& p = end[prev >= 0 ? prev : last];
+			s.writeStages = p.writeStages | p.readStages;
+			s.writeAccess = p.writeAccess;
+		}
+	};
+	init({});
+	walk(states);
+	vector<State> end = states;
+	init(end);
+	walk(states);
+
+	numBarriers = 0;
+	for (auto& pass : passes)
+		numBarriers += pass.barriers.dstStages != 0;
+	numBarriers += finalBarriers.dstStages != 0;
+	compiled = true;
+}
+
+void RenderGraph::issue(VkCommandBuffer cmd, const Pass::Barriers& barriers)
+{
+	if (!barriers.dstStages)
+		return;
+
+	VkMemoryBarrier memBarrier = {};
+	memBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memBarrier.pNext = nullptr;
+	memBarrier.srcAccessMask = barriers.srcAccess;
+	memBarrier.dstAccessMask = barriers.dstAccess;
+	bool memory = barriers.srcAccess != 0;
+
+	VkImageMemoryBarrier imageBarriers[16];
+	vector<VkImageMemoryBarrier> moreBarriers;
+	VkImageMemoryBarrier* images = imageBarriers;
+	if (barriers.images.size() > 16) {
+		moreBarriers.resize(barriers.images.size());
+		images = moreBarriers.data();
+	}
+	for (size_t i = 0; i < barriers.images.size(); i++) {
+		const Pass::ImageBarrier& b = barriers.images[i];
+		const Resource& res = resources[b.resource];
+		VkImageMemoryBarrier& barrier = images[i];
+		barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.pNext = nullptr;
+		barrier.srcAccessMask = b.srcAccess;
+		barrier.dstAccessMask = b.dstAccess;
+		barrier.oldLayout = b.oldLayout;
+		barrier.newLayout = b.newLayout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = res.img;
+		barrier.subresourceRange.aspectMask = res.aspect;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+	}
+	vkCmdPipelineBarrier(cmd, barriers.srcStages, barriers.dstStages, 0, memory ? 1 : 0, memory ? &memBarrier : nullptr,
+		0, nullptr, (uint32_t)barriers.images.size(), images);
+}
+
+void RenderGraph::execute(VkCommandBuffer cmd)
+{
+	if (!compiled)
+		compile();
+
+	for (auto& pass : passes) {
+		if (!pass.live)
+			continue;
+		GpuScope scope(cmd, pass.name.c_str());
+		issue(cmd, pass.barriers);
+
+		if (pass.renderPass) {
+			vector<VkImageView> views;
+			for (int res : pass.attachments)
+				views.push_back(resources[res].view);
+			VkFramebuffer& fb = pass.framebuffers[views];
+			if (!fb) {
+				VkFramebufferCreateInfo info = {};
+				info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+				info.pNext = nullptr;
+				info.renderPass = pass.renderPass;
+				info.attachmentCount = (uint32_t)views.size();
+				info.pAttachments = views.data();
+				info.width = pass.width;
+				info.height = pass.height;
+				info.layers = 1;
+				vkAssert(vkCreateFramebuffer(inst.device, &info, nullptr, &fb), "create framebuffer " + pass.name);
+			}
+
+			VkRenderPassBeginInfo info = {};
+			info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+			info.pNext = nullptr;
+			info.renderPass = pass.renderPass;
+			info.framebuffer = fb;
+			info.renderArea.offset.x = 0;
+			info.renderArea.offset.y = 0;
+			info.renderArea.extent.width = pass.width;
+			info.renderArea.extent.height = pass.height;
+			info.clearValueCount = (uint32_t)pass.clearValues.size();
+			info.pClearValues = pass.clearValues.data();
+			vkCmdBeginRenderPass(cmd, &info, VK_SUBPASS_CONTENTS_INLINE);
+
+			VkViewport viewport = { 0.0f, 0.0f, (float)pass.width, (float)pass.height, 0.0f, 1.0f };
+			vkCmdSetViewport(cmd, 0, 1, &viewport);
+			VkRect2D scissor = { { 0, 0 }, { pass.width, pass.height } };
+			vkCmdSetScissor(cmd, 0, 1, &scissor);
+		}
+
+		if (pass.record)
+			pass.record(cmd);
+		if (pass.renderPass)
+			vkCmdEndRenderPass(cmd);
+	}
+	issue(cmd, finalBarriers);
+}
+
+void RenderGraph::destroy()
+{
+	// the graph may be in flight, its objects go once the current frames retire
+	vector<VkFramebuffer> framebuffers;
+	vector<VkRenderPass> renderPasses;
+	vector<VkImageView> views;
+	vector<VkImage> images;
+	vector<Allocation> mems;
+	for (auto& pass : passes) {
+		for (auto& fb : pass.framebuffers)
+			framebuffers.push_back(fb.second);
+		pass.framebuffers.clear();
+		if (pass.renderPass)
+			renderPasses.push_back(pass.renderPass);
+		pass.renderPass = VK_NULL_HANDLE;
+		pass.attachments.clear();
+		pass.clearValues.clear();
+	}
+	for (auto& res : resources) {
+		res.slot = -1;
+		if (res.imported)
+			continue;
+		if (res.img) {
+			views.push_back(res.view);
+			images.push_back(res.img);
+		}
+		res.view = VK_NULL_HANDLE;
+		res.img = VK_NULL_HANDLE;
+	}
+	for (auto& slot : slots)
+		mems.push_back(slot.mem);
+	slots.clear();
+	compiled = false;
+
+	VkDevice device = inst.device;
+	MemoryAllocator* allocator = inst.allocator.get();
+	inst.defer([=]() {
+		for (auto fb : framebuffers)
+			vkDestroyFramebuffer(device, fb, nullptr);
+		for (auto rp : renderPasses)
+			vkDestroyRenderPass(device, rp, nullptr);
+		for (auto view : views)
+			vkDestroyImageView(device, view, nullptr);
+		for (auto img : images)
+			vkDestroyImage(device, img, nullptr);
+		for (auto mem : mems)
+			allocator->free(mem);
+	});
+}
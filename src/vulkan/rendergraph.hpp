@@ -0,0 +1,184 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <map>
+#include <deque>
+#include <functional>
+#include "vulkan/vkmain.hpp"
+#include "vulkan/memory.hpp"
+
+class VulkanInstance;
+
+// Frame render graph. Passes declare how they read and write images and
+// buffers, compile() then derives everything the passes would otherwise
+// hand-write:
+//  - batched barriers with the exact stages/accesses of both sides, issued
+//    only on real hazards (RAW, WAR, WAW, layout changes)
+//  - passes whose results never reach an output are culled
+//  - transient images whose lifetimes don't overlap share memory, and those
+//    that only live inside one render pass get lazily allocated memory
+//  - a render pass and framebuffers for passes with attachments, with load
+//    and store ops derived from the surrounding passes
+// The graph is built and compiled once and executed every frame; imported
+// resources (e.g. the swapchain image) can be rebound before each execute().
+//
+//   RenderGraph graph(inst);
+//   int color = graph.importImage("swap", ...);
+//   int depth = graph.createImage("depth", inst.depthFormat);
+//   graph.addPass("main", [&](VkCommandBuffer cmd) { ... })
+//       .write(color, RenderGraph::ColorAttachment).clear(color, clearColor)
+//       .write(depth, RenderGraph::DepthAttachment).clear(depth, clearDepth);
+//   graph.compile();
+class RenderGraph
+{
+public:
+	// How a pass uses a resource, combined with read() or write()
+	enum Usage {
+		ColorAttachment,
+		DepthAttachment, // read: depth test without writes
+		InputAttachment, // read only
+		VertexShader,    // images: read sampled / write storage
+		FragmentShader,
+		ComputeShader,
+		VertexBuffer,    // read only
+		IndexBuffer,     // read only
+		IndirectBuffer,  // read only
+		Transfer,        // read: copy source / write: copy destination
+	};
+
+	struct Pass {
+		Pass& read(int resource, Usage usage);
+		Pass& write(int resource, Usage usage);
+		// Clear an attachment at the start of the pass instead of loading it
+		Pass& clear(int resource, VkClearValue value);
+
+		struct Use {
+			int resource;
+			Usage usage;
+			bool write;
+		};
+
+		std::string name;
+		std::function<void(VkCommandBuffer)> record;
+		std::vector<Use> uses;
+		std::map<int, VkClearValue> clears;
+		// Never culled, e.g. writes results to the host
+		bool sideEffects = false;
+
+	private:
+		friend class RenderGraph;
+		// uses of one resource merged
+		struct Access {
+			int resource;
+			bool write;
+			VkPipelineStageFlags stages;
+			VkAccessFlags access;
+			VkImageLayout layout;
+			VkImageUsageFlags usage;
+		};
+		struct ImageBarrier {
+			int resource;
+			VkImageLayout oldLayout, newLayout;
+			VkAccessFlags srcAccess, dstAccess;
+		};
+		struct Barriers {
+			VkPipelineStageFlags srcStages = 0, dstStages = 0;
+			VkAccessFlags srcAccess = 0, dstAccess = 0; // global memory barrier, covers buffers
+			std::vector<ImageBarrier> images;
+		};
+
+		bool live = false;
+		std::vector<Access> accesses;
+		Barriers barriers;
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+		std::vector<int> attachments;
+		std::vector<VkClearValue> clearValues;
+		uint32_t width = 0, height = 0;
+		std::map<std::vector<VkImageView>, VkFramebuffer> framebuffers;
+	};
+
+	RenderGraph(VulkanInstance& inst);
+	~RenderGraph();
+
+	// An image owned elsewhere. It is in initialLayout whenever the graph
+	// starts and is left in finalLayout. initialStages/initialAccess are what
+	// the first barrier has to wait for, e.g. the stage the acquire semaphore
+	// of a swapchain image is waited at. Barriers cover all mip levels.
+	int importImage(const std::string& name, VkImage image, VkImageView view, VkFormat format,
+		uint32_t width, uint32_t height, VkImageLayout initialLayout, VkImageLayout finalLayout,
+		VkPipelineStageFlags initialStages = 0, VkAccessFlags initialAccess = 0);
+	// Buffers written before the graph runs must be visible already, or
+	// described by initialStages/initialAccess
+	int importBuffer(const std::string& name, VkBuffer buffer,
+		VkPipelineStageFlags initialStages = 0, VkAccessFlags initialAccess = 0);
+	// A transient image, created by compile() with the usage its passes need.
+	// Zero extents follow the instance's size, also after the swapchain is
+	// recreated.
+	int createImage(const std::string& name, VkFormat format, uint32_t width = 0, uint32_t height = 0);
+	// Rebind an imported image, e.g. to the current swapchain image
+	void setImage(int resource, VkImage image, VkImageView view);
+	// New extent of an image, takes effect with the next compile()
+	void resize(int resource, uint32_t width, uint32_t height);
+	// The view of an image, transients have one after compile()
+	VkImageView view(int resource) const { return resources[resource].view; }
+
+	Pass& addPass(const std::string& name, std::function<void(VkCommandBuffer)> record);
+	// Keep the passes writing this resource, imported resources are outputs implicitly
+	void markOutput(int resource);
+
+	void compile();
+	void execute(VkCommandBuffer cmd);
+
+	VulkanInstance& inst;
+	std::deque<Pass> passes;
+	// Statistics of the last compile
+	int numCulled = 0, numBarriers = 0;
+	VkDeviceSize transientBytes = 0, aliasedBytes = 0;
+
+private:
+	struct Resource {
+		std::string name;
+		bool image, imported;
+		bool output = false;
+		VkImage img = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		VkImageAspectFlags aspect = 0;
+		uint32_t width = 0, height = 0;
+		bool instanceSized = false;
+		VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED, finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags initialStages = 0;
+		VkAccessFlags initialAccess = 0;
+		// transients
+		VkImageUsageFlags usage = 0;
+		int firstPass = -1, lastPass = -1;
+		int slot = -1;
+	};
+	// Synchronization state of a resource while walking the passes
+	struct State {
+		VkImageLayout layout;
+		VkPipelineStageFlags writeStages, readStages;
+		VkAccessFlags writeAccess, visibleAccess;
+	};
+	// A memory range shared by transients with disjoint lifetimes
+	struct Slot {
+		Allocation mem;
+		bool lazy = false; // transient attachments, not aliased
+		VkMemoryRequirements reqs;
+		std::vector<int> resources;
+	};
+
+	void mergeUses(Pass& pass);
+	void cull();
+	void allocateTransients();
+	void createRenderPass(int passIdx);
+	void walk(std::vector<State>& states);
+	void issue(VkCommandBuffer cmd, const Pass::Barriers& barriers);
+	void destroy();
+
+	std::vector<Resource> resources;
+	std::vector<Slot> slots;
+	Pass::Barriers finalBarriers;
+	bool compiled = false;
+};
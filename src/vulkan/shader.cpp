@@ -1,50 +1,148 @@
 #include "vulkan/shader.hpp"
 #include "vulkan/buffer.hpp"
+#include "util/archive.hpp"
 #include <fstream>
 #include <vector>
 #include <cassert>
+#include <algorithm>
 using namespace std;
 
 Shader::Shader(VkDevice device, const string& name) :
-	name(name)
+	device(device), name(name)
 {
+	// mapped from the archive: reflected and handed to the driver in place
+	if (Archive::active) {
+		if (const ArchiveEntry* entry = Archive::active->find("shader/" + name + ".spv")) {
+			create((const uint32_t*)Archive::active->data(*entry), (size_t)entry->size / sizeof(uint32_t));
+			return;
+		}
+	}
+
 	// read binary blob
 	ifstream ifs("shader/" + name + ".spv", ios::binary | ios::ate);
 	if (!ifs.is_open())
 		fatalError("Can't open shader " + name);
 	auto pos = ifs.tellg();
-	vector<char> buffer(pos);
+	vector<uint32_t> buffer((size_t)pos / sizeof(uint32_t));
 	ifs.seekg(0, ios::beg);
-	ifs.read(buffer.data(), pos);
+	ifs.read(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(uint32_t));
 	ifs.close();
+	create(buffer.data(), buffer.size());
+}
+
+void Shader::create(const uint32_t* code, size_t words)
+{
+	reflection = reflectSpirv(code, words);
 
 	// create shader
 	VkShaderModuleCreateInfo info;
 	info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
 	info.pNext = nullptr;
 	info.flags = 0;
-	info.codeSize = pos;
-	info.pCode = reinterpret_cast<uint32_t*>(buffer.data());
+	info.codeSize = words * sizeof(uint32_t);
+	info.pCode = code;
 	
 	vkAssert(vkCreateShaderModule(device, &info, nullptr, &module), "create shader");
 }
 
-void DescriptorSetLayout::add(int idx, Type type, ShaderType shaderType)
+Shader::~Shader()
+{
+	vkDestroyShaderModule(device, module, nullptr);
+}
+
+Shader::Shader(Shader&& o) :
+	device(o.device), name(move(o.name)), module(o.module), reflection(move(o.reflection))
 {
+	o.module = VK_NULL_HANDLE;
+}
+
+static VkShaderStageFlags stageFlags(DescriptorSetLayout::ShaderType shaderType)
+{
+	VkShaderStageFlags flags = 0;
+	if (shaderType & DescriptorSetLayout::Vertex)
+		flags |= VK_SHADER_STAGE_VERTEX_BIT;
+	if (shaderType & DescriptorSetLayout::Fragment)
+		flags |= VK_SHADER_STAGE_FRAGMENT_BIT;
+	if (shaderType & DescriptorSetLayout::Compute)
+		flags |= VK_SHADER_STAGE_COMPUTE_BIT;
+	return flags;
+}
+
+DescriptorSetLayout::~DescriptorSetLayout()
+{
+	sets.reset();
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, layout, nullptr);
+}
+
+void DescriptorSetLayout::add(int idx, Type type, ShaderType shaderType, uint32_t count)
+{
+	static const VkDescriptorType types[] = {
+		VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_SAMPLER, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT
+	};
 	VkDescriptorSetLayoutBinding info;
 	info.binding = idx;
-	if (type == Type::Sampler)
-		info.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
-	else if (type == Type::UniformBuffer)
-		info.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	info.descriptorCount = 1;
-	info.stageFlags = 0;
-	if (shaderType & ShaderType::Vertex)
-		info.stageFlags |= VK_SHADER_STAGE_VERTEX_BIT;
-	if (shaderType & ShaderType::Fragment)
-		info.stageFlags |= VK_SHADER_STAGE_FRAGMENT_BIT;
+	info.descriptorType = types[type - UniformBuffer];
+	info.descriptorCount = count;
+	info.stageFlags = stageFlags(shaderType);
 	info.pImmutableSamplers = nullptr;
-	bindings.push_back(info);
+	add(info);
+}
+
+void DescriptorSetLayout::add(const VkDescriptorSetLayoutBinding& binding)
+{
+	for (auto& b : bindings) {
+		if (b.binding != binding.binding)
+			continue;
+		if (b.descriptorType != binding.descriptorType || b.descriptorCount != binding.descriptorCount)
+			fatalError("Descriptor binding " + to_string(binding.binding) + " differs between stages");
+		b.stageFlags |= binding.stageFlags;
+		return;
+	}
+	bindings.push_back(binding);
+}
+
+void DescriptorSetLayout::add(const Shader& shader)
+{
+	const ShaderReflection& refl = shader.reflection;
+	for (auto& b : refl.bindings) {
+		if (b.set != 0)
+			fatalError("Shader " + shader.name + " uses descriptor set " + to_string(b.set) + ", only set 0 is supported");
+		VkDescriptorSetLayoutBinding info;
+		info.binding = b.binding;
+		info.descriptorType = b.type;
+		info.descriptorCount = b.count;
+		info.stageFlags = refl.stage;
+		info.pImmutableSamplers = nullptr;
+		add(info);
+	}
+
+	if (refl.pushConstants.size == 0)
+		return;
+	// stages sharing an identical block share one range
+	for (auto& r : pushConstantRanges) {
+		if (r.offset == refl.pushConstants.offset && r.size == refl.pushConstants.size) {
+			r.stageFlags |= refl.stage;
+			return;
+		}
+	}
+	pushConstantRanges.push_back(refl.pushConstants);
+}
+
+void DescriptorSetLayout::addPushConstant(ShaderType shaderType, uint32_t size, uint32_t offset)
+{
+	VkPushConstantRange range;
+	range.stageFlags = stageFlags(shaderType);
+	range.offset = offset;
+	range.size = size;
+	pushConstantRanges.push_back(range);
+}
+
+void DescriptorSetLayout::pushConstants(VkCommandBuffer cmd, ShaderType shaderType, const void* data, uint32_t size, uint32_t offset)
+{
+	vkCmdPushConstants(cmd, pipelineLayout, stageFlags(shaderType), offset, size, data);
 }
 
 void DescriptorSetLayout::create()
@@ -61,68 +159,144 @@ void DescriptorSetLayout::create()
 	VkPipelineLayoutCreateInfo pipelineInfo = {};
 	pipelineInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineInfo.pNext = nullptr;
-	pipelineInfo.pushConstantRangeCount = 0;
-	pipelineInfo.pPushConstantRanges = nullptr;
+	pipelineInfo.pushConstantRangeCount = (uint32_t)pushConstantRanges.size();
+	pipelineInfo.pPushConstantRanges = pushConstantRanges.empty() ? nullptr : pushConstantRanges.data();
 	pipelineInfo.setLayoutCount = 1;
 	pipelineInfo.pSetLayouts = &layout;
 	vkAssert(vkCreatePipelineLayout(device, &pipelineInfo, nullptr, &pipelineLayout), "create pipeline layout");
+}
 
-	// Desc Pool
-	vector<VkDescriptorPoolSize> typeCount(bindings.size());
-	for (int i = 0; i < bindings.size(); i++) {
-		typeCount[i].type = bindings[i].descriptorType;
-		typeCount[i].descriptorCount = 1;
-	}
-	
-	VkDescriptorPoolCreateInfo poolInfo = {};
-	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolInfo.pNext = nullptr;
-	poolInfo.maxSets = 1;
-	poolInfo.poolSizeCount = (uint32_t)typeCount.size();
-	poolInfo.pPoolSizes = typeCount.data();
+unique_ptr<Binding> DescriptorSetLayout::createBinding()
+{
+	if (!sets)
+		sets = make_unique<DescriptorAllocator>(device);
+	return createBinding(sets->allocate(*this));
+}
 
-	vkAssert(vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool), "create desc pool");
+unique_ptr<Binding> DescriptorSetLayout::createBinding(FrameDescriptors& frame)
+{
+	return createBinding(frame.allocate(*this));
 }
 
-unique_ptr<Binding> DescriptorSetLayout::createBinding()
+unique_ptr<Binding> DescriptorSetLayout::createBinding(VkDescriptorSet set)
 {
 	auto bnd = make_unique<Binding>();
-	VkDescriptorSetAllocateInfo info[1];
-	info[0].sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	info[0].pNext = nullptr;
-	info[0].descriptorPool = pool;
-	info[0].descriptorSetCount = 1;
-	info[0].pSetLayouts = &layout;
-	vkAssert(vkAllocateDescriptorSets(device, info, &bnd->set), "alloc desc set");
+	bnd->set = set;
+	bnd->device = device;
+	bnd->pipelineLayout = pipelineLayout;
+	VkShaderStageFlags stages = 0;
+	for (auto& b : bindings)
+		stages |= b.stageFlags;
+	bnd->bindPoint = (stages & VK_SHADER_STAGE_COMPUTE_BIT) ? VK_PIPELINE_BIND_POINT_COMPUTE : VK_PIPELINE_BIND_POINT_GRAPHICS;
 
 	bnd->writes.resize(bindings.size());
 	bnd->bindData.resize(bindings.size());
-	for (int i = 0; i < bindings.size(); i++)
+	for (size_t i = 0; i < bindings.size(); i++)
 	{
 		auto& el = bnd->writes[i];
 		el = {};
 		el.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 		el.pNext = nullptr;
 		el.dstSet = bnd->set;
-		el.descriptorCount = 1;
+		el.descriptorCount = bindings[i].descriptorCount;
 		el.descriptorType = bindings[i].descriptorType;
 		el.dstArrayElement = 0;
-		el.dstBinding = i;
+		el.dstBinding = bindings[i].binding;
+		auto& data = bnd->bindData[i];
+		data.bufferInfos.resize(bindings[i].descriptorCount, VkDescriptorBufferInfo {});
+		data.imageInfos.resize(bindings[i].descriptorCount, VkDescriptorImageInfo {});
 	}
 	return bnd;
 }
 
 void Binding::apply() 
 {
-	vkUpdateDescriptorSets(device, (uint32_t)writes.size(), writes.data(), 0, nullptr);
+	// bindings nothing was set for yet are left alone
+	vector<VkWriteDescriptorSet> used;
+	for (size_t i = 0; i < writes.size(); i++) {
+		if (bindData[i].count == 0)
+			continue;
+		writes[i].descriptorCount = bindData[i].count;
+		used.push_back(writes[i]);
+	}
+	if (!used.empty())
+		vkUpdateDescriptorSets(device, (uint32_t)used.size(), used.data(), 0, nullptr);
 }
 
-void Binding::setBuffer(int idx, const VulkanBuffer& buffer)
+void Binding::setBuffer(int idx, const VulkanBuffer& buffer, uint32_t element)
 {
-	assert(idx < writes.size());
-	
-	bindData[idx].bufferInfo.offset = 0;
-	bindData[idx].bufferInfo.buffer = buffer.buffer;
-	bindData[idx].bufferInfo.range = buffer.size;
-	writes[idx].pBufferInfo = &bindData[idx].bufferInfo;
+	setBuffer(idx, buffer, 0, buffer.size, element);
+}
+
+void Binding::setBuffer(int idx, const VulkanBuffer& buffer, size_t offset, size_t range, uint32_t element)
+{
+	assert(idx >= 0 && (size_t)idx < writes.size());
+	assert(element < bindData[idx].bufferInfos.size());
+
+	auto& info = bindData[idx].bufferInfos[element];
+	info.offset = offset;
+	info.buffer = buffer.buffer;
+	info.range = range;
+	bindData[idx].count = max(bindData[idx].count, element + 1);
+	writes[idx].pBufferInfo = bindData[idx].bufferInfos.data();
+}
+
+void Binding::setImage(int idx, VkImageView view, VkImageLayout layout, VkSampler sampler, uint32_t element)
+{
+	assert(idx >= 0 && (size_t)idx < writes.size());
+	assert(element < bindData[idx].imageInfos.size());
+
+	auto& info = bindData[idx].imageInfos[element];
+	info.imageView = view;
+	info.imageLayout = layout;
+	info.sampler = sampler;
+	bindData[idx].count = max(bindData[idx].count, element + 1);
+	writes[idx].pImageInfo = bindData[idx].imageInfos.data();
+}
+
+void Binding::bind(VkCommandBuffer cmd, initializer_list<uint32_t> dynamicOffsets)
+{
+	vkCmdBindDescriptorSets(cmd, bindPoint, pipelineLayout, 0, 1, &set,
+		(uint32_t)dynamicOffsets.size(), dynamicOffsets.begin());
+}
+
+DescriptorSetLayout* DescriptorLayoutCache::get(initializer_list<const Shader*> shaders, initializer_list<uint32_t> dynamicBindings)
+{
+	auto desc = make_unique<DescriptorSetLayout>(device);
+	for (auto shader : shaders)
+		desc->add(*shader);
+	for (auto& b : desc->bindings) {
+		if (find(dynamicBindings.begin(), dynamicBindings.end(), b.binding) == dynamicBindings.end())
+			continue;
+		if (b.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+			b.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		else if (b.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+			b.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	}
+	sort(desc->bindings.begin(), desc->bindings.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) {
+		return a.binding < b.binding;
+	});
+
+	// key on everything that affects compatibility
+	vector<uint32_t> key;
+	for (auto& b : desc->bindings) {
+		key.push_back(b.binding);
+		key.push_back(b.descriptorType);
+		key.push_back(b.descriptorCount);
+		key.push_back(b.stageFlags);
+	}
+	key.push_back(~0u);
+	for (auto& r : desc->pushConstantRanges) {
+		key.push_back(r.stageFlags);
+		key.push_back(r.offset);
+		key.push_back(r.size);
+	}
+
+	auto it = layouts.find(key);
+	if (it != layouts.end())
+		return it->second.get();
+	desc->create();
+	DescriptorSetLayout* res = desc.get();
+	layouts[key] = move(desc);
+	return res;
 }
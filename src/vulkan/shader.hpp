@@ -2,50 +2,115 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <initializer_list>
+#include <map>
 #include "vulkan/vkmain.hpp"
+#include "vulkan/reflect.hpp"
+#include "vulkan/descriptor.hpp"
 
 class VulkanBuffer;
 
+// Loads shader/<name>.spv from Archive::active, or from a loose file
+// if there is no archive or it lacks the shader
 class Shader 
 { 
 public:
 	Shader(VkDevice device, const std::string& name);
+	~Shader();
+	Shader(Shader&& o);
+	// pipelines are cached by Shader address, swapping the module under one would alias them
+	Shader& operator=(Shader&&) = delete;
+	Shader(const Shader&) = delete;
+	Shader& operator=(const Shader&) = delete;
 
+	VkDevice device;
 	std::string name;
 	VkShaderModule module;
+	ShaderReflection reflection;
+
+private:
+	void create(const uint32_t* code, size_t words);
 };
 
 class Binding 
 {
 public:
-	void setBuffer(int idx, const VulkanBuffer& buffer);
+	// element selects the entry of an arrayed binding
+	void setBuffer(int idx, const VulkanBuffer& buffer, uint32_t element = 0);
+	// For dynamic uniform buffers, range is the size of one block
+	void setBuffer(int idx, const VulkanBuffer& buffer, size_t offset, size_t range, uint32_t element = 0);
+	// Storage images and input attachments; pass a sampler for combined image samplers
+	void setImage(int idx, VkImageView view, VkImageLayout layout, VkSampler sampler = VK_NULL_HANDLE, uint32_t element = 0);
+	// Write the elements set so far, up to the highest one, of each binding
 	void apply();
+	void bind(VkCommandBuffer cmd, std::initializer_list<uint32_t> dynamicOffsets = {});
 
+	// one info per array element of the binding
 	struct BindData {
-		VkDescriptorBufferInfo bufferInfo;
-		VkDescriptorImageInfo imageInfo;
+		std::vector<VkDescriptorBufferInfo> bufferInfos;
+		std::vector<VkDescriptorImageInfo> imageInfos;
+		uint32_t count = 0; // highest element set + 1
 	};
 
 	VkDescriptorSet set;
 	std::vector<VkWriteDescriptorSet> writes;
 	std::vector<BindData> bindData;
 	VkDevice device;
+	VkPipelineLayout pipelineLayout;
+	VkPipelineBindPoint bindPoint;
 };
 
 class DescriptorSetLayout
 {
 public:
-	enum Type { UniformBuffer = 1, Sampler };
-	enum ShaderType { Vertex = 1, Fragment = 2, Both = 3 };
+	enum Type { UniformBuffer = 1, Sampler, UniformBufferDynamic, StorageBuffer, StorageBufferDynamic,
+		CombinedImageSampler, SampledImage, StorageImage, InputAttachment };
+	enum ShaderType { Vertex = 1, Fragment = 2, Both = 3, Compute = 4 };
 	DescriptorSetLayout(VkDevice device) : device(device) {}
+	~DescriptorSetLayout();
 	
-	void add(int idx, Type type, ShaderType shaderType);
+	void add(int idx, Type type, ShaderType shaderType, uint32_t count = 1);
+	// Merge the set 0 bindings and push constants of each shader, stages are or'ed
+	// together for bindings used by several shaders
+	void add(const Shader& shader);
+	// Push constant range for small per-draw data, e.g. the MVP matrix
+	void addPushConstant(ShaderType shaderType, uint32_t size, uint32_t offset = 0);
 	void create();
+	// Long-lived set from the layout's own allocator
 	std::unique_ptr<Binding> createBinding();
+	// Per-draw set, valid until the frame slot is reused
+	std::unique_ptr<Binding> createBinding(FrameDescriptors& frame);
+
+	void pushConstants(VkCommandBuffer cmd, ShaderType shaderType, const void* data, uint32_t size, uint32_t offset = 0);
+	template<class T> void pushConstants(VkCommandBuffer cmd, ShaderType shaderType, const T& data, uint32_t offset = 0)
+	{
+		pushConstants(cmd, shaderType, &data, sizeof(T), offset);
+	}
 
 	VkDevice device;
 	std::vector<VkDescriptorSetLayoutBinding> bindings;
-	VkDescriptorSetLayout layout;
-	VkPipelineLayout pipelineLayout;
-	VkDescriptorPool pool;
+	std::vector<VkPushConstantRange> pushConstantRanges;
+	VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	std::unique_ptr<DescriptorAllocator> sets;
+
+private:
+	void add(const VkDescriptorSetLayoutBinding& binding);
+	std::unique_ptr<Binding> createBinding(VkDescriptorSet set);
+};
+
+// Builds layouts from shader reflection and hands out one instance per
+// distinct layout. Pipelines created from the same layout share its
+// VkPipelineLayout, so descriptor sets stay bound across pipeline switches.
+class DescriptorLayoutCache
+{
+public:
+	DescriptorLayoutCache(VkDevice device) : device(device) {}
+
+	// dynamicBindings lists the uniform/storage buffer bindings to make dynamic
+	DescriptorSetLayout* get(std::initializer_list<const Shader*> shaders, std::initializer_list<uint32_t> dynamicBindings = {});
+
+	VkDevice device;
+private:
+	std::map<std::vector<uint32_t>, std::unique_ptr<DescriptorSetLayout>> layouts;
 };
\ No newline at end of file
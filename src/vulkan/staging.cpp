@@ -0,0 +1,171 @@
+#include "vulkan/staging.hpp"
+#include "vulkan/instance.hpp"
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+static const uint64_t copyAlignment = 16;
+
+StagingRing::StagingRing(VulkanInstance& inst, size_t size) :
+	inst(inst), buffer(*inst.allocator, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
+{
+	VkCommandPoolCreateInfo cmdPoolInfo = {};
+	cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	cmdPoolInfo.pNext = nullptr;
+	cmdPoolInfo.queueFamilyIndex = inst.queueFamilyIndex;
+	cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	vkAssert(vkCreateCommandPool(inst.device, &cmdPoolInfo, nullptr, &cmdPool), "create pool");
+
+	vector<VkCommandBuffer> cmds(numSubmissions);
+	VkCommandBufferAllocateInfo cmdInfo = {};
+	cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmdInfo.pNext = nullptr;
+	cmdInfo.commandPool = cmdPool;
+	cmdInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmdInfo.commandBufferCount = numSubmissions;
+	vkAssert(vkAllocateCommandBuffers(inst.device, &cmdInfo, cmds.data()), "create command buffer");
+
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.pNext = nullptr;
+	fenceInfo.flags = 0;
+	for (int i = 0; i < numSubmissions; i++) {
+		Submission sub;
+		sub.cmd = cmds[i];
+		sub.end = 0;
+		vkAssert(vkCreateFence(inst.device, &fenceInfo, nullptr, &sub.fence), "create fence");
+		submissions.push_back(sub);
+		idle.push_back(i);
+	}
+}
+
+StagingRing::~StagingRing()
+{
+	while (!inFlight.empty())
+		reclaim(true);
+	for (auto& sub : submissions)
+		vkDestroyFence(inst.device, sub.fence, nullptr);
+	vkDestroyCommandPool(inst.device, cmdPool, nullptr);
+}
+
+void StagingRing::reclaim(bool wait)
+{
+	while (!inFlight.empty()) {
+		Submission& sub = submissions[inFlight.front()];
+		if (wait) {
+			vkAssert(vkWaitForFences(inst.device, 1, &sub.fence, VK_TRUE, UINT64_MAX), "wait fence");
+			wait = false;
+		} else if (vkGetFenceStatus(inst.device, sub.fence) != VK_SUCCESS) {
+			break;
+		}
+		tail = sub.end;
+		idle.push_back(inFlight.front());
+		inFlight.pop_front();
+	}
+}
+
+void StagingRing::upload(const VulkanBuffer& dst, size_t dstOffset, const void* data, size_t size)
+{
+	const uint64_t ringSize = buffer.size;
+	const uint8_t* src = static_cast<const uint8_t*>(data);
+
+	// uploads larger than the ring are split into chunks
+	while (size > 0) {
+		uint64_t chunk = min<uint64_t>(size, ringSize / 2);
+		uint64_t start = (head + copyAlignment - 1) & ~(copyAlignment - 1);
+		// never let a chunk straddle the wrap point
+		if (start % ringSize + chunk > ringSize)
+			start += ringSize - start % ringSize;
+
+		reclaim(false);
+		while (start + chunk - tail > ringSize) {
+			if (inFlight.empty())
+				flush();
+			reclaim(true);
+		}
+
+		uint64_t offset = start % ringSize;
+		memcpy(buffer.mem.mapped + offset, src, chunk);
+
+		Copy copy;
+		copy.dst = dst.buffer;
+		copy.region.srcOffset = offset;
+		copy.region.dstOffset = dstOffset;
+		copy.region.size = chunk;
+		pending.push_back(copy);
+
+		head = start + chunk;
+		src += chunk;
+		dstOffset += chunk;
+		size -= chunk;
+	}
+}
+
+void StagingRing::flush()
+{
+	if (pending.empty())
+		return;
+
+	reclaim(false);
+	if (idle.empty())
+		reclaim(true);
+	int idx = idle.front();
+	idle.pop_front();
+	Submission& sub = submissions[idx];
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.pNext = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = nullptr;
+	vkAssert(vkBeginCommandBuffer(sub.cmd, &beginInfo), "begin command buffer");
+
+	// one copy command per destination buffer
+	stable_sort(pending.begin(), pending.end(), [](const Copy& a, const Copy& b) { return a.dst < b.dst; });
+	vector<VkBufferCopy> regions;
+	for (size_t i = 0; i < pending.size(); ) {
+		size_t j = i;
+		regions.clear();
+		for (; j < pending.size() && pending[j].dst == pending[i].dst; j++)
+			regions.push_back(pending[j].region);
+		vkCmdCopyBuffer(sub.cmd, buffer.buffer, pending[i].dst, (uint32_t)regions.size(), regions.data());
+		i = j;
+	}
+	pending.clear();
+
+	// make the copies visible to everything submitted after this on the queue,
+	// including indirect arguments and later copies out of or over the data
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+		VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT |
+		VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(sub.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+	vkAssert(vkEndCommandBuffer(sub.cmd), "end command buffer");
+
+	VkSubmitInfo submit = {};
+	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit.pNext = nullptr;
+	submit.commandBufferCount = 1;
+	submit.pCommandBuffers = &sub.cmd;
+	vkAssert(vkResetFences(inst.device, 1, &sub.fence), "reset fence");
+	{
+		lock_guard<mutex> lock(inst.queueMutex);
+		vkAssert(vkQueueSubmit(inst.queue, 1, &submit, sub.fence), "submit staging");
+	}
+
+	sub.end = head;
+	inFlight.push_back(idx);
+}
+
+void StagingRing::finish()
+{
+	flush();
+	while (!inFlight.empty())
+		reclaim(true);
+}
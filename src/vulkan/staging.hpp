@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include "vulkan/vkmain.hpp"
+#include "vulkan/buffer.hpp"
+
+class VulkanInstance;
+
+// Persistently mapped ring buffer that feeds device-local buffers.
+// Uploads are copied into the ring and batched into one vkCmdCopyBuffer per
+// destination on flush(); ring space is reclaimed once the fence of the
+// submission that consumed it has signaled.
+class StagingRing
+{
+public:
+	StagingRing(VulkanInstance& inst, size_t size = 16 * 1024 * 1024);
+	// Waits for the copies in flight, queued ones are dropped
+	~StagingRing();
+	StagingRing(const StagingRing&) = delete;
+	StagingRing& operator=(const StagingRing&) = delete;
+
+	// Queue a copy of size bytes from data into dst at dstOffset
+	void upload(const VulkanBuffer& dst, size_t dstOffset, const void* data, size_t size);
+	// Record and submit all queued copies
+	void flush();
+	// Flush and block until all copies have completed
+	void finish();
+
+	VulkanInstance& inst;
+	VulkanBuffer buffer;
+	static const int numSubmissions = 4;
+
+private:
+	struct Copy {
+		VkBuffer dst;
+		VkBufferCopy region;
+	};
+	struct Submission {
+		VkCommandBuffer cmd;
+		VkFence fence;
+		uint64_t end;
+	};
+
+	void reclaim(bool wait);
+
+	VkCommandPool cmdPool;
+	std::vector<Submission> submissions;
+	std::deque<int> inFlight, idle;
+	std::vector<Copy> pending;
+	uint64_t head = 0, tail = 0; // monotonic byte positions, wrapped by buffer.size
+};
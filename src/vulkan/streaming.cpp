@@ -0,0 +1,250 @@
+#include "vulkan/streaming.hpp"
+#include "vulkan/instance.hpp"
+#include <algorithm>
+#include <cmath>
+using namespace std;
+
+StreamingService::StreamingService(VulkanInstance& inst, size_t budget, int decodeThreads) :
+	inst(inst), uploads(inst), budget(budget), decodePool(new ThreadPool(decodeThreads))
+{
+	ioThread = thread([this] { runIo(); });
+}
+
+StreamingService::~StreamingService()
+{
+	{
+		lock_guard<std::mutex> lock(ioMutex);
+		stop = true;
+	}
+	ioCv.notify_all();
+	ioThread.join();
+	// finishes the decodes in flight
+	decodePool.reset();
+	for (auto& job : uploading)
+		uploads.wait(job->ticket);
+	for (auto& a : assets)
+		if (a.buffer)
+			inst.retire(move(a.buffer));
+}
+
+uint32_t StreamingService::add(Source source)
+{
+	assets.emplace_back();
+	assets.back().source = move(source);
+	return (uint32_t)assets.size() - 1;
+}
+
+void StreamingService::request(uint32_t asset, int lod, float importance)
+{
+	Asset& a = assets[asset];
+	lod = min(max(lod, a.minLod), (int)a.source.lodSizes.size() - 1);
+	if (a.lastRequested != frame) {
+		a.lastRequested = frame;
+		a.wantedLod = lod;
+		a.importance = importance;
+		requested.push_back(asset);
+	} else {
+		a.wantedLod = min(a.wantedLod, lod);
+		a.importance = max(a.importance, importance);
+	}
+}
+
+const VulkanBuffer* StreamingService::buffer(uint32_t asset, int* lod) const
+{
+	const Asset& a = assets[asset];
+	if (lod)
+		*lod = a.residentLod;
+	return a.buffer.get();
+}
+
+void StreamingService::update(VkCommandBuffer cmd)
+{
+	// decoded loads go to the transfer queue
+	vector<shared_ptr<Job>> ready;
+	{
+		lock_guard<std::mutex> lock(decodedMutex);
+		ready.swap(decoded);
+	}
+	bool submit = false;
+	for (auto& job : ready) {
+		Asset& a = assets[job->asset];
+		size_t size = a.source.lodSizes[job->lod];
+		if (!job->ok || job->data.size() < size) {
+			// don't ask for this LOD again
+			committed -= size;
+			a.loadingLod = -1;
+			a.minLod = job->lod + 1;
+			stats.failed++;
+			continue;
+		}
+		job->buffer.reset(new VulkanBuffer(*inst.allocator, size, a.source.usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+		uploads.upload(*job->buffer, 0, job->data.data(), size);
+		job->data = vector<char>();
+		uploading.push_back(job);
+		submit = true;
+	}
+	if (submit) {
+		uint64_t ticket = uploads.submit();
+		for (auto& job : uploading)
+			if (job->ticket == 0)
+				job->ticket = ticket;
+	}
+
+	// swap in the LODs usable from this point of cmd on, the replaced ones
+	// retire with the frames still using them
+	uint64_t usable = uploads.acquire(cmd);
+	for (size_t i = 0; i < uploading.size();) {
+		shared_ptr<Job> job = uploading[i];
+		if (job->ticket > usable) {
+			i++;
+			continue;
+		}
+		Asset& a = assets[job->asset];
+		if (a.buffer) {
+			committed -= a.source.lodSizes[a.residentLod];
+			inst.retire(move(a.buffer));
+		}
+		a.buffer = move(job->buffer);
+		a.residentLod = job->lod;
+		a.loadingLod = -1;
+		stats.loaded++;
+		uploading[i] = move(uploading.back());
+		uploading.pop_back();
+	}
+
+	// drop reads nobody waits for anymore, refresh the priority of the others
+	{
+		lock_guard<std::mutex> lock(ioMutex);
+		for (size_t i = 0; i < ioQueue.size();) {
+			Asset& a = assets[ioQueue[i]->asset];
+			if (a.lastRequested != frame || (a.residentLod != -1 && a.wantedLod >= a.residentLod)) {
+				committed -= a.source.lodSizes[a.loadingLod];
+				a.loadingLod = -1;
+				stats.cancelled++;
+				ioQueue[i] = move(ioQueue.back());
+				ioQueue.pop_back();
+				continue;
+			}
+			ioQueue[i]->importance = a.importance;
+			i++;
+		}
+	}
+
+	Lru lru;
+	for (uint32_t i = 0; i < (uint32_t)assets.size(); i++) {
+		const Asset& a = assets[i];
+		if (a.buffer && a.loadingLod == -1 && a.lastRequested != frame) {
+			lru.assets.push_back(i);
+			lru.bytes += a.source.lodSizes[a.residentLod];
+		}
+	}
+	sort(lru.assets.begin(), lru.assets.end(), [this](uint32_t x, uint32_t y) {
+		return assets[x].lastRequested < assets[y].lastRequested;
+	});
+
+	// most important first, so they get the budget
+	sort(requested.begin(), requested.end(), [this](uint32_t x, uint32_t y) {
+		return assets[x].importance > assets[y].importance;
+	});
+	vector<shared_ptr<Job>> jobs;
+	for (uint32_t id : requested) {
+		Asset& a = assets[id];
+		if (a.loadingLod != -1)
+			continue;
+		// the wanted LOD, or the finest coarser one that fits and is still
+		// an improvement
+		int first = max(a.wantedLod, a.minLod);
+		int last = a.residentLod == -1 ? (int)a.source.lodSizes.size() - 1 : a.residentLod - 1;
+		for (int lod = first; lod <= last && a.loadingLod == -1; lod++)
+			if (reserve(a.source.lodSizes[lod], lru))
+				a.loadingLod = lod;
+		if (first <= last && a.loadingLod == -1) {
+			stats.overBudget++;
+			continue;
+		}
+		if (a.loadingLod == -1)
+			continue;
+
+		auto job = make_shared<Job>();
+		job->asset = id;
+		job->lod = a.loadingLod;
+		job->importance = a.importance;
+		job->source = &a.source;
+		jobs.push_back(job);
+	}
+	if (!jobs.empty()) {
+		{
+			lock_guard<std::mutex> lock(ioMutex);
+			ioQueue.insert(ioQueue.end(), jobs.begin(), jobs.end());
+		}
+		ioCv.notify_one();
+	}
+
+	requested.clear();
+	frame++;
+}
+
+bool StreamingService::reserve(size_t bytes, Lru& lru)
+{
+	// only evict if that makes enough room
+	if (committed + bytes > budget + lru.bytes)
+		return false;
+	while (committed + bytes > budget) {
+		Asset& a = assets[lru.assets[lru.next++]];
+		lru.bytes -= a.source.lodSizes[a.residentLod];
+		evict(a);
+	}
+	committed += bytes;
+	return true;
+}
+
+void StreamingService::evict(Asset& a)
+{
+	committed -= a.source.lodSizes[a.residentLod];
+	inst.retire(move(a.buffer));
+	a.residentLod = -1;
+	stats.evicted++;
+}
+
+void StreamingService::runIo()
+{
+	while (true) {
+		shared_ptr<Job> job;
+		{
+			unique_lock<std::mutex> lock(ioMutex);
+			ioCv.wait(lock, [this] { return stop || !ioQueue.empty(); });
+			if (stop)
+				return;
+			auto it = max_element(ioQueue.begin(), ioQueue.end(), [](const shared_ptr<Job>& x, const shared_ptr<Job>& y) {
+				return x->importance < y->importance;
+			});
+			job = *it;
+			ioQueue.erase(it);
+		}
+		job->ok = job->source->read(job->lod, job->data);
+		decodePool->enqueue([this, job] {
+			if (job->ok && job->source->decode)
+				job->source->decode(job->lod, job->data);
+			lock_guard<std::mutex> lock(decodedMutex);
+			decoded.push_back(job);
+		});
+	}
+}
+
+float StreamingService::projectedSize(const float center[3], float radius, const float eye[3], float fovY, float viewportHeight)
+{
+	float d[3] = { center[0] - eye[0], center[1] - eye[1], center[2] - eye[2] };
+	float dist = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+	if (dist <= radius)
+		return viewportHeight;
+	return radius / (dist * tan(fovY * 0.5f)) * viewportHeight;
+}
+
+int StreamingService::selectLod(float pixels, float lod0Pixels, int numLods)
+{
+	if (pixels <= 0)
+		return numLods - 1;
+	int lod = (int)floor(log2(lod0Pixels / pixels));
+	return min(max(lod, 0), numLods - 1);
+}
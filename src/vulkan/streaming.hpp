@@ -0,0 +1,126 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include "vulkan/vkmain.hpp"
+#include "vulkan/buffer.hpp"
+#include "vulkan/transfer.hpp"
+#include "util/threadpool.hpp"
+
+class VulkanInstance;
+
+// Streams buffer LODs, e.g. the vertex data of a mesh, into device-local
+// buffers in the background. Textures aren't streamed, they would need an
+// image and a buffer-to-image copy. Every frame the renderer requests the
+// LOD each visible asset should have, weighted by its screen-space
+// importance. update() starts the most important missing loads that fit
+// the VRAM budget, evicting the assets unused for longest, and swaps in
+// LODs whose upload finished. Loads run on one I/O thread, are decoded on
+// a thread pool, and are uploaded by an UploadService on the transfer
+// queue, so the frame never waits for them. Until an LOD arrives the asset
+// keeps its coarser one.
+//
+//   StreamingService streaming(inst, 256 << 20);
+//   uint32_t rock = streaming.add({ readRockLod, nullptr, rockLodSizes, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT });
+//   // every frame
+//   float px = StreamingService::projectedSize(center, radius, eye, fovY, height);
+//   streaming.request(rock, StreamingService::selectLod(px, 512, 4), px);
+//   streaming.update(cmd);
+//   if (const VulkanBuffer* vb = streaming.buffer(rock)) ...
+class StreamingService
+{
+public:
+	// I/O thread: read the raw data of lod, false if it can't be loaded
+	typedef std::function<bool(int lod, std::vector<char>& data)> ReadFn;
+	// Decode worker: turn the raw data into the uploaded data, in place
+	typedef std::function<void(int lod, std::vector<char>& data)> DecodeFn;
+
+	struct Source {
+		ReadFn read;
+		DecodeFn decode; // optional
+		std::vector<size_t> lodSizes; // uploaded bytes of each LOD, 0 is the finest
+		VkBufferUsageFlags usage;
+	};
+	struct Stats {
+		uint64_t loaded = 0, evicted = 0, cancelled = 0, failed = 0;
+		// requests that didn't fit the budget, even at a coarser LOD
+		uint64_t overBudget = 0;
+	};
+
+	// decodeThreads = 0 uses one worker per hardware thread
+	StreamingService(VulkanInstance& inst, size_t budget, int decodeThreads = 0);
+	~StreamingService();
+
+	// From the frame's thread, like request and update
+	uint32_t add(Source source);
+	// Ask for lod of asset in the coming update. Several requests in one
+	// frame keep the finest LOD and the highest importance.
+	void request(uint32_t asset, int lod, float importance);
+	// Once per frame with the frame's command buffer, before the streamed
+	// buffers are used in it
+	void update(VkCommandBuffer cmd);
+	// Buffer of the resident LOD, nullptr until the first one arrived
+	const VulkanBuffer* buffer(uint32_t asset, int* lod = nullptr) const;
+
+	// Diameter in pixels of a bounding sphere seen from eye, fovY in radians
+	static float projectedSize(const float center[3], float radius, const float eye[3], float fovY, float viewportHeight);
+	// LOD 0 is meant for lod0Pixels on screen, each further LOD for half that
+	static int selectLod(float pixels, float lod0Pixels, int numLods);
+
+	VulkanInstance& inst;
+	UploadService uploads;
+	size_t budget;
+	// Bytes of the resident LODs and of the loads in flight
+	size_t committed = 0;
+	Stats stats;
+
+private:
+	struct Asset {
+		Source source;
+		std::unique_ptr<VulkanBuffer> buffer;
+		int residentLod = -1, loadingLod = -1;
+		// finest LOD that loads, raised when a read fails
+		int minLod = 0;
+		int wantedLod = -1;
+		float importance = 0;
+		uint64_t lastRequested = 0;
+	};
+	struct Job {
+		uint32_t asset;
+		int lod;
+		float importance;
+		const Source* source;
+		std::vector<char> data;
+		bool ok = false;
+		std::unique_ptr<VulkanBuffer> buffer;
+		uint64_t ticket = 0;
+	};
+	// Resident assets not requested this frame, least recently used first
+	struct Lru {
+		std::vector<uint32_t> assets;
+		size_t next = 0, bytes = 0;
+	};
+
+	void runIo();
+	void evict(Asset& a);
+	bool reserve(size_t bytes, Lru& lru);
+
+	std::deque<Asset> assets; // stable references for the I/O thread
+	std::vector<uint32_t> requested;
+	uint64_t frame = 1;
+
+	std::vector<std::shared_ptr<Job>> ioQueue;
+	std::mutex ioMutex;
+	std::condition_variable ioCv;
+	bool stop = false;
+	std::vector<std::shared_ptr<Job>> decoded;
+	std::mutex decodedMutex;
+	std::vector<std::shared_ptr<Job>> uploading;
+
+	std::unique_ptr<ThreadPool> decodePool;
+	std::thread ioThread;
+};
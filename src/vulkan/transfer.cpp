@@ -0,0 +1,266 @@
+#include "vulkan/transfer.hpp"
+#include "vulkan/instance.hpp"
+#include <cstring>
+using namespace std;
+
+UploadService::UploadService(VulkanInstance& inst) :
+	inst(inst), queue(inst.transferQueue), familyIndex(inst.transferFamilyIndex), timeline(inst.timelineSemaphores)
+{
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.pNext = nullptr;
+	poolInfo.queueFamilyIndex = familyIndex;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	vkAssert(vkCreateCommandPool(inst.device, &poolInfo, nullptr, &pool), "create transfer pool");
+
+	if (timeline) {
+		VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+		typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+		typeInfo.pNext = nullptr;
+		typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+		typeInfo.initialValue = 0;
+
+		VkSemaphoreCreateInfo semInfo = {};
+		semInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semInfo.pNext = &typeInfo;
+		semInfo.flags = 0;
+		vkAssert(vkCreateSemaphore(inst.device, &semInfo, nullptr, &timelineSem), "create timeline");
+	}
+}
+
+UploadService::~UploadService()
+{
+	// frames that waited on batch semaphores must have retired as well, so
+	// the whole device is waited for, not just the transfer queue. The lock
+	// stays held: vkDeviceWaitIdle requires host access to every queue of the
+	// device to be externally synchronized, like a submit to each of them.
+	{
+		lock_guard<std::mutex> queueLock(inst.queueMutex);
+		inst.waitIdle();
+	}
+	auto destroy = [this](Batch& batch) {
+		releaseStaging(batch);
+		vkDestroyFence(inst.device, batch.fence, nullptr);
+		vkDestroySemaphore(inst.device, batch.sem, nullptr);
+	};
+	for (auto& batch : submitted)
+		destroy(*batch);
+	for (auto& batch : retiring)
+		destroy(*batch);
+	for (auto& batch : freeBatches)
+		destroy(*batch);
+	pending.clear();
+	vkDestroySemaphore(inst.device, timelineSem, nullptr);
+	vkDestroyCommandPool(inst.device, pool, nullptr);
+}
+
+void UploadService::upload(const VulkanBuffer& dst, size_t dstOffset, const void* data, size_t size)
+{
+	// staging memory comes from the sub-allocator, large assets get their own block
+	Copy copy;
+	copy.staging = make_unique<VulkanBuffer>(*inst.allocator, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+	memcpy(copy.staging->mem.mapped, data, size);
+	copy.dst = dst.buffer;
+	copy.region.srcOffset = 0;
+	copy.region.dstOffset = dstOffset;
+	copy.region.size = size;
+	copy.exclusive = dst.sharingMode == VK_SHARING_MODE_EXCLUSIVE;
+
+	lock_guard<std::mutex> lock(mutex);
+	pending.push_back(move(copy));
+}
+
+unique_ptr<UploadService::Batch> UploadService::newBatch()
+{
+	auto batch = make_unique<Batch>();
+	VkCommandBufferAllocateInfo cmdInfo = {};
+	cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmdInfo.pNext = nullptr;
+	cmdInfo.commandPool = pool;
+	cmdInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmdInfo.commandBufferCount = 1;
+	vkAssert(vkAllocateCommandBuffers(inst.device, &cmdInfo, &batch->cmd), "alloc transfer command buffer");
+
+	if (!timeline) {
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fenceInfo.pNext = nullptr;
+		fenceInfo.flags = 0;
+		vkAssert(vkCreateFence(inst.device, &fenceInfo, nullptr, &batch->fence), "create fence");
+
+		VkSemaphoreCreateInfo semInfo = {};
+		semInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semInfo.pNext = nullptr;
+		semInfo.flags = 0;
+		vkAssert(vkCreateSemaphore(inst.device, &semInfo, nullptr, &batch->sem), "create semaphore");
+	}
+	return batch;
+}
+
+uint64_t UploadService::submit()
+{
+	lock_guard<std::mutex> lock(mutex);
+	if (pending.empty())
+		return nextTicket - 1;
+
+	unique_ptr<Batch> batch;
+	if (freeBatches.empty()) {
+		batch = newBatch();
+	} else {
+		batch = move(freeBatches.back());
+		freeBatches.pop_back();
+	}
+	batch->ticket = nextTicket++;
+	batch->copies = move(pending);
+	pending.clear();
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.pNext = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = nullptr;
+	vkAssert(vkBeginCommandBuffer(batch->cmd, &beginInfo), "begin transfer command buffer");
+
+	vector<VkBufferMemoryBarrier> releases;
+	for (auto& copy : batch->copies) {
+		vkCmdCopyBuffer(batch->cmd, copy.staging->buffer, copy.dst, 1, &copy.region);
+		if (!copy.exclusive || !inst.dedicatedTransfer())
+			continue;
+		// release to the graphics family, acquire() records the other half
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.pNext = nullptr;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		barrier.srcQueueFamilyIndex = familyIndex;
+		barrier.dstQueueFamilyIndex = inst.queueFamilyIndex;
+		barrier.buffer = copy.dst;
+		barrier.offset = copy.region.dstOffset;
+		barrier.size = copy.region.size;
+		releases.push_back(barrier);
+	}
+	if (!releases.empty())
+		vkCmdPipelineBarrier(batch->cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+			0, nullptr, (uint32_t)releases.size(), releases.data(), 0, nullptr);
+	vkAssert(vkEndCommandBuffer(batch->cmd), "end transfer command buffer");
+
+	VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+	timelineInfo.pNext = nullptr;
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues = &batch->ticket;
+
+	VkSubmitInfo submit = {};
+	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit.pNext = timeline ? &timelineInfo : nullptr;
+	submit.commandBufferCount = 1;
+	submit.pCommandBuffers = &batch->cmd;
+	submit.signalSemaphoreCount = 1;
+	submit.pSignalSemaphores = timeline ? &timelineSem : &batch->sem;
+	if (!timeline)
+		vkAssert(vkResetFences(inst.device, 1, &batch->fence), "reset fence");
+	{
+		lock_guard<std::mutex> queueLock(inst.queueMutex);
+		vkAssert(vkQueueSubmit(queue, 1, &submit, batch->fence), "submit transfer");
+	}
+
+	uint64_t ticket = batch->ticket;
+	submitted.push_back(move(batch));
+	return ticket;
+}
+
+bool UploadService::complete(const Batch& batch)
+{
+	if (timeline) {
+		uint64_t value;
+		vkAssert(inst.pfnGetSemaphoreCounterValue(inst.device, timelineSem, &value), "get timeline value");
+		return value >= batch.ticket;
+	}
+	return vkGetFenceStatus(inst.device, batch.fence) == VK_SUCCESS;
+}
+
+bool UploadService::isComplete(uint64_t ticket)
+{
+	lock_guard<std::mutex> lock(mutex);
+	for (auto& batch : submitted)
+		if (batch->ticket == ticket)
+			return complete(*batch);
+	return ticket < nextTicket;
+}
+
+void UploadService::wait(uint64_t ticket)
+{
+	lock_guard<std::mutex> lock(mutex);
+	if (timeline) {
+		VkSemaphoreWaitInfoKHR waitInfo = {};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+		waitInfo.pNext = nullptr;
+		waitInfo.flags = 0;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &timelineSem;
+		waitInfo.pValues = &ticket;
+		vkAssert(inst.pfnWaitSemaphores(inst.device, &waitInfo, UINT64_MAX), "wait timeline");
+		return;
+	}
+	for (auto& batch : submitted)
+		if (batch->ticket == ticket)
+			vkAssert(vkWaitForFences(inst.device, 1, &batch->fence, VK_TRUE, UINT64_MAX), "wait fence");
+}
+
+void UploadService::releaseStaging(Batch& batch)
+{
+	batch.copies.clear();
+}
+
+uint64_t UploadService::acquire(VkCommandBuffer cmd)
+{
+	lock_guard<std::mutex> lock(mutex);
+
+	// binary semaphores can be reused once the frame that waited on them retired
+	uint64_t completed = inst.completedFrame();
+	while (!retiring.empty() && retiring.front()->retireFrame <= completed) {
+		freeBatches.push_back(move(retiring.front()));
+		retiring.pop_front();
+	}
+
+	vector<VkBufferMemoryBarrier> acquires;
+	uint64_t first = acquired;
+	while (!submitted.empty() && complete(*submitted.front())) {
+		unique_ptr<Batch> batch = move(submitted.front());
+		submitted.pop_front();
+
+		for (auto& copy : batch->copies) {
+			if (!copy.exclusive || !inst.dedicatedTransfer())
+				continue;
+			VkBufferMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			barrier.pNext = nullptr;
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = dstAccess;
+			barrier.srcQueueFamilyIndex = familyIndex;
+			barrier.dstQueueFamilyIndex = inst.queueFamilyIndex;
+			barrier.buffer = copy.dst;
+			barrier.offset = copy.region.dstOffset;
+			barrier.size = copy.region.size;
+			acquires.push_back(barrier);
+		}
+		releaseStaging(*batch);
+		acquired = batch->ticket;
+
+		// the copies are done, the wait only orders the acquire after the release
+		if (timeline) {
+			freeBatches.push_back(move(batch));
+		} else {
+			inst.addFrameWait(batch->sem, dstStages);
+			batch->retireFrame = inst.frameNumber + 1;
+			retiring.push_back(move(batch));
+		}
+	}
+	if (timeline && acquired != first)
+		inst.addFrameWait(timelineSem, dstStages, acquired);
+
+	if (!acquires.empty())
+		vkCmdPipelineBarrier(cmd, dstStages, dstStages, 0, 0, nullptr,
+			(uint32_t)acquires.size(), acquires.data(), 0, nullptr);
+	return acquired;
+}
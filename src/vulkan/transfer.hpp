@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include "vulkan/vkmain.hpp"
+#include "vulkan/buffer.hpp"
+
+class VulkanInstance;
+
+// Background uploads on the transfer queue (VulkanInstance::dedicatedTransfer),
+// so streaming large assets doesn't compete with frame rendering.
+// Copies are batched by submit(), which returns a ticket. Completion is
+// tracked with the instance's timeline semaphore type when available, and
+// with a fence plus binary semaphore per batch otherwise.
+// Destination buffers created exclusive are released by the transfer family
+// and must be acquired by graphics before use: acquire() records the
+// acquire barriers of every finished batch into a frame's command buffer,
+// so the frame never waits for an unfinished copy.
+// upload() and submit() may be called from any thread.
+class UploadService
+{
+public:
+	UploadService(VulkanInstance& inst);
+	~UploadService();
+
+	// data is copied into staging memory before returning
+	void upload(const VulkanBuffer& dst, size_t dstOffset, const void* data, size_t size);
+	// Submit the uploads queued so far, returns their ticket
+	uint64_t submit();
+	bool isComplete(uint64_t ticket);
+	void wait(uint64_t ticket);
+
+	// Call once per frame with the frame's command buffer, before the uploaded
+	// buffers are used. Returns the highest ticket whose buffers may be used
+	// from this point of the command buffer on.
+	uint64_t acquire(VkCommandBuffer cmd);
+
+	VulkanInstance& inst;
+	VkQueue queue;
+	uint32_t familyIndex;
+	bool timeline;
+	// Stages of the graphics queue that consume uploaded data
+	VkPipelineStageFlags dstStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	VkAccessFlags dstAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+		VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+private:
+	struct Copy {
+		std::unique_ptr<VulkanBuffer> staging;
+		VkBuffer dst;
+		VkBufferCopy region;
+		bool exclusive;
+	};
+	struct Batch {
+		VkCommandBuffer cmd;
+		VkFence fence = VK_NULL_HANDLE;
+		VkSemaphore sem = VK_NULL_HANDLE;
+		uint64_t ticket = 0;
+		uint64_t retireFrame = 0; // frame whose submission waited on sem
+		std::vector<Copy> copies;
+	};
+
+	bool complete(const Batch& batch);
+	void releaseStaging(Batch& batch);
+	std::unique_ptr<Batch> newBatch();
+
+	VkCommandPool pool;
+	VkSemaphore timelineSem = VK_NULL_HANDLE;
+	std::vector<Copy> pending;
+	std::deque<std::unique_ptr<Batch>> submitted, retiring;
+	std::vector<std::unique_ptr<Batch>> freeBatches;
+	uint64_t nextTicket = 1, acquired = 0;
+	std::mutex mutex;
+};
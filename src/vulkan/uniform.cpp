@@ -0,0 +1,33 @@
+#include "vulkan/uniform.hpp"
+#include "vulkan/instance.hpp"
+using namespace std;
+
+static size_t alignUp(size_t v, size_t alignment)
+{
+	return (v + alignment - 1) / alignment * alignment;
+}
+
+UniformRing::UniformRing(MemoryAllocator& allocator, const GpuInfo& gpu, size_t frameSize, int numFrames) :
+	buffer(allocator, alignUp(frameSize, (size_t)gpu.gpuProps.limits.minUniformBufferOffsetAlignment) * numFrames,
+		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT),
+	alignment((size_t)gpu.gpuProps.limits.minUniformBufferOffsetAlignment), numFrames(numFrames)
+{
+	this->frameSize = alignUp(frameSize, alignment);
+	beginFrame(0);
+}
+
+void UniformRing::beginFrame(int frame)
+{
+	cursor = frame * frameSize;
+	frameEnd = cursor + frameSize;
+}
+
+bool UniformRing::allocate(size_t size, uint32_t& offset, void*& ptr)
+{
+	if (cursor + size > frameEnd)
+		return false;
+	offset = (uint32_t)cursor;
+	cursor = alignUp(cursor + size, alignment);
+	ptr = buffer.mem.mapped + offset;
+	return true;
+}
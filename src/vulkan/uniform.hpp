@@ -0,0 +1,43 @@
+#pragma once
+#include "vulkan/vkmain.hpp"
+#include "vulkan/buffer.hpp"
+
+struct GpuInfo;
+
+// Per-frame streaming allocator for uniform data. One persistently mapped
+// buffer holds a slice per frame in flight; per-object blocks are
+// sub-allocated from the current frame's slice and bound through a single
+// VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC descriptor plus a dynamic offset.
+class UniformRing
+{
+public:
+	UniformRing(MemoryAllocator& allocator, const GpuInfo& gpu, size_t frameSize, int numFrames);
+
+	// Start writing into the slice of the given frame; its previous contents
+	// must no longer be in use by the GPU
+	void beginFrame(int frame);
+	// Reserve size bytes: the dynamic offset and a pointer to write to.
+	// False if the frame's slice is full, size the ring for the peak.
+	bool allocate(size_t size, uint32_t& offset, void*& ptr);
+	template<class T> bool push(const T& data, uint32_t& offset);
+
+	VulkanBuffer buffer;
+	size_t frameSize, alignment;
+	int numFrames;
+	size_t cursor = 0, frameEnd = 0;
+};
+
+
+// ----------------------------------------------------
+// IMPLEMENTATION
+// ----------------------------------------------------
+
+template<class T>
+bool UniformRing::push(const T& data, uint32_t& offset)
+{
+	void* ptr;
+	if (!allocate(sizeof(T), offset, ptr))
+		return false;
+	*static_cast<T*>(ptr) = data;
+	return true;
+}
@@ -0,0 +1,86 @@
+#include "vulkan/vertexformat.hpp"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+using namespace std;
+
+uint16_t toHalf(float f)
+{
+	uint32_t x;
+	memcpy(&x, &f, sizeof(x));
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t absx = x & 0x7fffffff;
+
+	// inf and nan
+	if (absx >= 0x7f800000)
+		return (uint16_t)(sign | 0x7c00 | (absx > 0x7f800000 ? 0x200 : 0));
+	// rounds to 65520 or more
+	if (absx >= 0x477ff000)
+		return (uint16_t)(sign | 0x7c00);
+	// subnormal, or zero below 2^-25
+	if (absx < 0x38800000) {
+		if (absx <= 0x33000000)
+			return (uint16_t)sign;
+		uint32_t e = absx >> 23, m = (absx & 0x7fffff) | 0x800000;
+		uint32_t shift = 126 - e;
+		uint32_t h = m >> shift, rem = m & ((1u << shift) - 1), half = 1u << (shift - 1);
+		if (rem > half || (rem == half && (h & 1)))
+			h++;
+		return (uint16_t)(sign | h);
+	}
+	// rebias the exponent and round the mantissa to nearest even, a carry
+	// into the exponent is still correct
+	uint32_t h = (absx - 0x38000000) >> 13, rem = absx & 0x1fff;
+	if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+		h++;
+	return (uint16_t)(sign | h);
+}
+
+Half2 half2(float x, float y)
+{
+	return {{ toHalf(x), toHalf(y) }};
+}
+
+Half4 half4(float x, float y, float z, float w)
+{
+	return {{ toHalf(x), toHalf(y), toHalf(z), toHalf(w) }};
+}
+
+static int16_t snorm16(float f)
+{
+	return (int16_t)lround(min(max(f, -1.0f), 1.0f) * 32767.0f);
+}
+
+static uint8_t unorm8(float f)
+{
+	return (uint8_t)lround(min(max(f, 0.0f), 1.0f) * 255.0f);
+}
+
+static uint16_t unorm16(float f)
+{
+	return (uint16_t)lround(min(max(f, 0.0f), 1.0f) * 65535.0f);
+}
+
+OctNormal octNormal(float x, float y, float z)
+{
+	// project onto the octahedron, fold the lower half over the upper
+	float l1 = fabs(x) + fabs(y) + fabs(z);
+	float u = l1 > 0 ? x / l1 : 0, v = l1 > 0 ? y / l1 : 0;
+	if (z < 0) {
+		float fu = (1.0f - fabs(v)) * (u >= 0 ? 1.0f : -1.0f);
+		float fv = (1.0f - fabs(u)) * (v >= 0 ? 1.0f : -1.0f);
+		u = fu;
+		v = fv;
+	}
+	return {{ snorm16(u), snorm16(v) }};
+}
+
+Unorm8x4 unorm8x4(float r, float g, float b, float a)
+{
+	return {{ unorm8(r), unorm8(g), unorm8(b), unorm8(a) }};
+}
+
+Unorm16x2 unorm16x2(float u, float v)
+{
+	return {{ unorm16(u), unorm16(v) }};
+}
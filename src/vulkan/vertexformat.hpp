@@ -0,0 +1,114 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include "vulkan/vkmain.hpp"
+
+// Compact attribute types. The vertex shader still declares vec4/vec2
+// inputs, the fetch unit expands them.
+
+// Half float, e.g. positions of meshes within a few hundred units of their
+// origin. Use 4 components, 3 component 16 bit formats are rarely supported.
+struct Half2 { uint16_t v[2]; };
+struct Half4 { uint16_t v[4]; };
+// Octahedral unit vector in two snorm16, decoded in the shader with
+//   vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+//   float t = max(-n.z, 0.0);
+//   n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+//   n = normalize(n);
+struct OctNormal { int16_t v[2]; };
+// Colors and other [0,1] data
+struct Unorm8x4 { uint8_t v[4]; };
+struct Unorm16x2 { uint16_t v[2]; };
+
+uint16_t toHalf(float f);
+Half2 half2(float x, float y);
+Half4 half4(float x, float y, float z, float w = 1.0f);
+OctNormal octNormal(float x, float y, float z);
+Unorm8x4 unorm8x4(float r, float g, float b, float a = 1.0f);
+Unorm16x2 unorm16x2(float u, float v);
+
+// VkFormat of an attribute type
+template<class T> struct VertexFormat;
+template<> struct VertexFormat<float> { static constexpr VkFormat format = VK_FORMAT_R32_SFLOAT; };
+template<> struct VertexFormat<float[2]> { static constexpr VkFormat format = VK_FORMAT_R32G32_SFLOAT; };
+template<> struct VertexFormat<float[3]> { static constexpr VkFormat format = VK_FORMAT_R32G32B32_SFLOAT; };
+template<> struct VertexFormat<float[4]> { static constexpr VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT; };
+template<> struct VertexFormat<uint32_t> { static constexpr VkFormat format = VK_FORMAT_R32_UINT; };
+template<> struct VertexFormat<int32_t> { static constexpr VkFormat format = VK_FORMAT_R32_SINT; };
+template<> struct VertexFormat<Half2> { static constexpr VkFormat format = VK_FORMAT_R16G16_SFLOAT; };
+template<> struct VertexFormat<Half4> { static constexpr VkFormat format = VK_FORMAT_R16G16B16A16_SFLOAT; };
+template<> struct VertexFormat<OctNormal> { static constexpr VkFormat format = VK_FORMAT_R16G16_SNORM; };
+template<> struct VertexFormat<Unorm8x4> { static constexpr VkFormat format = VK_FORMAT_R8G8B8A8_UNORM; };
+template<> struct VertexFormat<Unorm16x2> { static constexpr VkFormat format = VK_FORMAT_R16G16_UNORM; };
+
+struct VertexAttribute {
+	uint32_t location;
+	VkFormat format;
+	uint32_t offset, size;
+};
+
+// Attribute of type A at offset, e.g.
+//   vertexAttribute<decltype(Vertex::pos)>(0, offsetof(Vertex, pos))
+template<class A>
+constexpr VertexAttribute vertexAttribute(uint32_t location, size_t offset)
+{
+	return { location, VertexFormat<A>::format, (uint32_t)offset, (uint32_t)sizeof(A) };
+}
+
+// Describes a vertex type T to Vulkan. T lists its attributes in a
+// static constexpr function:
+//
+//   struct Vertex {
+//       Half4 pos;
+//       Unorm8x4 color;
+//       static constexpr std::array<VertexAttribute, 2> attributes() {
+//           return {{ vertexAttribute<Half4>(0, offsetof(Vertex, pos)),
+//                     vertexAttribute<Unorm8x4>(1, offsetof(Vertex, color)) }};
+//       }
+//   };
+//   state.addVertexLayout<Vertex>();
+//
+// Streams split by attribute, e.g. positions alone for depth passes, are
+// one type per binding: the depth pipeline adds only the position stream,
+// the main pipeline the position stream at binding 0 and the rest at 1.
+template<class T>
+struct VertexLayout
+{
+	static constexpr size_t count = std::tuple_size<decltype(T::attributes())>::value;
+	typedef std::array<VkVertexInputAttributeDescription, count> Attributes;
+
+	static constexpr VkVertexInputBindingDescription binding(uint32_t binding = 0, VkVertexInputRate rate = VK_VERTEX_INPUT_RATE_VERTEX)
+	{
+		return { binding, (uint32_t)sizeof(T), rate };
+	}
+	static constexpr Attributes attributes(uint32_t binding = 0)
+	{
+		return describe(T::attributes(), binding, std::make_index_sequence<count>());
+	}
+
+	// Attributes inside the vertex, 4 byte aligned, with distinct locations
+	static constexpr bool valid()
+	{
+		const auto attrs = T::attributes();
+		for (size_t i = 0; i < count; i++) {
+			if (attrs[i].offset % 4 != 0 || attrs[i].offset + attrs[i].size > sizeof(T))
+				return false;
+			for (size_t k = 0; k < i; k++)
+				if (attrs[k].location == attrs[i].location)
+					return false;
+		}
+		return true;
+	}
+	static_assert(sizeof(T) % 4 == 0, "vertex stride must be a multiple of 4");
+
+private:
+	// through a const reference: the non-const std::array::operator[] isn't
+	// constexpr in C++14
+	template<size_t... I>
+	static constexpr Attributes describe(const std::array<VertexAttribute, count>& attrs, uint32_t binding, std::index_sequence<I...>)
+	{
+		return {{ { attrs[I].location, binding, attrs[I].format, attrs[I].offset }... }};
+	}
+};
@@ -10,7 +10,9 @@
 #endif
 
 #include <vulkan/vulkan.h>
+#ifdef _WIN32
 #include <vulkan/vk_sdk_platform.h>
+#endif
 #include <string>
 #include "util/util.hpp"
 
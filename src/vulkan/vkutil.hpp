@@ -4,3 +4,13 @@
 uint32_t memoryTypeFromProps(const VkPhysicalDeviceMemoryProperties& props, 
 	uint32_t typeBits, VkFlags requirements_mask);
 
+// Transition all mip levels of an image, waiting only for the stages that
+// use oldLayout and blocking only those that use newLayout
+void queueImageLayout(VkCommandBuffer cmd, VkImage image, VkImageAspectFlags aspectMask,
+	VkImageLayout oldLayout, VkImageLayout newLayout);
+
+// Stages and accesses that use an image in the given layout, for deriving
+// barriers from layout transitions
+void layoutAccess(VkImageLayout layout, VkPipelineStageFlags& stages, VkAccessFlags& access);
+// The subset of access that are writes, the only ones a barrier has to make available
+VkAccessFlags writeAccess(VkAccessFlags access);